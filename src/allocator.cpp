@@ -0,0 +1,187 @@
+//allocator.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstdlib>
+
+#include "allocator.h"
+
+using namespace cam1394;
+
+static inline size_t alignUp(size_t v, size_t a) {
+	return (v + a - 1) & ~(a - 1);
+}
+
+#ifndef NOOPENCV
+/* OpenCV keeps the reference count with the pixels, put it in front of them */
+#define MAT_HEADER 64
+
+void mat_allocator::allocate(int dims, const int* sizes, int type, int*& refcount,
+							 uchar*& datastart, uchar*& data, size_t* step) {
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--) {
+		step[i] = total;
+		total *= sizes[i];
+	}
+
+	uchar *mem = (uchar*)alloc->allocate(total + MAT_HEADER);
+	if (mem == NULL)
+		CV_Error(CV_StsNoMem, "frame allocator is out of memory");
+
+	refcount  = (int*)mem;
+	*refcount = 1;
+	datastart = data = mem + MAT_HEADER;
+}
+
+void mat_allocator::deallocate(int* refcount, uchar* datastart, uchar* data) {
+	if (refcount != NULL)
+		alloc->deallocate(refcount);
+}
+#endif
+
+void* heap_allocator::allocate(size_t size) {
+	return malloc(size);
+}
+
+void heap_allocator::deallocate(void* ptr) {
+	free(ptr);
+}
+
+aligned_allocator::aligned_allocator(size_t alignment) : alignment(alignment) {
+	if (this->alignment < sizeof(void*))
+		this->alignment = sizeof(void*);
+}
+
+void* aligned_allocator::allocate(size_t size) {
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+		return NULL;
+	return ptr;
+}
+
+void aligned_allocator::deallocate(void* ptr) {
+	free(ptr);
+}
+
+arena_allocator::arena_allocator(size_t capacity, size_t alignment) :
+	base(NULL), capacity(capacity), alignment(alignment), used(0), owned(true) {
+	if (posix_memalign((void**)&base, alignment, capacity) != 0) {
+		fprintf(stderr, "ERROR: Failed to allocate a %zu byte arena\n", capacity);
+		base = NULL;
+		this->capacity = 0;
+	}
+}
+
+arena_allocator::arena_allocator(void* region, size_t capacity, size_t alignment) :
+	base((unsigned char*)region), capacity(capacity), alignment(alignment), used(0), owned(false) {
+	/* start at the first aligned address of the region */
+	used = alignUp((size_t)base, alignment) - (size_t)base;
+	if (used > capacity)
+		used = capacity;
+}
+
+arena_allocator::~arena_allocator() {
+	if (owned)
+		free(base);
+}
+
+void* arena_allocator::allocate(size_t size) {
+	std::lock_guard<std::mutex> guard(lock);
+	size = alignUp(size ? size : 1, alignment);
+
+	std::multimap<size_t, void*>::iterator it = free_blocks.lower_bound(size);
+	if (it != free_blocks.end()) {
+		void *ptr = it->second;
+		blocks[ptr] = it->first;
+		free_blocks.erase(it);
+		return ptr;
+	}
+
+	if (capacity - used < size)
+		return NULL;
+
+	void *ptr = base + used;
+	used += size;
+	blocks[ptr] = size;
+	return ptr;
+}
+
+void arena_allocator::deallocate(void* ptr) {
+	if (ptr == NULL)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::map<void*, size_t>::iterator it = blocks.find(ptr);
+	if (it == blocks.end()) {
+		/* a second free would hand the block out twice */
+		fprintf(stderr, "ERROR: Freeing %p which is not in use in this arena\n", ptr);
+		return;
+	}
+	free_blocks.insert(std::make_pair(it->second, ptr));
+	blocks.erase(it);
+}
+
+size_t arena_allocator::remaining() {
+	std::lock_guard<std::mutex> guard(lock);
+	return capacity - used;
+}
+
+host_allocator::host_allocator(int node, bool huge, bool lock) :
+	node(node), huge(huge), locked(lock) {}
+
+void host_allocator::configure(int node, bool huge, bool lock) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->node   = node;
+	this->huge   = huge;
+	this->locked = lock;
+}
+
+void* host_allocator::allocate(size_t size) {
+	std::lock_guard<std::mutex> guard(lock);
+	host_buffer buf;
+
+	if (allocHostBuffer(size, node, huge, locked, &buf) < 0)
+		return NULL;
+
+	buffers[buf.data] = buf;
+	newest = buf;
+	return buf.data;
+}
+
+void host_allocator::deallocate(void* ptr) {
+	if (ptr == NULL)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::map<void*, host_buffer>::iterator it = buffers.find(ptr);
+	if (it == buffers.end()) {
+		fprintf(stderr, "ERROR: Freeing %p which is not from this allocator\n", ptr);
+		return;
+	}
+	freeHostBuffer(&it->second);
+	buffers.erase(it);
+}
+
+host_buffer host_allocator::last() {
+	std::lock_guard<std::mutex> guard(lock);
+	return newest;
+}
+
+frame_allocator* cam1394::heapAllocator() {
+	static heap_allocator heap;
+	return &heap;
+}
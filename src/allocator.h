@@ -0,0 +1,184 @@
+//allocator.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file allocator.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#ifndef NOOPENCV
+#include <cv.h>
+#endif
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+#include "realtime.h"
+
+namespace cam1394
+{
+	class frame_allocator;
+
+#ifndef NOOPENCV
+	/*!\brief Lets cv::Mat take its pixels from a frame_allocator
+	 */
+	class mat_allocator : public cv::MatAllocator
+	{
+	public:
+		mat_allocator(frame_allocator* alloc) : alloc(alloc) {}
+
+		void allocate(int dims, const int* sizes, int type, int*& refcount,
+					  uchar*& datastart, uchar*& data, size_t* step);
+		void deallocate(int* refcount, uchar* datastart, uchar* data);
+
+	private:
+		frame_allocator *alloc;
+	};
+#endif
+
+	/*!
+	 * \class frame_allocator
+	 * \brief Source of every host side frame and scratch buffer of a camera
+	 *
+	 * Implementations must be thread safe, buffers may be freed from a
+	 * different thread than the one that allocated them.  An allocator has
+	 * to outlive every buffer it handed out, including cv::Mat and
+	 * cam1394Image copies that are still alive.
+	 */
+	class frame_allocator
+	{
+	public:
+#ifndef NOOPENCV
+		frame_allocator() : mat(this) {}
+#endif
+		virtual ~frame_allocator() {}
+
+		/*!\brief Allocates a buffer
+		 * \param size bytes to allocate
+		 * \return the buffer, NULL if failure
+		 */
+		virtual void* allocate(size_t size) = 0;
+
+		/*!\brief Frees a buffer from #allocate, NULL is ignored
+		 */
+		virtual void deallocate(void* ptr) = 0;
+
+#ifndef NOOPENCV
+		/*!\brief Gets an adapter to set as cv::Mat::allocator */
+		cv::MatAllocator* matAllocator() { return &mat; }
+
+	private:
+		mat_allocator mat;
+#endif
+	};
+
+	/*!\brief malloc and free, what cam1394Image used before allocators
+	 */
+	class heap_allocator : public frame_allocator
+	{
+	public:
+		void* allocate(size_t size);
+		void deallocate(void* ptr);
+	};
+
+	/*!\brief Buffers aligned for SIMD loads or DMA engines
+	 */
+	class aligned_allocator : public frame_allocator
+	{
+	public:
+		/*!\param alignment power of two, at least sizeof(void*) */
+		aligned_allocator(size_t alignment = 64);
+
+		void* allocate(size_t size);
+		void deallocate(void* ptr);
+
+	private:
+		size_t alignment;
+	};
+
+	/*!\brief Carves buffers out of one region allocated up front
+	 *
+	 * Freed buffers are kept and handed out again for requests of up to
+	 * their size, so a steady stream of equally sized frames never goes
+	 * back to the system.  The region can be given by the caller, e.g.
+	 * pinned or registered memory.
+	 */
+	class arena_allocator : public frame_allocator
+	{
+	public:
+		/*!\brief Allocates a region of capacity bytes from the heap */
+		arena_allocator(size_t capacity, size_t alignment = 64);
+		/*!\brief Uses memory owned by the caller, which must outlive the arena */
+		arena_allocator(void* region, size_t capacity, size_t alignment = 64);
+		~arena_allocator();
+
+		/*!\return the buffer, NULL if the arena is exhausted */
+		void* allocate(size_t size);
+		/*!\brief Returns a buffer to the arena, a buffer that is not in
+		 * use is rejected with an error */
+		void deallocate(void* ptr);
+
+		/*!\brief Gets the bytes of the region that were never handed out */
+		size_t remaining();
+
+	private:
+		std::mutex lock;
+		unsigned char *base;
+		size_t capacity;
+		size_t alignment;
+		size_t used;
+		bool owned;
+
+		/*!\brief size of every block in use, by address */
+		std::map<void*, size_t> blocks;
+		/*!\brief freed blocks, by size */
+		std::multimap<size_t, void*> free_blocks;
+	};
+
+	/*!\brief Page mapped buffers placed on a NUMA node, see allocHostBuffer
+	 */
+	class host_allocator : public frame_allocator
+	{
+	public:
+		host_allocator(int node = -1, bool huge = false, bool lock = false);
+
+		/*!\brief Changes the placement of buffers allocated from now on */
+		void configure(int node, bool huge, bool lock);
+
+		void* allocate(size_t size);
+		void deallocate(void* ptr);
+
+		/*!\brief Gets the mapping of the newest buffer */
+		host_buffer last();
+
+	private:
+		std::mutex lock;
+		int node;
+		bool huge;
+		bool locked;
+		host_buffer newest;
+		std::map<void*, host_buffer> buffers;
+	};
+
+	/*!\brief Gets the process wide heap_allocator */
+	frame_allocator* heapAllocator();
+};
+#endif
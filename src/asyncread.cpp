@@ -0,0 +1,216 @@
+//asyncread.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cstring>
+
+#include "asyncread.h"
+
+using namespace cam1394;
+
+async_reader::async_reader(camera* cam) : cam(cam), running(true), busy(false), abort(false) {
+	readyfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	wakefd  = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (readyfd < 0 || wakefd < 0) {
+		fprintf(stderr, "ERROR: Failed to create eventfd: %s\n", strerror(errno));
+		running = false;
+		return;
+	}
+
+	reader = std::thread(&async_reader::readerLoop, this);
+}
+
+async_reader::~async_reader() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+	}
+	cancel();
+	pending.notify_all();
+	if (reader.joinable())
+		reader.join();
+
+	/* nobody is left to dispatch the callbacks of cancelled reads */
+	dispatch();
+
+	if (readyfd >= 0)
+		close(readyfd);
+	if (wakefd >= 0)
+		close(wakefd);
+}
+
+int async_reader::fd() {
+	return readyfd;
+}
+
+std::future<int> async_reader::read_async(cam1394Image* image) {
+	std::promise<int> *promise = new std::promise<int>;
+	std::future<int> future = promise->get_future();
+
+	std::lock_guard<std::mutex> guard(lock);
+	request r = {image, NULL, NULL, promise, 0};
+
+	if (!running) {
+		complete(r, -1);
+		return future;
+	}
+
+	requests.push_back(r);
+	pending.notify_one();
+	return future;
+}
+
+int async_reader::read_async(cam1394Image* image, read_callback cb, void* user) {
+	if (cb == NULL) {
+		fprintf(stderr, "ERROR: read_async needs a callback\n");
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!running) {
+		fprintf(stderr, "ERROR: Async reader is not running\n");
+		return -1;
+	}
+
+	request r = {image, cb, user, NULL, 0};
+	requests.push_back(r);
+	pending.notify_one();
+	return 0;
+}
+
+/* Hands a result to the waiter, called with the lock held */
+void async_reader::complete(request& r, int result) {
+	if (r.promise != NULL) {
+		r.promise->set_value(result);
+		delete r.promise;
+		return;
+	}
+
+	r.result = result;
+	completed.push_back(r);
+
+	uint64_t one = 1;
+	if (write(readyfd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "ERROR: Failed to signal completion: %s\n", strerror(errno));
+}
+
+int async_reader::dispatch() {
+	std::deque<request> done;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		uint64_t count;
+		if (read(readyfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "ERROR: Failed to read eventfd: %s\n", strerror(errno));
+		done.swap(completed);
+	}
+
+	/* without the lock so a callback can queue the next read */
+	for (size_t i = 0; i < done.size(); i++)
+		done[i].cb(done[i].result, done[i].image, done[i].user);
+
+	return done.size();
+}
+
+void async_reader::cancel() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	/* the request being read is failed by the reader thread once it wakes */
+	size_t keep = busy ? 1 : 0;
+	while (requests.size() > keep) {
+		complete(requests.back(), -1);
+		requests.pop_back();
+	}
+
+	if (busy) {
+		abort = true;
+		uint64_t one = 1;
+		if (write(wakefd, &one, sizeof(one)) < 0)
+			fprintf(stderr, "ERROR: Failed to wake reader: %s\n", strerror(errno));
+	}
+}
+
+/* Waits until the capture descriptor or the wake eventfd is readable.
+ * Returns 1 for a frame, 0 when woken, <0 on failure. */
+int async_reader::waitFrame() {
+	struct pollfd fds[2];
+	fds[0].fd     = cam->getFileDescriptor();
+	fds[0].events = POLLIN;
+	fds[1].fd     = wakefd;
+	fds[1].events = POLLIN;
+
+	if (fds[0].fd < 0) {
+		fprintf(stderr, "ERROR: Camera is not capturing\n");
+		return -1;
+	}
+
+	while (::poll(fds, 2, -1) < 0) {
+		if (errno != EINTR) {
+			fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (fds[1].revents & POLLIN) {
+		uint64_t count;
+		if (read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "ERROR: Failed to read eventfd: %s\n", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
+void async_reader::readerLoop() {
+	std::unique_lock<std::mutex> lk(lock);
+
+	while (1) {
+		pending.wait(lk, [this] { return !running || !requests.empty(); });
+		if (requests.empty())
+			break;
+
+		/* the request stays queued while it is read, cancel leaves it alone */
+		cam1394Image *image = requests.front().image;
+		busy  = true;
+		abort = false;
+
+		/* a cancel that came after the last read finished must not fail this one */
+		uint64_t count;
+		if (read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "ERROR: Failed to read eventfd: %s\n", strerror(errno));
+		lk.unlock();
+
+		/* 0 means woken or the ring was already drained, wait again unless cancelled */
+		int ret;
+		do {
+			ret = waitFrame();
+			if (ret > 0)
+				ret = cam->poll(image);
+		} while (ret == 0 && !abort);
+		if (ret == 0)
+			ret = -1;
+
+		lk.lock();
+		busy = false;
+		complete(requests.front(), ret);
+		requests.pop_front();
+	}
+}
@@ -0,0 +1,118 @@
+//asyncread.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file asyncread.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef ASYNCREAD_H
+#define ASYNCREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Completion of async_reader::read_async
+	 * \param result	1 if image holds a new frame, <0 if the read failed
+	 * 					or was cancelled
+	 * \param image		the image given to read_async
+	 * \param user		pointer given to read_async
+	 */
+	typedef void (*read_callback)(int result, cam1394Image* image, void* user);
+
+	/*!
+	 * \class async_reader
+	 * \brief Reads a camera without blocking the calling thread
+	 *
+	 * Requests are queued and served in order by a reader thread that
+	 * waits on the capture file descriptor, so each request gets the next
+	 * frame from the DMA ring.  Futures are fulfilled from the reader
+	 * thread.  Callbacks are run by #dispatch instead, so an event loop can
+	 * register #fd and run them on its own thread when it is readable.
+	 */
+	class async_reader
+	{
+	public:
+		/*!\param cam	an open camera, not to be read by anyone else meanwhile */
+		async_reader(camera* cam);
+		/*!\brief Cancels every pending request, see #cancel */
+		~async_reader();
+
+		/*!\brief Gets an eventfd that is readable while callbacks wait for #dispatch
+		 * \return the descriptor, <0 if the reader could not be set up
+		 */
+		int fd();
+
+		/*!\brief Queues a read of the next frame into image
+		 *
+		 * image must stay alive and untouched until the future is ready.
+		 * \return future holding 1 if success, <0 if failure or cancelled
+		 */
+		std::future<int> read_async(cam1394Image* image);
+
+		/*!\brief Queues a read of the next frame into image, cb is run by #dispatch
+		 * \return 0 if queued, <0 if failure
+		 */
+		int read_async(cam1394Image* image, read_callback cb, void* user);
+
+		/*!\brief Runs the callbacks of finished reads on the calling thread
+		 * \return number of callbacks run
+		 */
+		int dispatch();
+
+		/*!\brief Fails every request that has not started with -1
+		 *
+		 * Their callbacks still run from #dispatch.
+		 */
+		void cancel();
+
+	private:
+		struct request {
+			cam1394Image *image;
+			read_callback cb;
+			void *user;
+			std::promise<int> *promise;
+			int result;
+		};
+
+		void readerLoop();
+		int waitFrame();
+		void complete(request& r, int result);
+
+		camera *cam;
+		int readyfd;
+		int wakefd;
+		bool running;
+		bool busy;
+		std::atomic<bool> abort;
+
+		std::mutex lock;
+		std::condition_variable pending;
+		std::deque<request> requests;
+		std::deque<request> completed;
+		std::thread reader;
+	};
+};
+#endif
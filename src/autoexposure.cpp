@@ -0,0 +1,248 @@
+//autoexposure.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "autoexposure.h"
+#include "camera.h"
+#include "colorstage.h"
+
+using namespace cam1394;
+
+/* software white balance gains stay within two stops of unity */
+#define BALANCE_GAIN_MIN 0.25
+#define BALANCE_GAIN_MAX 4.0
+
+/* a metered mean below this is treated as black, its ratio to the target is meaningless */
+#define MEAN_FLOOR 1e-4
+
+auto_exposure::auto_exposure(camera* cam, const exposure_settings& settings) :
+	cam(cam), stage(NULL), settings(settings), started(false), skipped(0),
+	shutter(0), gain(0), written_shutter(0), written_gain(0), balance_min(0), balance_max(0) {
+	memset(&result, 0, sizeof(result));
+	balance[0] = balance[1] = 0;
+	written_balance[0] = written_balance[1] = 0;
+}
+
+void auto_exposure::setSettings(const exposure_settings& s) {
+	std::lock_guard<std::mutex> guard(lock);
+	settings = s;
+	started = false;
+}
+
+void auto_exposure::setColorStage(color_stage* s) {
+	std::lock_guard<std::mutex> guard(lock);
+	stage = s;
+}
+
+/* Reads the starting values and the limits the settings leave open */
+int auto_exposure::start() {
+	if (settings.exposure) {
+		if (cam->getShutter(&written_shutter) < 0 || cam->getGain(&written_gain) < 0)
+			return -1;
+
+		if (settings.shutter_min == 0 && settings.shutter_max == 0 &&
+			cam->getFeatureRange(DC1394_FEATURE_SHUTTER, &settings.shutter_min, &settings.shutter_max) < 0)
+			return -1;
+		if (settings.gain_min == 0 && settings.gain_max == 0 &&
+			cam->getFeatureRange(DC1394_FEATURE_GAIN, &settings.gain_min, &settings.gain_max) < 0)
+			return -1;
+
+		/* the shutter is scaled, so it can never reach 0 */
+		settings.shutter_min = std::max(settings.shutter_min, 1u);
+		if (settings.shutter_max < settings.shutter_min || settings.gain_max < settings.gain_min) {
+			fprintf(stderr, "ERROR: Exposure limits are out of order\n");
+			return -1;
+		}
+		if (settings.gain_per_stop <= 0)
+			settings.gain_per_stop = std::max((settings.gain_max - settings.gain_min) / 6.0f, 1.0f);
+
+		shutter = std::min(std::max(written_shutter, settings.shutter_min), settings.shutter_max);
+		gain    = std::min(std::max(written_gain, settings.gain_min), settings.gain_max);
+
+		/* writing takes both out of the camera's own auto loop */
+		written_shutter = (unsigned int)lround(shutter);
+		written_gain    = (unsigned int)lround(gain);
+		if (cam->setShutter(written_shutter) < 0 || cam->setGain(written_gain) < 0)
+			return -1;
+	}
+
+	if (settings.white_balance && stage == NULL) {
+		if (cam->getWhiteBalance(&written_balance[0], &written_balance[1]) < 0 ||
+			cam->getFeatureRange(DC1394_FEATURE_WHITE_BALANCE, &balance_min, &balance_max) < 0)
+			return -1;
+
+		balance_min = std::max(balance_min, 1u);
+		balance[0] = std::min(std::max(written_balance[0], balance_min), balance_max);
+		balance[1] = std::min(std::max(written_balance[1], balance_min), balance_max);
+
+		written_balance[0] = (unsigned int)lround(balance[0]);
+		written_balance[1] = (unsigned int)lround(balance[1]);
+		if (cam->setWhiteBalance(written_balance[0], written_balance[1]) < 0)
+			return -1;
+	}
+
+	started = true;
+	return 0;
+}
+
+int auto_exposure::adjustExposure() {
+	uint64_t samples = 0, clipped = 0;
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		samples += result.samples[c];
+		clipped += result.clipped[c];
+	}
+	if (samples == 0)
+		return 0;
+
+	/* error in stops, clipping wins over a dark mean so highlights are kept */
+	double error;
+	if (clipped > settings.max_clipped * samples)
+		error = -std::max(0.5, (double)settings.tolerance);
+	else
+		error = log2(settings.target / std::max(result.mean[METER_GREEN], MEAN_FLOOR));
+
+	if (fabs(error) < settings.tolerance)
+		return 0;
+
+	double step = error * settings.damping;
+	if (step > 0) {
+		double next = std::min(shutter * exp2(step), (double)settings.shutter_max);
+		step -= log2(next / shutter);
+		shutter = next;
+		gain = std::min(gain + step * settings.gain_per_stop, (double)settings.gain_max);
+	} else {
+		double next = std::max(gain + step * settings.gain_per_stop, (double)settings.gain_min);
+		step -= (next - gain) / settings.gain_per_stop;
+		gain = next;
+		shutter = std::max(shutter * exp2(step), (double)settings.shutter_min);
+	}
+
+	int changed = 0;
+	unsigned int value = (unsigned int)lround(shutter);
+	if (value != written_shutter) {
+		if (cam->setShutter(value) < 0)
+			return -1;
+		written_shutter = value;
+		changed = 1;
+	}
+
+	value = (unsigned int)lround(gain);
+	if (value != written_gain) {
+		if (cam->setGain(value) < 0)
+			return -1;
+		written_gain = value;
+		changed = 1;
+	}
+
+	return changed;
+}
+
+/* Gray world, red and blue are pulled to the green mean */
+int auto_exposure::adjustBalance() {
+	if (settings.meter.pattern == 0)
+		return 0;
+
+	for (int c = 0; c < METER_CHANNELS; c++) {
+		if (result.samples[c] == 0 || result.mean[c] < MEAN_FLOOR ||
+			result.clipped[c] > settings.max_clipped * result.samples[c])
+			return 0;
+	}
+
+	/* stops red and blue are below green */
+	double error[2];
+	error[0] = log2(result.mean[METER_GREEN] / result.mean[METER_BLUE]);
+	error[1] = log2(result.mean[METER_GREEN] / result.mean[METER_RED]);
+
+	if (fabs(error[0]) < settings.tolerance && fabs(error[1]) < settings.tolerance)
+		return 0;
+
+	/* the stage sees the frames before its gains, so the gains are absolute */
+	if (stage != NULL) {
+		color_settings colors = stage->get();
+		double red  = log2(colors.gains[0]);
+		double blue = log2(colors.gains[2]);
+
+		red  += (error[1] - red) * settings.damping;
+		blue += (error[0] - blue) * settings.damping;
+		colors.gains[0] = std::min(std::max(exp2(red), BALANCE_GAIN_MIN), BALANCE_GAIN_MAX);
+		colors.gains[1] = 1;
+		colors.gains[2] = std::min(std::max(exp2(blue), BALANCE_GAIN_MIN), BALANCE_GAIN_MAX);
+		return (stage->set(colors) < 0) ? -1 : 1;
+	}
+
+	/* the camera balances before the meter, so its values are corrected by the error */
+	unsigned int value[2];
+	for (int i = 0; i < 2; i++) {
+		balance[i] *= exp2(error[i] * settings.damping);
+		balance[i] = std::min(std::max(balance[i], (double)balance_min), (double)balance_max);
+		value[i] = (unsigned int)lround(balance[i]);
+	}
+
+	if (value[0] == written_balance[0] && value[1] == written_balance[1])
+		return 0;
+	if (cam->setWhiteBalance(value[0], value[1]) < 0)
+		return -1;
+
+	written_balance[0] = value[0];
+	written_balance[1] = value[1];
+	return 1;
+}
+
+int auto_exposure::update(const unsigned char* data, int width, int height, int bytes, int bits) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!settings.exposure && !settings.white_balance)
+		return 0;
+	if (++skipped < settings.interval)
+		return 0;
+	skipped = 0;
+
+	if (!started && start() < 0)
+		return -1;
+
+	if (meterFrame(data, width, height, bytes, bits, settings.meter, &result) < 0)
+		return -1;
+
+	int changed = 0, ret;
+	if (settings.exposure) {
+		if ((ret = adjustExposure()) < 0)
+			return -1;
+		changed |= ret;
+	}
+	if (settings.white_balance) {
+		if ((ret = adjustBalance()) < 0)
+			return -1;
+		changed |= ret;
+	}
+
+	return changed;
+}
+
+meter_result auto_exposure::getResult() {
+	std::lock_guard<std::mutex> guard(lock);
+	return result;
+}
+
+void auto_exposure::getExposure(unsigned int* s, unsigned int* g) {
+	std::lock_guard<std::mutex> guard(lock);
+	*s = written_shutter;
+	*g = written_gain;
+}
@@ -0,0 +1,144 @@
+//autoexposure.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+/*!
+ * \file autoexposure.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef AUTOEXPOSURE_H
+#define AUTOEXPOSURE_H
+
+#include <mutex>
+
+#include "framemeter.h"
+
+namespace cam1394
+{
+	class camera;
+	class color_stage;
+
+	/*!\brief Targets and limits of an auto_exposure controller
+	 *
+	 * Shutter and gain are in camera units.  A limit pair of 0, 0 is read
+	 * from the camera the first time a frame is metered.
+	 */
+	struct exposure_settings {
+		/*!\brief Drive shutter and gain */
+		bool exposure;
+		/*!\brief Drive the white balance */
+		bool white_balance;
+
+		/*!\brief Mean of the metered green samples to reach, as a fraction of full scale */
+		float target;
+		/*!\brief Errors smaller than this many stops are left alone */
+		float tolerance;
+		/*!\brief Fraction of clipped samples above which exposure is lowered */
+		float max_clipped;
+		/*!\brief Fraction of the error in stops corrected per update, 0 to 1 */
+		float damping;
+
+		unsigned int shutter_min;
+		unsigned int shutter_max;
+		unsigned int gain_min;
+		unsigned int gain_max;
+		/*!\brief Gain units that double the signal, 0 for a sixth of the gain range */
+		float gain_per_stop;
+
+		/*!\brief Meter every interval-th frame */
+		int interval;
+		/*!\brief Regions, pattern and sample budget of the meter */
+		meter_settings meter;
+
+		exposure_settings() :
+			exposure(true), white_balance(false), target(0.18f), tolerance(0.1f), max_clipped(0.01f),
+			damping(0.5f), shutter_min(0), shutter_max(0), gain_min(0), gain_max(0), gain_per_stop(0),
+			interval(1) {
+			meter.max_samples = 16384;
+		}
+	};
+
+	/*!
+	 * \class auto_exposure
+	 * \brief Software auto exposure and gray world white balance
+	 *
+	 * Each metered frame moves the exposure a damped step towards the
+	 * target.  More light comes from the shutter first and from the gain
+	 * once the shutter is at its limit, less light lowers the gain first.
+	 * The white balance goes to the camera, or to a color_stage when one
+	 * is set with #setColorStage.  The first frame writes the starting
+	 * values, which turns off the camera's own auto modes for the features
+	 * the controller drives.  After that only changed values are written, so a
+	 * settled controller costs one sampled meter pass per frame.  Attach
+	 * it with camera::setAutoExposure.
+	 */
+	class auto_exposure
+	{
+	public:
+		auto_exposure(camera* cam, const exposure_settings& settings);
+
+		/*!\brief Replaces the targets and limits */
+		void setSettings(const exposure_settings& settings);
+
+		/*!\brief Balances with the gains of stage instead of the camera
+		 * \param stage	the stage, NULL to use the camera again
+		 */
+		void setColorStage(color_stage* stage);
+
+		/*!\brief Meters a raw frame and adjusts the camera
+		 * \param data		raw samples
+		 * \param width		width of the frame
+		 * \param height	height of the frame
+		 * \param bytes		bytes per sample, 1 or 2
+		 * \param bits		significant bits per sample
+		 * \return 1 if a setting was changed, 0 if not, <0 if failure
+		 */
+		int update(const unsigned char* data, int width, int height, int bytes, int bits);
+
+		/*!\brief Gets the statistics of the last metered frame */
+		meter_result getResult();
+
+		/*!\brief Gets the shutter and gain last written */
+		void getExposure(unsigned int* shutter, unsigned int* gain);
+
+	private:
+		int start();
+		int adjustExposure();
+		int adjustBalance();
+
+		camera *cam;
+		color_stage *stage;
+		std::mutex lock;
+
+		exposure_settings settings;
+		meter_result result;
+		bool started;
+		int skipped;
+
+		/* tracked in floating point, a step smaller than one unit still accumulates */
+		double shutter;
+		double gain;
+		double balance[2];
+		unsigned int written_shutter;
+		unsigned int written_gain;
+		unsigned int written_balance[2];
+		unsigned int balance_min;
+		unsigned int balance_max;
+	};
+};
+#endif
@@ -0,0 +1,229 @@
+//binning.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "binning.h"
+
+using namespace cam1394;
+
+/* bits a bin adds to a sample, log2 of factor * factor */
+static int binBits(int factor) {
+	return (factor == 4) ? 4 : 2;
+}
+
+/* low bits dropped from each source sample so a sum fits 16 bits */
+static int headroomShift(int bits, int factor) {
+	return std::max(bits + binBits(factor) - 16, 0);
+}
+
+void cam1394::binnedSize(int width, int height, int factor, bool bayer, int* out_width, int* out_height) {
+	if (bayer) {
+		*out_width  = width / (2 * factor) * 2;
+		*out_height = height / (2 * factor) * 2;
+	} else {
+		*out_width  = width / factor;
+		*out_height = height / factor;
+	}
+}
+
+int cam1394::binnedBytes(int bytes, bin_mode mode) {
+	return (mode == BIN_SUM) ? 2 : bytes;
+}
+
+int cam1394::binnedDepth(int bits, int factor, bin_mode mode) {
+	if (mode == BIN_AVERAGE)
+		return bits;
+	return bits + binBits(factor) - headroomShift(bits, factor);
+}
+
+/* Adds a source row to the accumulated row */
+template<typename T>
+static void accumulate(const T* src, int count, int shift, bool first, uint16_t* acc) {
+	int x = 0;
+
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i bits = _mm_cvtsi32_si128(shift);
+
+	if (sizeof(T) == 1) {
+		for (; x + 16 <= count; x += 16) {
+			__m128i v  = _mm_loadu_si128((const __m128i*)(src + x));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			if (!first) {
+				lo = _mm_adds_epu16(lo, _mm_loadu_si128((const __m128i*)(acc + x)));
+				hi = _mm_adds_epu16(hi, _mm_loadu_si128((const __m128i*)(acc + x + 8)));
+			}
+			_mm_storeu_si128((__m128i*)(acc + x), lo);
+			_mm_storeu_si128((__m128i*)(acc + x + 8), hi);
+		}
+	} else {
+		for (; x + 8 <= count; x += 8) {
+			__m128i v = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(src + x)), bits);
+			if (!first)
+				v = _mm_adds_epu16(v, _mm_loadu_si128((const __m128i*)(acc + x)));
+			_mm_storeu_si128((__m128i*)(acc + x), v);
+		}
+	}
+#endif
+
+	for (; x < count; x++) {
+		unsigned int v = src[x] >> shift;
+		acc[x] = first ? v : std::min(acc[x] + v, 0xffffu);
+	}
+}
+
+#ifdef __SSE2__
+/* Packs the low 16 bits of each 32 bit lane of two vectors, values are
+ * below 0x10000 so the signed pack works on them biased by 0x8000 */
+static inline __m128i packLow(__m128i a, __m128i b) {
+	__m128i mask = _mm_set1_epi32(0xffff);
+	__m128i bias = _mm_set1_epi32(0x8000);
+	a = _mm_sub_epi32(_mm_and_si128(a, mask), bias);
+	b = _mm_sub_epi32(_mm_and_si128(b, mask), bias);
+	return _mm_xor_si128(_mm_packs_epi32(a, b), _mm_set1_epi16((short)0x8000));
+}
+#endif
+
+/* Adds neighbouring samples in place, count becomes count / 2 */
+static void halveMono(uint16_t* acc, int count) {
+	int x = 0;
+
+#ifdef __SSE2__
+	for (; 2 * x + 16 <= count; x += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(acc + 2 * x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(acc + 2 * x + 8));
+		a = _mm_adds_epu16(a, _mm_srli_epi32(a, 16));
+		b = _mm_adds_epu16(b, _mm_srli_epi32(b, 16));
+		_mm_storeu_si128((__m128i*)(acc + x), packLow(a, b));
+	}
+#endif
+
+	for (; 2 * x + 1 < count; x++)
+		acc[x] = std::min(acc[2 * x] + acc[2 * x + 1], 0xffff);
+}
+
+/* Adds neighbouring samples of the same color in place, count becomes count / 2 */
+static void halveBayer(uint16_t* acc, int count) {
+	int x = 0;
+
+#ifdef __SSE2__
+	for (; 2 * x + 16 <= count; x += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(acc + 2 * x));
+		__m128i b = _mm_loadu_si128((const __m128i*)(acc + 2 * x + 8));
+		/* dwords 0 and 2 hold the two colors of a cell */
+		a = _mm_shuffle_epi32(_mm_adds_epu16(a, _mm_srli_epi64(a, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+		b = _mm_shuffle_epi32(_mm_adds_epu16(b, _mm_srli_epi64(b, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i*)(acc + x), _mm_unpacklo_epi64(a, b));
+	}
+#endif
+
+	for (; 2 * x + 3 < count; x += 2) {
+		acc[x]     = std::min(acc[2 * x] + acc[2 * x + 2], 0xffff);
+		acc[x + 1] = std::min(acc[2 * x + 1] + acc[2 * x + 3], 0xffff);
+	}
+}
+
+/* Writes the finished bins of a row, shifted right by shift with rounding */
+template<typename U>
+static void store(const uint16_t* acc, int count, int shift, U* dst) {
+	int x = 0;
+	unsigned int half = shift ? 1u << (shift - 1) : 0;
+
+#ifdef __SSE2__
+	__m128i bits  = _mm_cvtsi32_si128(shift);
+	__m128i round = _mm_set1_epi16((short)half);
+
+	for (; x + 16 <= count; x += 16) {
+		__m128i a = _mm_srl_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i*)(acc + x)), round), bits);
+		__m128i b = _mm_srl_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i*)(acc + x + 8)), round), bits);
+		if (sizeof(U) == 1) {
+			_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(a, b));
+		} else {
+			_mm_storeu_si128((__m128i*)(dst + x), a);
+			_mm_storeu_si128((__m128i*)(dst + x + 8), b);
+		}
+	}
+#endif
+
+	for (; x < count; x++)
+		dst[x] = (U)(std::min(acc[x] + half, 0xffffu) >> shift);
+}
+
+template<typename T, typename U>
+static void binRows(const T* src, int width, int factor, bool bayer, int pre, int post,
+					int out_width, int out_height, U* dst) {
+	int span = out_width * factor;
+	std::vector<uint16_t> acc(span);
+
+	for (int y = 0; y < out_height; y++) {
+		for (int j = 0; j < factor; j++) {
+			int row = bayer ? ((y >> 1) * factor + j) * 2 + (y & 1) : y * factor + j;
+			accumulate(src + (size_t)row * width, span, pre, j == 0, &acc[0]);
+		}
+
+		for (int count = span; count > out_width; count /= 2) {
+			if (bayer)
+				halveBayer(&acc[0], count);
+			else
+				halveMono(&acc[0], count);
+		}
+
+		store(&acc[0], out_width, post, dst + (size_t)y * out_width);
+	}
+}
+
+int cam1394::binPixels(const unsigned char* src, int width, int height, int bytes, int bits, int factor,
+					   bool bayer, bin_mode mode, unsigned char* dst) {
+	if (factor != 2 && factor != 4) {
+		fprintf(stderr, "ERROR: Bins of %dx%d are not supported\n", factor, factor);
+		return -1;
+	}
+	if (bytes != 1 && bytes != 2) {
+		fprintf(stderr, "ERROR: Binning needs 1 or 2 bytes per sample\n");
+		return -1;
+	}
+
+	int out_width, out_height;
+	binnedSize(width, height, factor, bayer, &out_width, &out_height);
+	if (out_width <= 0 || out_height <= 0) {
+		fprintf(stderr, "ERROR: Frame of %dx%d is too small for %dx%d bins\n", width, height, factor, factor);
+		return -1;
+	}
+
+	if (bytes == 1)
+		bits = 8;
+	int pre  = headroomShift(bits, factor);
+	int post = (mode == BIN_AVERAGE) ? binBits(factor) - pre : 0;
+
+	if (bytes == 1 && mode == BIN_AVERAGE)
+		binRows(src, width, factor, bayer, pre, post, out_width, out_height, dst);
+	else if (bytes == 1)
+		binRows(src, width, factor, bayer, pre, post, out_width, out_height, (uint16_t*)dst);
+	else
+		binRows((const uint16_t*)src, width, factor, bayer, pre, post, out_width, out_height, (uint16_t*)dst);
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+//binning.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+/*!
+ * \file binning.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef BINNING_H
+#define BINNING_H
+
+namespace cam1394
+{
+	/*!\brief How the samples of a bin are combined
+	 */
+	enum bin_mode {
+		/*!\brief Mean of the bin, same sample size and depth as the source */
+		BIN_AVERAGE = 0,
+		/*!\brief Sum of the bin in 16 bit samples, the depth grows by two
+		 * bits for 2x2 and four for 4x4 binning, up to 16 */
+		BIN_SUM = 1
+	};
+
+	/*!\brief Gets the size of a binned frame
+	 *
+	 * Columns and rows that do not fill a whole bin, or for bayer frames a
+	 * whole bayer cell of bins, are left out.
+	 * \param width		width of the source
+	 * \param height	height of the source
+	 * \param factor	bin size in each direction, 2 or 4
+	 * \param bayer		true to bin samples of the same color, keeping the pattern
+	 * \param out_width		filled in with the binned width
+	 * \param out_height	filled in with the binned height
+	 */
+	void binnedSize(int width, int height, int factor, bool bayer, int* out_width, int* out_height);
+
+	/*!\brief Gets the bytes per sample of a binned frame */
+	int binnedBytes(int bytes, bin_mode mode);
+
+	/*!\brief Gets the significant bits per sample of a binned frame */
+	int binnedDepth(int bits, int factor, bin_mode mode);
+
+	/*!\brief Bins a raw frame
+	 *
+	 * Rows of a bin are accumulated in 16 bits with SSE2 and then halved
+	 * across, one output row at a time.  Samples too deep to add up in 16
+	 * bits lose their low bits first, so a bin never saturates.
+	 * \param src		raw samples
+	 * \param width		width of the source
+	 * \param height	height of the source
+	 * \param bytes		bytes per sample, 1 or 2
+	 * \param bits		significant bits per sample
+	 * \param factor	bin size in each direction, 2 or 4
+	 * \param bayer		true to bin samples of the same color, keeping the pattern
+	 * \param mode		sum or average
+	 * \param dst		room for the binned frame, see #binnedSize and #binnedBytes
+	 * \return 0 if success, <0 if failure
+	 */
+	int binPixels(const unsigned char* src, int width, int height, int bytes, int bits, int factor,
+				  bool bayer, bin_mode mode, unsigned char* dst);
+};
+#endif
@@ -0,0 +1,363 @@
+//bracket.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <errno.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bracket.h"
+#include "Timer.hpp"
+
+using namespace cam1394;
+
+struct merge_job {
+	const unsigned char* const* frames;
+	std::vector<float> scale;
+	int count;
+	int shortest;
+	int longest;
+	float inv_full;
+	float clip;
+};
+
+/* Weight of a sample by how far it is from black and from clipping */
+static inline float hatWeight(float x, float clip) {
+	return (x < clip) ? std::min(x, 1 - x) : 0;
+}
+
+#ifdef __SSE2__
+static inline __m128 load4(const uint8_t* p) {
+	int32_t word;
+	memcpy(&word, p, sizeof(word));
+	__m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+static inline __m128 load4(const uint16_t* p) {
+	__m128i v = _mm_loadl_epi64((const __m128i*)p);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+}
+#endif
+
+template<typename T>
+static void mergeRange(const merge_job& job, size_t first, size_t last, float* out) {
+	size_t i = first;
+
+#ifdef __SSE2__
+	__m128 one  = _mm_set1_ps(1);
+	__m128 zero = _mm_setzero_ps();
+	__m128 clip = _mm_set1_ps(job.clip);
+	__m128 full = _mm_set1_ps(job.inv_full);
+
+	for (; i + 4 <= last; i += 4) {
+		__m128 sum = zero, total = zero;
+
+		for (int k = 0; k < job.count; k++) {
+			__m128 v = load4((const T*)job.frames[k] + i);
+			__m128 x = _mm_mul_ps(v, full);
+			__m128 w = _mm_and_ps(_mm_min_ps(x, _mm_sub_ps(one, x)), _mm_cmplt_ps(x, clip));
+			sum   = _mm_add_ps(sum, _mm_mul_ps(w, _mm_mul_ps(v, _mm_set1_ps(job.scale[k]))));
+			total = _mm_add_ps(total, w);
+		}
+
+		/* clipped everywhere takes the shortest exposure, black everywhere the longest */
+		__m128 s = load4((const T*)job.frames[job.shortest] + i);
+		__m128 l = load4((const T*)job.frames[job.longest] + i);
+		__m128 clipped = _mm_cmpge_ps(_mm_mul_ps(s, full), clip);
+		__m128 fallback = _mm_or_ps(_mm_and_ps(clipped, _mm_mul_ps(s, _mm_set1_ps(job.scale[job.shortest]))),
+									_mm_andnot_ps(clipped, _mm_mul_ps(l, _mm_set1_ps(job.scale[job.longest]))));
+
+		__m128 some = _mm_cmpgt_ps(total, zero);
+		__m128 merged = _mm_div_ps(sum, _mm_or_ps(_mm_and_ps(some, total), _mm_andnot_ps(some, one)));
+		_mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(some, merged), _mm_andnot_ps(some, fallback)));
+	}
+#endif
+
+	for (; i < last; i++) {
+		float sum = 0, total = 0;
+
+		for (int k = 0; k < job.count; k++) {
+			float v = ((const T*)job.frames[k])[i];
+			float w = hatWeight(v * job.inv_full, job.clip);
+			sum   += w * v * job.scale[k];
+			total += w;
+		}
+
+		if (total > 0) {
+			out[i] = sum / total;
+		} else {
+			float s = ((const T*)job.frames[job.shortest])[i];
+			float l = ((const T*)job.frames[job.longest])[i];
+			out[i] = (s * job.inv_full >= job.clip) ? s * job.scale[job.shortest] : l * job.scale[job.longest];
+		}
+	}
+}
+
+int cam1394::mergeExposures(const unsigned char* const* frames, const float* exposures, int count,
+							int width, int height, int bytes, int bits, float clip_level, int threads,
+							float* radiance) {
+	if (count <= 0 || width <= 0 || height <= 0 || (bytes != 1 && bytes != 2)) {
+		fprintf(stderr, "ERROR: Nothing to merge\n");
+		return -1;
+	}
+
+	merge_job job;
+	job.frames   = frames;
+	job.count    = count;
+	job.shortest = job.longest = 0;
+	job.inv_full = 1.0f / ((bytes == 2) ? (1 << bits) - 1 : 255);
+	job.clip     = clip_level;
+
+	for (int k = 0; k < count; k++) {
+		if (exposures[k] <= 0) {
+			fprintf(stderr, "ERROR: Exposure %d is not positive\n", k);
+			return -1;
+		}
+		job.scale.push_back(1 / exposures[k]);
+		if (exposures[k] < exposures[job.shortest])
+			job.shortest = k;
+		if (exposures[k] > exposures[job.longest])
+			job.longest = k;
+	}
+
+	if (threads < 0)
+		threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	threads = std::max(std::min(threads, height), 1);
+
+	/* whole rows per thread, the caller merges the last share */
+	size_t row = width;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++) {
+		size_t first = row * (height * (size_t)t / threads);
+		size_t last  = row * (height * (size_t)(t + 1) / threads);
+
+		if (t == threads - 1) {
+			if (bytes == 2)
+				mergeRange<uint16_t>(job, first, last, radiance);
+			else
+				mergeRange<uint8_t>(job, first, last, radiance);
+		} else if (bytes == 2) {
+			workers.push_back(std::thread(mergeRange<uint16_t>, std::cref(job), first, last, radiance));
+		} else {
+			workers.push_back(std::thread(mergeRange<uint8_t>, std::cref(job), first, last, radiance));
+		}
+	}
+
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	return 0;
+}
+
+exposure_bracket::exposure_bracket(camera* cam) : cam(cam), period_us(0) {}
+
+exposure_bracket::~exposure_bracket() {
+	for (size_t i = 0; i < frames.size(); i++)
+		frames[i].destroy();
+}
+
+int exposure_bracket::setup(const bracket_settings& s) {
+	if (s.shutters.empty()) {
+		fprintf(stderr, "ERROR: A bracket needs at least one shutter value\n");
+		return -1;
+	}
+	if (!s.exposures.empty() && s.exposures.size() != s.shutters.size()) {
+		fprintf(stderr, "ERROR: A bracket needs one exposure per shutter value\n");
+		return -1;
+	}
+
+	float fps = cam->getFrameRate();
+	period_us = (fps > 0) ? 1e6 / fps : 0;
+	if (s.reader == NULL && period_us == 0) {
+		fprintf(stderr, "ERROR: Frames can not be matched by time without a frame rate\n");
+		return -1;
+	}
+
+	/* each value costs the settle time and one more frame at least */
+	if (s.budget_ms > 0 && period_us > 0) {
+		double needed = s.shutters.size() * (std::max(s.settle_frames, 0) + 1) * period_us / 1000;
+		if (needed > s.budget_ms) {
+			fprintf(stderr, "ERROR: A bracket of %d exposures needs about %.1f ms, over its %.1f ms budget\n",
+					(int)s.shutters.size(), needed, s.budget_ms);
+			return -1;
+		}
+	}
+
+	settings = s;
+	for (size_t i = s.shutters.size(); i < frames.size(); i++)
+		frames[i].destroy();
+	frames.resize(s.shutters.size());
+	unpacked.resize(s.shutters.size());
+
+	return 0;
+}
+
+/* Reads the next frame into frame, waiting no longer than the budget
+ * allows.  Returns 1 for a frame, 0 if none came in time, <0 on failure. */
+int exposure_bracket::readFrame(cam1394Image* frame, double start) {
+	struct pollfd fds;
+	fds.fd     = cam->getFileDescriptor();
+	fds.events = POLLIN;
+
+	if (fds.fd < 0) {
+		fprintf(stderr, "ERROR: Camera is not capturing\n");
+		return -1;
+	}
+
+	Timer clock;
+	while (1) {
+		int timeout = -1;
+		if (settings.budget_ms > 0) {
+			clock.start();
+			double left = settings.budget_ms - (clock.getStartTime() - start) * 1000;
+			if (left <= 0)
+				return 0;
+			timeout = (int)std::ceil(left);
+		}
+
+		int ret = ::poll(&fds, 1, timeout);
+		if (ret < 0 && errno != EINTR) {
+			fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* the gate may drop the frame, then wait for the next one */
+		if (ret > 0 && (ret = cam->pollRaw(frame)) != 0)
+			return ret;
+	}
+}
+
+/* Reads one frame per shutter value into frames */
+int exposure_bracket::captureFrames(hdr_frame* hdr, double start) {
+	Timer wall(CLOCK_REALTIME);
+
+	for (size_t i = 0; i < settings.shutters.size(); i++) {
+		if (cam->setShutter(settings.shutters[i]) < 0)
+			return -1;
+
+		/* frame timestamps are wall clock microseconds */
+		wall.start();
+		double written = wall.getStartTime() * 1e6;
+
+		while (1) {
+			int ret = readFrame(&frames[i], start);
+			if (ret < 0)
+				return -1;
+			if (ret == 0) {
+				fprintf(stderr, "ERROR: Bracketed burst ran over its %.1f ms budget\n", settings.budget_ms);
+				return -1;
+			}
+
+			long timestamp = cam->getTimestamp();
+			bool exposed;
+			if (settings.reader != NULL)
+				exposed = settings.reader(&frames[i], settings.reader_user) == (int)settings.shutters[i];
+			else
+				exposed = timestamp - written > settings.settle_frames * period_us;
+
+			if (exposed) {
+				hdr->timestamps[i] = timestamp;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int exposure_bracket::capture(hdr_frame* hdr) {
+	if (frames.empty()) {
+		fprintf(stderr, "ERROR: Bracket is not set up\n");
+		return -1;
+	}
+
+	Timer total;
+	total.start();
+
+	unsigned int original = 0;
+	bool automatic = false;
+	if (settings.restore && (cam->getShutter(&original) < 0 || cam->getShutterMode(&automatic) < 0))
+		return -1;
+
+	size_t count = frames.size();
+	hdr->timestamps.assign(count, 0);
+
+	int ret = captureFrames(hdr, total.getStartTime());
+	/* setShutter switches to manual, auto is set again after the value */
+	if (settings.restore && (cam->setShutter(original) < 0 || (automatic && cam->setShutter(-1) < 0)))
+		ret = -1;
+	if (ret < 0)
+		return -1;
+
+	int width = frames[0].width, height = frames[0].height;
+	size_t pixels = (size_t)width * height;
+	pixel_packing packing = cam->getPacking();
+	int bytes = (packing != PACKED_NONE) ? 2 : frames[0].size / pixels;
+	int bits  = (packing != PACKED_NONE) ? (int)packing : (bytes == 2) ? frames[0].depth : 8;
+
+	std::vector<const unsigned char*> samples(count);
+	std::vector<float> exposures(count);
+	for (size_t i = 0; i < count; i++) {
+		if (frames[i].width != width || frames[i].height != height) {
+			fprintf(stderr, "ERROR: Video mode changed during a bracketed burst\n");
+			return -1;
+		}
+
+		if (packing != PACKED_NONE) {
+			if ((size_t)frames[i].size < packedBytes(packing, pixels)) {
+				fprintf(stderr, "ERROR: Frame of %d bytes is too small for %zu packed samples\n",
+						frames[i].size, pixels);
+				return -1;
+			}
+			unpacked[i].resize(pixels);
+			unpackPixels(frames[i].data, pixels, packing, &unpacked[i][0]);
+			samples[i] = (const unsigned char*)&unpacked[i][0];
+		} else {
+			samples[i] = frames[i].data;
+		}
+		exposures[i] = settings.exposures.empty() ? settings.shutters[i] : settings.exposures[i];
+	}
+
+	if (packing == PACKED_NONE && frames[0].size != (int)(pixels * bytes)) {
+		fprintf(stderr, "ERROR: Bracketed bursts need raw or mono frames\n");
+		return -1;
+	}
+
+	hdr->width  = width;
+	hdr->height = height;
+	hdr->radiance.resize(pixels);
+	if (mergeExposures(&samples[0], &exposures[0], count, width, height, bytes, bits,
+					   settings.clip_level, settings.threads, &hdr->radiance[0]) < 0)
+		return -1;
+
+	hdr->latency = total.timePassed();
+	if (settings.budget_ms > 0 && hdr->latency * 1000 > settings.budget_ms)
+		fprintf(stderr, "WARNING: Bracketed burst took %.1f ms, over its %.1f ms budget\n",
+				hdr->latency * 1000, settings.budget_ms);
+
+	return 0;
+}
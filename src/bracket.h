@@ -0,0 +1,147 @@
+//bracket.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+/*!
+ * \file bracket.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef BRACKET_H
+#define BRACKET_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Reads the shutter value a camera embedded in a frame
+	 *
+	 * The layout of embedded frame information is vendor specific.
+	 * \param frame	frame from camera::readRaw
+	 * \param user	pointer given in bracket_settings
+	 * \return the shutter value, <0 if the frame carries none
+	 */
+	typedef int (*shutter_reader)(const cam1394Image* frame, void* user);
+
+	/*!\brief Exposures and limits of an exposure_bracket
+	 */
+	struct bracket_settings {
+		/*!\brief Shutter values to capture, in camera units */
+		std::vector<unsigned int> shutters;
+		/*!\brief Exposure time of each shutter value in any linear unit,
+		 * empty if the shutter values are linear themselves */
+		std::vector<float> exposures;
+
+		/*!\brief Without a reader, a frame counts as exposed with a new
+		 * shutter value once it arrives this many frame periods after the
+		 * value was written */
+		int settle_frames;
+		/*!\brief Matches frames by the shutter value embedded in them, NULL to match by time */
+		shutter_reader reader;
+		void *reader_user;
+
+		/*!\brief Time a burst may take from the first write to the merged
+		 * frame in ms, 0 for no limit */
+		double budget_ms;
+		/*!\brief Samples at or above this fraction of full scale are not merged */
+		float clip_level;
+		/*!\brief Threads that merge, -1 for one per core */
+		int threads;
+		/*!\brief Write the shutter value and mode from before the burst back afterwards */
+		bool restore;
+
+		bracket_settings() : settle_frames(2), reader(NULL), reader_user(NULL), budget_ms(0),
+			clip_level(0.98f), threads(-1), restore(true) {}
+	};
+
+	/*!\brief A merged burst
+	 */
+	struct hdr_frame {
+		int width;
+		int height;
+		/*!\brief Raw samples per unit of exposure, bayer frames keep their pattern */
+		std::vector<float> radiance;
+		/*!\brief Timestamp of the frame taken for each exposure */
+		std::vector<long> timestamps;
+		/*!\brief Seconds from the first shutter write to the merged frame */
+		double latency;
+	};
+
+	/*!\brief Merges raw frames of one scene taken with different exposures
+	 *
+	 * Each sample is weighted by its distance from black and from the clip
+	 * level.  Samples clipped in every frame take the value of the shortest
+	 * exposure, samples black in every frame that of the longest.  Four
+	 * samples at a time are merged with SSE2, rows are split among threads.
+	 * \param frames	raw samples of each frame
+	 * \param exposures	exposure of each frame, in any linear unit
+	 * \param count		number of frames
+	 * \param width		width of the frames
+	 * \param height	height of the frames
+	 * \param bytes		bytes per sample, 1 or 2
+	 * \param bits		significant bits per sample
+	 * \param clip_level	fraction of full scale where samples clip
+	 * \param threads	threads to merge with, -1 for one per core
+	 * \param radiance	room for width * height values
+	 * \return 0 if success, <0 if failure
+	 */
+	int mergeExposures(const unsigned char* const* frames, const float* exposures, int count,
+					   int width, int height, int bytes, int bits, float clip_level, int threads,
+					   float* radiance);
+
+	/*!
+	 * \class exposure_bracket
+	 * \brief Captures a burst of frames at several shutter values and merges them
+	 *
+	 * Each shutter value is written and frames are read until one is known
+	 * to be exposed with it, from the value embedded in the frame or from
+	 * the time it arrived.  Reading drains the DMA ring, so frames exposed
+	 * with an earlier value are never taken.
+	 */
+	class exposure_bracket
+	{
+	public:
+		/*!\param cam an open camera */
+		exposure_bracket(camera* cam);
+		~exposure_bracket();
+
+		/*!\brief Sets the exposures, checking that they fit the budget
+		 * \return 0 if success, <0 if failure
+		 */
+		int setup(const bracket_settings& settings);
+
+		/*!\brief Captures and merges one burst
+		 * \return 0 if success, <0 if failure or if the budget ran out
+		 */
+		int capture(hdr_frame* hdr);
+
+	private:
+		int readFrame(cam1394Image* frame, double start);
+		int captureFrames(hdr_frame* hdr, double start);
+
+		camera *cam;
+		bracket_settings settings;
+		double period_us;
+		std::vector<cam1394Image> frames;
+		std::vector<std::vector<uint16_t> > unpacked;
+	};
+};
+#endif
@@ -0,0 +1,376 @@
+//calibration.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "calibration.h"
+
+using namespace cam1394;
+
+static const char CALIBRATION_MAGIC[8] = {'C', '1', '3', '9', '4', 'C', 'A', 'L'};
+
+int cam1394::saveCalibration(const char* path, const calibration_map& map) {
+	size_t n = (size_t)map.width * map.height;
+	if (map.dark.size() != n || map.gain.size() != n) {
+		fprintf(stderr, "ERROR: Calibration map is incomplete\n");
+		return -1;
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Unable to create %s\n", path);
+		return -1;
+	}
+
+	int32_t size[2] = {map.width, map.height};
+	uint32_t defects = map.defects.size();
+	bool ok = fwrite(CALIBRATION_MAGIC, sizeof(CALIBRATION_MAGIC), 1, file) == 1 &&
+			  fwrite(size, sizeof(size), 1, file) == 1 &&
+			  fwrite(&defects, sizeof(defects), 1, file) == 1 &&
+			  fwrite(&map.dark[0], sizeof(uint16_t), n, file) == n &&
+			  fwrite(&map.gain[0], sizeof(uint16_t), n, file) == n &&
+			  (defects == 0 || fwrite(&map.defects[0], sizeof(uint32_t), defects, file) == defects);
+
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "ERROR: Unable to write %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int cam1394::loadCalibration(const char* path, calibration_map* map) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Unable to open %s\n", path);
+		return -1;
+	}
+
+	char magic[sizeof(CALIBRATION_MAGIC)];
+	int32_t size[2];
+	uint32_t defects;
+	bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+			  !memcmp(magic, CALIBRATION_MAGIC, sizeof(magic)) &&
+			  fread(size, sizeof(size), 1, file) == 1 &&
+			  fread(&defects, sizeof(defects), 1, file) == 1 &&
+			  size[0] > 0 && size[1] > 0;
+
+	if (ok) {
+		size_t n = (size_t)size[0] * size[1];
+		map->width  = size[0];
+		map->height = size[1];
+		map->dark.resize(n);
+		map->gain.resize(n);
+		map->defects.resize(defects);
+		ok = fread(&map->dark[0], sizeof(uint16_t), n, file) == n &&
+			 fread(&map->gain[0], sizeof(uint16_t), n, file) == n &&
+			 (defects == 0 || fread(&map->defects[0], sizeof(uint32_t), defects, file) == defects);
+	}
+	fclose(file);
+
+	if (!ok) {
+		fprintf(stderr, "ERROR: %s is not a calibration map\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+calibration_builder::calibration_builder() {
+	reset();
+}
+
+void calibration_builder::reset() {
+	width  = 0;
+	height = 0;
+	darks  = 0;
+	flats  = 0;
+	dark_sum.clear();
+	flat_sum.clear();
+}
+
+int calibration_builder::accumulate(const cam1394Image* frame, std::vector<uint64_t>& sum, int* count) {
+	size_t n = (size_t)frame->width * frame->height;
+	int bytes = n ? frame->size / n : 0;
+
+	if ((bytes != 1 && bytes != 2) || (size_t)frame->size != n * bytes) {
+		fprintf(stderr, "ERROR: Calibration frames must be raw or mono samples of 8 or 16 bits\n");
+		return -1;
+	}
+	if (width == 0) {
+		width  = frame->width;
+		height = frame->height;
+	} else if (frame->width != width || frame->height != height) {
+		fprintf(stderr, "ERROR: Calibration frame is %dx%d, expected %dx%d\n",
+				frame->width, frame->height, width, height);
+		return -1;
+	}
+
+	if (sum.size() != n)
+		sum.assign(n, 0);
+
+	if (bytes == 1) {
+		for (size_t i = 0; i < n; i++)
+			sum[i] += frame->data[i];
+	} else {
+		const uint16_t *p = (const uint16_t*)frame->data;
+		for (size_t i = 0; i < n; i++)
+			sum[i] += p[i];
+	}
+
+	(*count)++;
+	return 0;
+}
+
+int calibration_builder::addDark(const cam1394Image* frame) {
+	return accumulate(frame, dark_sum, &darks);
+}
+
+int calibration_builder::addFlat(const cam1394Image* frame) {
+	return accumulate(frame, flat_sum, &flats);
+}
+
+int calibration_builder::build(calibration_map* map, bool bayer, double defect_sigma, double flat_tolerance) {
+	if (darks == 0 && flats == 0) {
+		fprintf(stderr, "ERROR: No calibration frames were added\n");
+		return -1;
+	}
+
+	size_t n = (size_t)width * height;
+	const int unity = 1 << CALIBRATION_GAIN_BITS;
+	std::vector<double> dark(n, 0);
+	std::vector<bool> bad(n, false);
+
+	map->width  = width;
+	map->height = height;
+	map->dark.assign(n, 0);
+	map->gain.assign(n, unity);
+	map->defects.clear();
+
+	if (darks > 0) {
+		double sum = 0, squares = 0;
+		for (size_t i = 0; i < n; i++) {
+			dark[i] = (double)dark_sum[i] / darks;
+			map->dark[i] = (uint16_t)(dark[i] + 0.5);
+			sum     += dark[i];
+			squares += dark[i] * dark[i];
+		}
+
+		/* hot pixels stand out of the spatial spread of the dark frame */
+		double mean  = sum / n;
+		double sigma = sqrt(std::max(0.0, squares / n - mean * mean));
+		for (size_t i = 0; defect_sigma > 0 && i < n; i++)
+			if (dark[i] > mean + defect_sigma * sigma && dark[i] - mean >= 1)
+				bad[i] = true;
+	}
+
+	if (flats > 0) {
+		/* each bayer color is flattened to its own mean response */
+		std::vector<double> response(n);
+		double sum[4] = {0, 0, 0, 0};
+		size_t count[4] = {0, 0, 0, 0};
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				size_t i = (size_t)y * width + x;
+				int c = bayer ? (y & 1) * 2 + (x & 1) : 0;
+				response[i] = (double)flat_sum[i] / flats - dark[i];
+				if (response[i] > 0 && !bad[i]) {
+					sum[c] += response[i];
+					count[c]++;
+				}
+			}
+		}
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				size_t i = (size_t)y * width + x;
+				int c = bayer ? (y & 1) * 2 + (x & 1) : 0;
+				double mean = count[c] ? sum[c] / count[c] : 0;
+
+				if (response[i] <= 0 || mean <= 0) {
+					bad[i] = bad[i] || mean > 0;
+					continue;
+				}
+				if (flat_tolerance > 0 && fabs(response[i] - mean) > flat_tolerance * mean)
+					bad[i] = true;
+
+				double gain = mean / response[i] * unity + 0.5;
+				map->gain[i] = (uint16_t)(gain > 65535 ? 65535 : gain);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (bad[i])
+			map->defects.push_back(i);
+
+	return 0;
+}
+
+raw_corrector::raw_corrector() {}
+
+int raw_corrector::setMap(const calibration_map& m, bool bayer) {
+	size_t n = (size_t)m.width * m.height;
+	if (n == 0 || m.dark.size() != n || m.gain.size() != n) {
+		fprintf(stderr, "ERROR: Calibration map is incomplete\n");
+		return -1;
+	}
+
+	std::vector<bool> bad(n, false);
+	for (size_t i = 0; i < m.defects.size(); i++) {
+		if (m.defects[i] >= n) {
+			fprintf(stderr, "ERROR: Defect %u is outside the %dx%d map\n", m.defects[i], m.width, m.height);
+			return -1;
+		}
+		bad[m.defects[i]] = true;
+	}
+
+	/* the nearest good samples of the same color replace each defect */
+	const int step = bayer ? 2 : 1;
+	const int dx[4] = {-step, step, 0, 0};
+	const int dy[4] = {0, 0, -step, step};
+
+	defects.clear();
+	for (size_t i = 0; i < m.defects.size(); i++) {
+		defect d;
+		d.index = m.defects[i];
+		d.count = 0;
+
+		int x = d.index % m.width;
+		int y = d.index / m.width;
+		for (int k = 0; k < 4; k++) {
+			int nx = x + dx[k], ny = y + dy[k];
+			if (nx < 0 || ny < 0 || nx >= m.width || ny >= m.height)
+				continue;
+
+			uint32_t j = (uint32_t)ny * m.width + nx;
+			if (!bad[j])
+				d.from[d.count++] = j;
+		}
+		defects.push_back(d);
+	}
+
+	map = m;
+	return 0;
+}
+
+/* Dark subtraction and gain of one sample */
+static inline int correct(int v, int dark, int gain, int maxv) {
+	v = (v > dark) ? v - dark : 0;
+	v = (int)(((uint32_t)v * gain + (1 << (CALIBRATION_GAIN_BITS - 1))) >> CALIBRATION_GAIN_BITS);
+	return v < maxv ? v : maxv;
+}
+
+#ifdef __SSE2__
+static inline __m128i load8(const uint8_t* p) {
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+}
+
+static inline __m128i load8(const uint16_t* p) {
+	return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline void store8(uint8_t* p, __m128i v) {
+	_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v));
+}
+
+static inline void store8(uint16_t* p, __m128i v) {
+	_mm_storeu_si128((__m128i*)p, v);
+}
+
+/* Eight samples at a time, the 32 bit products are packed back with
+ * signed saturation around a 0x8000 bias, SSE2 has no unsigned pack */
+template <typename T>
+static size_t correctSSE2(const T* src, const uint16_t* dark, const uint16_t* gain, size_t n, int maxv, T* dst) {
+	const __m128i round = _mm_set1_epi32(1 << (CALIBRATION_GAIN_BITS - 1));
+	const __m128i bias  = _mm_set1_epi32(0x8000);
+	const __m128i flip  = _mm_set1_epi16((short)0x8000);
+	const __m128i limit = _mm_set1_epi16((short)(maxv - 0x8000));
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i v  = _mm_subs_epu16(load8(src + i), _mm_loadu_si128((const __m128i*)(dark + i)));
+		__m128i g  = _mm_loadu_si128((const __m128i*)(gain + i));
+		__m128i lo = _mm_mullo_epi16(v, g);
+		__m128i hi = _mm_mulhi_epu16(v, g);
+
+		__m128i p0 = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), CALIBRATION_GAIN_BITS);
+		__m128i p1 = _mm_srli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), CALIBRATION_GAIN_BITS);
+		__m128i r  = _mm_packs_epi32(_mm_sub_epi32(p0, bias), _mm_sub_epi32(p1, bias));
+		store8(dst + i, _mm_xor_si128(_mm_min_epi16(r, limit), flip));
+	}
+
+	return i;
+}
+#endif
+
+template <typename T>
+static void correctSamples(const T* src, const uint16_t* dark, const uint16_t* gain, size_t n, int maxv, T* dst) {
+	size_t i = 0;
+#ifdef __SSE2__
+	i = correctSSE2(src, dark, gain, n, maxv, dst);
+#endif
+	for (; i < n; i++)
+		dst[i] = (T)correct(src[i], dark[i], gain[i], maxv);
+}
+
+int raw_corrector::apply(const unsigned char* src, unsigned char* dst, int width, int height, int bytes, int bits) {
+	if (width != map.width || height != map.height) {
+		fprintf(stderr, "ERROR: Frame is %dx%d, the calibration map %dx%d\n", width, height, map.width, map.height);
+		return -1;
+	}
+	if (bytes != 1 && bytes != 2) {
+		fprintf(stderr, "ERROR: Calibration needs raw or mono frames\n");
+		return -1;
+	}
+
+	size_t n = (size_t)width * height;
+	if (bits <= 0 || bits > 8 * bytes)
+		bits = 8 * bytes;
+	int maxv = (1 << bits) - 1;
+
+	if (bytes == 1)
+		correctSamples(src, &map.dark[0], &map.gain[0], n, maxv, dst);
+	else
+		correctSamples((const uint16_t*)src, &map.dark[0], &map.gain[0], n, maxv, (uint16_t*)dst);
+
+	/* neighbours are corrected by now, defects never take from each other */
+	for (size_t i = 0; i < defects.size(); i++) {
+		const defect& d = defects[i];
+		if (d.count == 0)
+			continue;
+
+		int sum = 0;
+		if (bytes == 1) {
+			for (int k = 0; k < d.count; k++)
+				sum += dst[d.from[k]];
+			dst[d.index] = (uint8_t)((sum + d.count / 2) / d.count);
+		} else {
+			uint16_t *p = (uint16_t*)dst;
+			for (int k = 0; k < d.count; k++)
+				sum += p[d.from[k]];
+			p[d.index] = (uint16_t)((sum + d.count / 2) / d.count);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+//calibration.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file calibration.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Fraction bits of the gains in calibration_map::gain */
+	const int CALIBRATION_GAIN_BITS = 14;
+
+	/*!\brief Per pixel correction of a sensor, in raw sample order
+	 */
+	struct calibration_map {
+		int width;
+		int height;
+
+		/*!\brief Dark frame subtracted from every sample */
+		std::vector<uint16_t> dark;
+		/*!\brief Gain applied after the dark frame, 1 << CALIBRATION_GAIN_BITS is 1.0 */
+		std::vector<uint16_t> gain;
+		/*!\brief Indices of the samples replaced from their neighbours */
+		std::vector<uint32_t> defects;
+
+		calibration_map() : width(0), height(0) {}
+	};
+
+	/*!\brief Writes a calibration map to a file
+	 * \return 0 if success, <0 if failure
+	 */
+	int saveCalibration(const char* path, const calibration_map& map);
+
+	/*!\brief Reads a calibration map written by saveCalibration
+	 * \return 0 if success, <0 if failure
+	 */
+	int loadCalibration(const char* path, calibration_map* map);
+
+	/*!
+	 * \class calibration_builder
+	 * \brief Builds a calibration_map by averaging calibration frames
+	 *
+	 * Dark frames are taken with the lens capped, flat frames of an evenly
+	 * lit target with the same exposure.  Frames must be raw or mono
+	 * samples of 8 or 16 bits, as camera::read returns without debayering.
+	 */
+	class calibration_builder
+	{
+	public:
+		calibration_builder();
+
+		/*!\brief Adds a dark frame to the average
+		 * \return 0 if success, <0 if the frame does not match the others
+		 */
+		int addDark(const cam1394Image* frame);
+
+		/*!\brief Adds a flat frame to the average
+		 * \return 0 if success, <0 if the frame does not match the others
+		 */
+		int addFlat(const cam1394Image* frame);
+
+		/*!\brief Computes the maps from the frames added so far
+		 *
+		 * Without flat frames every gain is 1.0.  A sample is marked
+		 * defective when its dark level is more than defect_sigma standard
+		 * deviations above the mean, or when its flat response differs from
+		 * the mean of its color by more than flat_tolerance.
+		 * \param map			filled in with the maps
+		 * \param bayer			true to compare samples within their bayer color
+		 * \param defect_sigma	hot pixel threshold, <=0 disables
+		 * \param flat_tolerance	relative flat response threshold, <=0 disables
+		 * \return 0 if success, <0 if no frames were added
+		 */
+		int build(calibration_map* map, bool bayer, double defect_sigma = 6, double flat_tolerance = 0.5);
+
+		/*!\brief Drops the frames added so far */
+		void reset();
+
+	private:
+		int accumulate(const cam1394Image* frame, std::vector<uint64_t>& sum, int* count);
+
+		int width;
+		int height;
+		std::vector<uint64_t> dark_sum;
+		std::vector<uint64_t> flat_sum;
+		int darks;
+		int flats;
+	};
+
+	/*!
+	 * \class raw_corrector
+	 * \brief Applies a calibration_map to raw frames before debayering
+	 *
+	 * Dark subtraction and gain run in one pass, vectorised with SSE2, and
+	 * defective samples are then replaced by the average of their nearest
+	 * samples of the same color, from a table of neighbours built once by
+	 * #setMap.  Attach it with camera::setCorrection.
+	 */
+	class raw_corrector
+	{
+	public:
+		raw_corrector();
+
+		/*!\brief Prepares the tables for a map
+		 * \param map	the maps, copied
+		 * \param bayer	true to take replacements from the same bayer color
+		 * \return 0 if success, <0 if the map is inconsistent
+		 */
+		int setMap(const calibration_map& map, bool bayer);
+
+		/*!\brief Corrects a frame, src and dst may be the same buffer
+		 * \param src		raw samples
+		 * \param dst		corrected samples, same size as src
+		 * \param width		width of the frame, must match the map
+		 * \param height	height of the frame, must match the map
+		 * \param bytes		bytes per sample, 1 or 2
+		 * \param bits		significant bits per sample, results are clamped to them
+		 * \return 0 if success, <0 if the frame does not match the map
+		 */
+		int apply(const unsigned char* src, unsigned char* dst, int width, int height, int bytes, int bits);
+
+	private:
+		struct defect {
+			uint32_t index;
+			uint32_t from[4];
+			int count;
+		};
+
+		calibration_map map;
+		std::vector<defect> defects;
+	};
+};
+#endif
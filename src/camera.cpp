@@ -16,9 +16,11 @@
 //
 
 #include <stdio.h>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
+#include <thread>
 
 #ifndef NOOPENCV
 #include "highgui.h"
@@ -26,18 +28,39 @@
 
 #include "camera.h"
 #include "cameraconstants.h"
+#include "capcache.h"
+#include "lazyframe.h"
+#include "governor.h"
+#include "calibration.h"
+#include "colorstage.h"
+#include "autoexposure.h"
+#include "tensorexport.h"
+#include "Timer.hpp"
 	
 
 using namespace cam1394;
 
+/* rows debayered before the color stage runs over them */
+#define COLOR_BAND_ROWS 16
+
+/* offset of the COLOR_CODING_ID register in a Format7 mode's CSR block */
+#define FORMAT7_COLOR_CODING_ID 0x010U
+
 
 /* defualt constructor */
-camera::camera() : guid(0), width(-1), height(-1), cam(NULL) {}
+camera::camera() : guid(0), width(-1), height(-1), cam(NULL),
+	bayer_pat((dc1394color_filter_t)-1), bayer_met((dc1394bayer_method_t)-1),
+	out_order(PIXEL_RGB), out_depth(DEPTH_SOURCE), packing(PACKED_NONE), debayer_buf(NULL), debayer_size(0),
+	debayer_alloc(NULL), bin_factor(1), bin_how(BIN_AVERAGE), dma_buffers(10), abs_fps(0), governor(NULL), corrector(NULL), color(NULL), exposure(NULL),
+	gate(NULL), gate_act(GATE_MARK), changed(true), allocator(NULL) {}
 
 /* destructor */
 camera::~camera()
 {
 	clean_up();
+	freeDebayerBuffer();
+	unpacked.destroy();
+	binned.destroy();
 }
 
 int camera::open() {
@@ -62,7 +85,7 @@ int camera::open(const char* cam_guid) {
 				  videoFrameRates[rate - STARTFRAMERATE], NULL, NULL) < 0) {
 		clean_up();
 		return -1;	
-	} else if (DC1394_SUCCESS != dc1394_capture_setup(cam, 10, DC1394_CAPTURE_FLAGS_DEFAULT)) {
+	} else if (DC1394_SUCCESS != dc1394_capture_setup(cam, dma_buffers, DC1394_CAPTURE_FLAGS_DEFAULT)) {
 		clean_up();
 		fprintf(stderr, "ERROR: Failed to setup camera\n");
 		return -1;	
@@ -72,17 +95,56 @@ int camera::open(const char* cam_guid) {
 		return -1;	
 	}
 
+	resetAnalytics();
 	return 0;
 }
 
 std::vector<camera_info> camera::getConnectedCameras() {
+	return getConnectedCameras(false);
+}
+
+/* Opens and probes one camera for getConnectedCameras */
+static void probeConnectedCamera(dc1394_t *dc, dc1394camera_id_t id, bool read_only, camera_info *info, int *ret) {
+	capability_cache& cache = capability_cache::instance();
+
+	*ret = -1;
+	dc1394camera_t *camera = dc1394_camera_new_unit(dc, id.guid, id.unit);
+	if (!camera) {
+		fprintf(stderr, "Failed to get camera (GUID %016lX unit %d)\n", id.guid, id.unit);
+		return;
+	}
+
+	if (cache.lookup(camera->guid, camera->vendor_id, camera->model_id, info) == 0) {
+		info->unit = camera->unit;
+		*ret = 0;
+	} else if (read_only) {
+		*ret = probeCapabilitiesReadOnly(camera, info);
+	} else if ((*ret = probeCapabilities(camera, info)) == 0) {
+		cache.store(*info);
+	}
+
+	dc1394_camera_free(camera);
+}
+
+/* Probes one camera on its own thread, a dc1394_t is not safe to share
+ * between threads so each opens its own */
+static void probeConnectedCameraThread(dc1394camera_id_t id, camera_info *info, int *ret) {
+	*ret = -1;
+	dc1394_t *dc = dc1394_new();
+	if (!dc) {
+		fprintf(stderr, "Can't initialize dc1394\n");
+		return;
+	}
+
+	probeConnectedCamera(dc, id, true, info, ret);
+	dc1394_free(dc);
+}
+
+std::vector<camera_info> camera::getConnectedCameras(bool read_only) {
 	dc1394error_t err;
 	dc1394camera_list_t *list;
 	dc1394_t *dc = NULL;
 
-
-	dc1394framerates_t rates;
-
 	std::vector<camera_info> cameras;
 	
 	dc = dc1394_new();
@@ -100,199 +162,24 @@ std::vector<camera_info> camera::getConnectedCameras() {
 		return cameras;
 	}
 
+	std::vector<camera_info> infos(list->num);
+	std::vector<int> rets(list->num, -1);
 
-	
-	for (uint32_t c = 0; c < list->num; c++) {
-		uint64_t guid = list->ids[c].guid;
-		int unit = list->ids[c].unit;
-	
-		dc1394camera_t *camera = dc1394_camera_new_unit(dc, guid, unit);
-		if (!camera) {
-			fprintf(stderr, "Failed to get camera (GUID %016lX unit %d)\n", guid, unit);
-			dc1394_camera_free(camera);
-			continue;
-		}
-
-
-		/* Populate the camera_info struct */
-		camera_info cam_info;
-		cam_info.guid      = guid;
-		cam_info.unit      = unit;
-		cam_info.vendor_id = camera->vendor_id;
-		cam_info.model_id  = camera->model_id;
-
-		memset(cam_info.vendor, 0, sizeof(cam_info.vendor));
-		memset(cam_info.model,  0, sizeof(cam_info.model));
-		strncpy(cam_info.vendor, camera->vendor, sizeof(cam_info.vendor));
-		strncpy(cam_info.model,  camera->model,  sizeof(cam_info.model));
-
-
-		dc1394video_mode_t cur_mode;
-		uint32_t cur_bayer_out_reg = 0;
-
-		if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1050, &cur_bayer_out_reg, 1)) {
-			fprintf(stderr, "Failed to get BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
-			goto skipCam;
-		}
-
-		if (cur_bayer_out_reg & 0x80000000)
-			cam_info.raw_control = true;
-		else
-			cam_info.raw_control = false;
-
-
-		// Get the supported video modes
-		dc1394video_modes_t modes;
-		err = dc1394_video_get_supported_modes(camera, &modes);
-		
-		if (err != DC1394_SUCCESS) {
-			fprintf(stderr, "Failed to get video modes for camera (GUID %016lX unit %d)\n", guid, unit);
-			dc1394_camera_free(camera);
-			continue;
-		}
-
-		if (DC1394_SUCCESS != dc1394_video_get_mode(camera, &cur_mode)) {
-			fprintf(stderr, "Failed to get current video mode for camera (GUID %016lX unit %d)\n", guid, unit);
-			goto skipCam;
-		}
-
-
-		for (uint32_t m = 0; m < modes.num; m++) {
-			video_mode mode_info;
-
-			mode_info.mode = modes.modes[m];
-
-
-			if (DC1394_SUCCESS != dc1394_video_set_mode(camera, mode_info.mode)) {
-				fprintf(stderr, "Failed to set video mode for camera (GUID %016lX unit %d)\n", guid, unit);
-				goto skipCam;
-			}
-
-
-			uint32_t bayer_out_off = 0x80000000;
-			uint32_t bayer_out_on  = 0x80000001;
-			uint32_t bayer_reg_off = 0;
-			uint32_t bayer_reg_on  = 0;
-			dc1394color_filter_t bayer_pat;
-
-			if (cam_info.raw_control) {
-				if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &bayer_out_off, 1)) {
-					fprintf(stderr, "Failed to set BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
-					goto skipCam;
-				}
-			}
-
-			if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1040, &bayer_reg_off, 1)) {
-				fprintf(stderr, "Failed to get BAYER_TILE_MAPPING register for camera (GUID %016lX unit %d)\n", guid, unit);
-				goto skipCam;
-			}
-
-			if (cam_info.raw_control) {
-				if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &bayer_out_on, 1)) {
-					fprintf(stderr, "Failed to set BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
-					goto skipCam;
-				}
-
-				if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1040, &bayer_reg_on, 1)) {
-					fprintf(stderr, "Failed to get BAYER_TILE_MAPPING register for camera (GUID %016lX unit %d)\n", guid, unit);
-					goto skipCam;
-				}
-			}
-
-			switch (bayer_reg_off) {
-				case 0x52474742:
-					mode_info.raw = true;
-					bayer_pat = DC1394_COLOR_FILTER_BGGR;
-					break;
-				case 0x47425247:
-					mode_info.raw = true;
-					bayer_pat = DC1394_COLOR_FILTER_GRBG;
-					break;
-				case 0x47524247:
-					mode_info.raw = true;
-					bayer_pat = DC1394_COLOR_FILTER_GBRG;
-					break;
-				case 0x42474752:
-					mode_info.raw = true;
-					bayer_pat = DC1394_COLOR_FILTER_RGGB;
-					break;
-				case 0x59595959:
-				default:
-					mode_info.raw = false;
-			}
-
-			mode_info.raw_control = false;
-			if (cam_info.raw_control) {
-				switch (bayer_reg_on) {
-					case 0x52474742:
-						mode_info.raw = true;
-						bayer_pat = DC1394_COLOR_FILTER_BGGR;
-						break;
-					case 0x47425247:
-						mode_info.raw = true;
-						bayer_pat = DC1394_COLOR_FILTER_GRBG;
-						break;
-					case 0x47524247:
-						mode_info.raw = true;
-						bayer_pat = DC1394_COLOR_FILTER_GBRG;
-						break;
-					case 0x42474752:
-						mode_info.raw = true;
-						bayer_pat = DC1394_COLOR_FILTER_RGGB;
-						break;
-					case 0x59595959:
-					default:
-						mode_info.raw = false;
-				}
-
-				if (mode_info.raw && bayer_reg_off != bayer_reg_on)
-					mode_info.raw_control = true;
-			}
-
-			if (mode_info.raw)
-				mode_info.bayer_pattern = bayer_pat;
-
-
-			if (mode_info.mode < DC1394_VIDEO_MODE_FORMAT7_MIN) {
-				// Get framerates
-				mode_info.format7 = false;
-				err = dc1394_video_get_supported_framerates(camera, mode_info.mode, &rates);
-	
-				if (err != DC1394_SUCCESS) {
-					fprintf(stderr, "Failed to get framerates for camera (GUID %016lX unit %d)\n", guid, unit);
-					goto skipCam;
-				}
-
-				for (uint32_t f = 0; f < rates.num; f++) {
-					mode_info.framerates.push_back(rates.framerates[f]);
-				}
-
-			} else if (mode_info.mode >= DC1394_VIDEO_MODE_FORMAT7_MIN &&
-					   mode_info.mode <= DC1394_VIDEO_MODE_FORMAT7_MAX) {
-				// Get format 7 mode
-				mode_info.format7 = true;
-				err = dc1394_format7_get_mode_info(camera, mode_info.mode, &mode_info.format7_mode);
-
-				if (err != DC1394_SUCCESS) {
-					fprintf(stderr, "Failed to get format 7 mode for camera (GUID %016lX unit %d)\n", guid, unit);
-					goto skipCam;
-				}
-			}
-
-			cam_info.modes.push_back(mode_info);
-		}
-
-		if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &cur_bayer_out_reg, 1)) {
-			fprintf(stderr, "Failed to reset BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
-		}
-		if (DC1394_SUCCESS != dc1394_video_set_mode(camera, cur_mode)) {
-			fprintf(stderr, "Failed to reset video mode for camera (GUID %016lX unit %d)\n", guid, unit);
-		}
-
-		cameras.push_back(cam_info);
+	if (read_only) {
+		/* opening and register reads only wait on the bus, so query every camera at once */
+		std::vector<std::thread> threads;
+		for (uint32_t c = 0; c < list->num; c++)
+			threads.push_back(std::thread(probeConnectedCameraThread, list->ids[c], &infos[c], &rets[c]));
+		for (size_t c = 0; c < threads.size(); c++)
+			threads[c].join();
+	} else {
+		for (uint32_t c = 0; c < list->num; c++)
+			probeConnectedCamera(dc, list->ids[c], false, &infos[c], &rets[c]);
+	}
 
-skipCam:
-		dc1394_camera_free(camera);
+	for (uint32_t c = 0; c < list->num; c++) {
+		if (rets[c] == 0)
+			cameras.push_back(infos[c]);
 	}
 	
 	dc1394_camera_free_list(list);
@@ -427,9 +314,65 @@ int camera::initCam(const char* cam_guid) {
 		return -1;
 	}
 
+	applyRealtime();
+
+	if (loadCapabilities(false) < 0) {
+		clean_up();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Fills caps from the capability cache, probing the camera on a miss */
+int camera::loadCapabilities(bool refresh) {
+	capability_cache& cache = capability_cache::instance();
+
+	if (!refresh && cache.lookup(cam->guid, cam->vendor_id, cam->model_id, &caps) == 0)
+		return 0;
+
+	if (probeCapabilities(cam, &caps) < 0) {
+		fprintf(stderr, "ERROR: Failed to get capabilities of camera with GUID %016lX\n", guid);
+		return -1;
+	}
+
+	cache.store(caps);
 	return 0;
 }
 
+int camera::refreshCapabilities() {
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
+	}
+
+	if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_OFF)) {
+		fprintf(stderr, "ERROR: Failed to stop transmission\n");
+		return -1;
+	}
+	dc1394_capture_stop(cam);
+
+	int ret = loadCapabilities(true);
+
+	/* Format7 modes have no frame rate to restore, startCapture skips it */
+	if (startCapture(_video_mode, _fps) < 0) {
+		clean_up();
+		fprintf(stderr, "ERROR: Failed to restore video mode\n");
+		return -1;
+	}
+
+	resetAnalytics();
+	return ret;
+}
+
+const video_mode* camera::findVideoMode(dc1394video_mode_t mode) const {
+	for (size_t i = 0; i < caps.modes.size(); i++) {
+		if (caps.modes[i].mode == mode)
+			return &caps.modes[i];
+	}
+	return NULL;
+}
+
 int camera::initParam(const char* video_mode, float fps, const char* method, const char* pattern) {
 	if (_setVideoMode(video_mode) < 0) {
 		return -1;
@@ -451,7 +394,7 @@ int camera::open(const char* cam_guid, const char* video_mode, float fps, const
 	if (initParam(video_mode, fps, method, pattern) < 0) {
 		clean_up();
 		return -1;	
-	} else if (DC1394_SUCCESS != dc1394_capture_setup(cam, 10, DC1394_CAPTURE_FLAGS_DEFAULT)) {
+	} else if (DC1394_SUCCESS != dc1394_capture_setup(cam, dma_buffers, DC1394_CAPTURE_FLAGS_DEFAULT)) {
 		clean_up();
 		fprintf(stderr, "ERROR: Failed to setup camera\n");
 		return -1;	
@@ -461,12 +404,13 @@ int camera::open(const char* cam_guid, const char* video_mode, float fps, const
 		return -1;	
 	}
 
+	resetAnalytics();
 	return 0;
 }
 
 int camera::_setFrameRate(float fps) {
 	dc1394framerate_t fr; 
-	if (convertFrameRate(fps, &fr) < 0) {
+	if (convertFrameRate(fps, &fr, _video_mode) < 0) {
 		printSupportedFrameRates(cam, _video_mode);
 		return -1;
 	}
@@ -482,52 +426,32 @@ int camera::_setFrameRate(float fps) {
 }
 
 int camera::getBestVideoMode(dc1394video_mode_t *mode) {
-	dc1394error_t err;
-	dc1394video_modes_t modes;
-	
-	/* get all supported video modes for camera*/
-	err = dc1394_video_get_supported_modes(cam, &modes);
+	if (caps.modes.size() == 0) {
+		fprintf(stderr, "ERROR: no supported videomodes\n");
+		return -1;
+	}
 
-	if (err != DC1394_SUCCESS) 
-		fprintf(stderr, "ERROR getting supported videomodes\n");
-	else {
-		if (modes.num == 0) {
-			fprintf(stderr, "ERROR: no supported videomodes\n");
-			return -1;
-		}
-		int count = modes.num - 1;
-		*mode = modes.modes[count];
-		while (*mode >= DC1394_VIDEO_MODE_FORMAT7_MIN) {
-			count--;
-			if (count < 0) {
-				fprintf(stderr, "ERROR: no supported non-format7 videomodes\n");
-				return -1;
-			}	
-			*mode = modes.modes[count];
+	for (int i = caps.modes.size() - 1; i >= 0; i--) {
+		if (caps.modes[i].mode < DC1394_VIDEO_MODE_FORMAT7_MIN) {
+			*mode = caps.modes[i].mode;
+			return 0;
 		}
-		return 0;
 	}
+
+	fprintf(stderr, "ERROR: no supported non-format7 videomodes\n");
 	return -1;
 }
 
 int camera::getBestFrameRate(dc1394framerate_t *rate, dc1394video_mode_t mode) {
-	dc1394error_t err;
-	dc1394framerates_t rates;
-	
-	/* get all supported video modes for camera*/
-	err = dc1394_video_get_supported_framerates(cam, mode, &rates);
+	const video_mode *info = findVideoMode(mode);
 
-	if (err != DC1394_SUCCESS) 
-		fprintf(stderr, "ERROR getting supported framerates\n");
-	else {
-		if (rates.num == 0) {
-			fprintf(stderr, "ERROR: no supported framerates\n");
-			return -1;
-		}
-		*rate = rates.framerates[rates.num - 1];
-		return 0;
+	if (info == NULL || info->framerates.size() == 0) {
+		fprintf(stderr, "ERROR: no supported framerates\n");
+		return -1;
 	}
-	return -1;
+
+	*rate = info->framerates.back();
+	return 0;
 }
 
 /* Sets video_mode based on string input */
@@ -566,20 +490,8 @@ int camera::checkValidVideoMode(dc1394video_mode_t *mode) {
 	else if (*mode < DC1394_VIDEO_MODE_MIN || *mode > DC1394_VIDEO_MODE_MAX)
 		return -1;
 
-	dc1394error_t err;
-	dc1394video_modes_t modes;
-	
-	/* get all supported video modes for camera*/
-	err = dc1394_video_get_supported_modes(cam, &modes);
-
-	if (err != DC1394_SUCCESS) 
-		fprintf(stderr, "ERROR getting supported videomodes\n");
-	else {
-		for (unsigned int i = 0; i < modes.num; i++) {
-			if (*mode == modes.modes[i]) 
-				return 1;
-		}
-	}
+	if (findVideoMode(*mode) != NULL)
+		return 1;
 
 	return -1;
 }
@@ -627,6 +539,8 @@ int camera::_setVideoMode(const char* video_mode) {
 	}
 
 	_video_mode = mode;
+	if (updatePipeline() < 0)
+		return -1;
 
 	dc1394framerate_t rate;
 	if (getBestFrameRate(&rate, mode) < 0)
@@ -638,7 +552,7 @@ int camera::_setVideoMode(const char* video_mode) {
 	return 0;
 }
 
-int camera::convertFrameRate(float fps, dc1394framerate_t *frame_rate) {
+int camera::convertFrameRate(float fps, dc1394framerate_t *frame_rate, dc1394video_mode_t mode) {
 	if (fps < 3.75)
 		*frame_rate = DC1394_FRAMERATE_1_875;
 	else if (fps < 7.5)
@@ -656,32 +570,26 @@ int camera::convertFrameRate(float fps, dc1394framerate_t *frame_rate) {
 	else
 		*frame_rate = DC1394_FRAMERATE_240;
 
-	if (checkValidFrameRate(frame_rate) < 0)
+	if (checkValidFrameRate(frame_rate, mode) < 0)
 		return -1;
 	else
 		return 1;
 }
 
-int camera::checkValidFrameRate(dc1394framerate_t* frame_rate) {
+int camera::checkValidFrameRate(dc1394framerate_t* frame_rate, dc1394video_mode_t mode) {
 	if (frame_rate == NULL) 
 		return -1;
 	else if (*frame_rate < DC1394_FRAMERATE_MIN || *frame_rate > DC1394_FRAMERATE_MAX)
 		return -1;
-	else if (_video_mode < DC1394_VIDEO_MODE_MIN || _video_mode > DC1394_VIDEO_MODE_MAX) {
+	else if (mode < DC1394_VIDEO_MODE_MIN || mode > DC1394_VIDEO_MODE_MAX) {
 		fprintf(stderr, "ERROR: Haven't set video mode yet\n");
 		return -1;
 	}
 
-	dc1394error_t err;
-	dc1394framerates_t rates;
-
-	err = dc1394_video_get_supported_framerates(cam, _video_mode, &rates);
-
-	if (err != DC1394_SUCCESS)
-		fprintf(stderr, "ERROR getting supported framerates");
-	else {
-		for (unsigned int i = 0; i < rates.num; i++) {
-			if (*frame_rate == rates.framerates[i]) 
+	const video_mode *info = findVideoMode(mode);
+	if (info != NULL) {
+		for (size_t i = 0; i < info->framerates.size(); i++) {
+			if (*frame_rate == info->framerates[i]) 
 				return 1;
 		}
 	}
@@ -728,13 +636,13 @@ int camera::setBayer(const char* method, const char* pattern)
 	
 	if (bayer_met == -1) {
 		bayer_pat = (dc1394color_filter_t)-1;
-		return 0;
+		return updatePipeline();
 	}
 
 	for (int i = 0; i < DC1394_COLOR_FILTER_NUM; i++) {
 		if (!strcasecmp(pattern, bayerPatterns[i])) {
 			bayer_pat = (dc1394color_filter_t)(STARTCOLORFILTER + i);
-			return 0;
+			return updatePipeline();
 		}
 	}
 
@@ -742,6 +650,164 @@ int camera::setBayer(const char* method, const char* pattern)
 	return -1;
 }
 
+int camera::setOutputOrder(pixel_order order) {
+	out_order = order;
+	return updatePipeline();
+}
+
+int camera::setAutoExposure(auto_exposure* ae) {
+	exposure = ae;
+	return 0;
+}
+
+int camera::setChangeGate(change_gate* g, gate_action action) {
+	gate     = g;
+	gate_act = action;
+	changed  = true;
+	return 0;
+}
+
+int camera::setColorStage(color_stage* stage) {
+	color = stage;
+	return 0;
+}
+
+int camera::setCorrection(raw_corrector* correction) {
+	corrector = correction;
+	return 0;
+}
+
+int camera::setOutputDepth(pixel_depth depth) {
+	out_depth = depth;
+	return updatePipeline();
+}
+
+int camera::setPacking(pixel_packing layout, unsigned int coding_id) {
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
+	}
+
+	if (coding_id != 0) {
+		if (_video_mode < DC1394_VIDEO_MODE_FORMAT7_MIN) {
+			fprintf(stderr, "ERROR: Color codings can only be chosen in Format7 modes\n");
+			return -1;
+		}
+
+		uint32_t previous;
+		if (DC1394_SUCCESS != dc1394_get_format7_register(cam, _video_mode, FORMAT7_COLOR_CODING_ID, &previous)) {
+			fprintf(stderr, "ERROR: Unable to read the color coding\n");
+			return -1;
+		}
+
+		/* packet sizes follow the coding, so capture is set up again */
+		if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_OFF)) {
+			fprintf(stderr, "ERROR: Failed to stop transmission\n");
+			return -1;
+		}
+		dc1394_capture_stop(cam);
+
+		bool written = DC1394_SUCCESS == dc1394_set_format7_register(cam, _video_mode, FORMAT7_COLOR_CODING_ID, coding_id << 24);
+		if (!written)
+			fprintf(stderr, "ERROR: Unable to set color coding %u\n", coding_id);
+
+		/* like a failed mode switch, the previous coding is restored */
+		if (!written || startCapture(_video_mode, _fps) < 0) {
+			if (written) {
+				fprintf(stderr, "ERROR: Failed to capture with color coding %u, restoring %u\n",
+						coding_id, previous >> 24);
+				dc1394_set_format7_register(cam, _video_mode, FORMAT7_COLOR_CODING_ID, previous);
+			}
+
+			if (startCapture(_video_mode, _fps) < 0) {
+				clean_up();
+				fprintf(stderr, "ERROR: Failed to restore the color coding\n");
+				return -1;
+			}
+			resetAnalytics();
+			return -1;
+		}
+		resetAnalytics();
+
+		if (reloadFormat7Mode() < 0)
+			return -1;
+	}
+
+	packing = layout;
+	return updatePipeline();
+}
+
+/* Reads the current Format7 mode back into caps after its coding was
+ * written, the converter and the output geometry follow the coding */
+int camera::reloadFormat7Mode() {
+	for (size_t i = 0; i < caps.modes.size(); i++) {
+		if (caps.modes[i].mode != _video_mode)
+			continue;
+
+		if (DC1394_SUCCESS != dc1394_format7_get_mode_info(cam, _video_mode, &caps.modes[i].format7_mode)) {
+			fprintf(stderr, "ERROR: Unable to read Format7 mode info\n");
+			return -1;
+		}
+		capability_cache::instance().store(caps);
+		break;
+	}
+	return 0;
+}
+
+pixel_packing camera::getPacking() {
+	return packing;
+}
+
+int camera::setBinning(int factor, bin_mode mode) {
+	if (factor != 1 && factor != 2 && factor != 4) {
+		fprintf(stderr, "ERROR: Bins of %dx%d are not supported\n", factor, factor);
+		return -1;
+	}
+
+	bin_factor = factor;
+	bin_how    = mode;
+	return updatePipeline();
+}
+
+int camera::getBinning() {
+	return bin_factor;
+}
+
+/* Picks the converter for the current video mode and bayer settings, once per change */
+int camera::updatePipeline() {
+	pipeline = pixel_pipeline();
+
+	if (bayer_met == -1 || cam == NULL)
+		return 0;
+
+	dc1394color_coding_t coding;
+	const video_mode *info = findVideoMode(_video_mode);
+	if (packing != PACKED_NONE) {
+		/* packed samples are debayered after unpacking to 16 bits */
+		coding = DC1394_COLOR_CODING_RAW16;
+	} else if (info != NULL && info->format7) {
+		coding = info->format7_mode.color_coding;
+	} else if (DC1394_SUCCESS != dc1394_get_color_coding_from_video_mode(cam, _video_mode, &coding)) {
+		fprintf(stderr, "ERROR: Failed to get color coding of video mode\n");
+		return -1;
+	}
+
+	/* summed bins of 8 bit samples are 16 bits */
+	if (bin_factor > 1 && bin_how == BIN_SUM) {
+		if (coding == DC1394_COLOR_CODING_RAW8)
+			coding = DC1394_COLOR_CODING_RAW16;
+		else if (coding == DC1394_COLOR_CODING_MONO8)
+			coding = DC1394_COLOR_CODING_MONO16;
+	}
+
+	if (selectPipeline(coding, bayer_pat, bayer_met, out_order, &pipeline, out_depth) < 0) {
+		fprintf(stderr, "WARNING: %s can not be debayered, reading raw frames\n",
+				videoModeNames[_video_mode - STARTVIDEOMODE]);
+	}
+
+	return 0;
+}
+
 void camera::clean_up()
 {
 	if (cam) {
@@ -831,6 +897,13 @@ int camera::setGain(int gain)
 
 int camera::setWhiteBalance(unsigned int b_u, unsigned int r_v)
 {
+	/* values written in auto mode are ignored */
+	if (DC1394_SUCCESS != dc1394_feature_set_mode(cam, DC1394_FEATURE_WHITE_BALANCE, DC1394_FEATURE_MODE_MANUAL))
+	{
+		fprintf(stderr, "ERROR: Unable to set white balance mode\n");
+		return -1;
+	}
+
 	if (DC1394_SUCCESS != dc1394_feature_whitebalance_set_value(cam, b_u, r_v))
 	{
 		fprintf(stderr, "ERROR: Unable to set white balance value\n");
@@ -840,9 +913,66 @@ int camera::setWhiteBalance(unsigned int b_u, unsigned int r_v)
 	return 0;
 }
 
-int camera::setRawOutput(bool raw)
+int camera::getShutter(unsigned int* shutter)
 {
-	uint32_t cur_bayer_out = 0;
+	if (DC1394_SUCCESS != dc1394_feature_get_value(cam, DC1394_FEATURE_SHUTTER, shutter))
+	{
+		fprintf(stderr, "ERROR: Unable to get shutter value\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int camera::getShutterMode(bool* autoShutter)
+{
+	dc1394feature_mode_t mode;
+	if (DC1394_SUCCESS != dc1394_feature_get_mode(cam, DC1394_FEATURE_SHUTTER, &mode))
+	{
+		fprintf(stderr, "ERROR: Unable to get shutter mode\n");
+		return -1;
+	}
+
+	*autoShutter = mode == DC1394_FEATURE_MODE_AUTO;
+	return 0;
+}
+
+int camera::getGain(unsigned int* gain)
+{
+	if (DC1394_SUCCESS != dc1394_feature_get_value(cam, DC1394_FEATURE_GAIN, gain))
+	{
+		fprintf(stderr, "ERROR: Unable to get gain value\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int camera::getWhiteBalance(unsigned int* b_u, unsigned int* r_v)
+{
+	if (DC1394_SUCCESS != dc1394_feature_whitebalance_get_value(cam, b_u, r_v))
+	{
+		fprintf(stderr, "ERROR: Unable to get white balance value\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int camera::getFeatureRange(dc1394feature_t feature, unsigned int* min, unsigned int* max)
+{
+	if (DC1394_SUCCESS != dc1394_feature_get_boundaries(cam, feature, min, max))
+	{
+		fprintf(stderr, "ERROR: Unable to get range of feature %d\n", feature);
+		return -1;
+	}
+
+	return 0;
+}
+
+int camera::setRawOutput(bool raw)
+{
+	uint32_t cur_bayer_out = 0;
 	uint32_t set_bayer_out;
 
 	if (DC1394_SUCCESS != dc1394_get_control_registers(cam, 0x1050, &cur_bayer_out, 1)) {
@@ -869,148 +999,649 @@ int camera::setRawOutput(bool raw)
 	return 0;
 }
 
-int camera::read(cam1394Image* image) {
-	if (!cam)
-	{
-		fprintf(stderr, "ERROR: Camera not initialized\n");
-		exit(1);
+/* Takes the newest frame that passes the change gate.
+ * Returns 1 with a frame, 0 if wait is false and no frame was ready. */
+int camera::grabFrame(dc1394video_frame_t* latest, bool wait) {
+	while (1) {
+		int ret = dequeueNewest(latest, wait);
+		if (ret <= 0 || gate == NULL) {
+			changed = true;
+			return ret;
+		}
+
+		if ((ret = gateFrame(latest)) < 0)
+			return -1;
+		changed = ret > 0;
+		if (changed || gate_act == GATE_MARK)
+			return 1;
+		if (!wait)
+			return 0;
 	}
-	
-	const int W = width;
-	const int H = height;
-	dc1394video_frame_t end;
-	dc1394video_frame_t * frame;
-	dc1394video_frame_t * prev_frame;
-	prev_frame = (dc1394video_frame_t *)malloc(sizeof(dc1394video_frame_t));
-	prev_frame->id = 255;
+}
+
+/* Checks a raw frame against the change gate, samples that are not
+ * bayer or mono are compared as bytes */
+int camera::gateFrame(const dc1394video_frame_t* frame) {
+	int w = frame->size[0], h = frame->size[1];
+
+	if (packing != PACKED_NONE)
+		return gate->check(frame->image, w, h, 2, packing, packing);
+
+	size_t pixels = (size_t)w * h;
+	if (frame->data_depth > 8 && frame->image_bytes == pixels * 2)
+		return gate->check(frame->image, w, h, 2, frame->data_depth);
+
+	return gate->check(frame->image, frame->image_bytes / h, h, 1, 8);
+}
+
+/* Drains the DMA ring and copies the descriptor of the newest frame.
+ * Returns 1 with a frame, 0 if wait is false and no frame was ready. */
+int camera::dequeueNewest(dc1394video_frame_t* latest, bool wait) {
+	dc1394video_frame_t * frame = NULL;
 	dc1394error_t err;
-	end.image = (unsigned char*)malloc(W * H * 3 * sizeof(unsigned char));
-	end.color_coding = DC1394_COLOR_CODING_RGB8;
-	
+	latest->id = 255;
+
+	/* before dequeuing, a rate switch restarts capture and unmaps the ring */
+	if (governor != NULL)
+		governor->update();
 	
 	int frames_read = 0;
 		
-	err = dc1394_capture_dequeue(cam, DC1394_CAPTURE_POLICY_WAIT, &frame);
+	err = dc1394_capture_dequeue(cam, wait ? DC1394_CAPTURE_POLICY_WAIT : DC1394_CAPTURE_POLICY_POLL, &frame);
 	if (frame != NULL && err == DC1394_SUCCESS)
 	{
+		analytics.dequeued(frame, true);
 		dc1394_capture_enqueue(cam, frame);
-		memcpy(prev_frame, frame, sizeof(dc1394video_frame_t));
+		memcpy(latest, frame, sizeof(dc1394video_frame_t));
 		frames_read++;
 	}
+	else if (!wait)
+	{
+		if (err != DC1394_SUCCESS) {
+			fprintf(stderr, "ERROR: Failed to dequeue frame\n");
+			return -1;
+		}
+		return 0;
+	}
 
 	while (1)
 	{
 		err = dc1394_capture_dequeue(cam, DC1394_CAPTURE_POLICY_POLL, &frame);
-		if (frame == NULL && err == DC1394_SUCCESS && prev_frame->id != 255)
+		if (frame == NULL && err == DC1394_SUCCESS && latest->id != 255)
 			break;
 		else if (frame != NULL && err == DC1394_SUCCESS)
 		{
+			analytics.dequeued(frame, frames_read == 0);
 			dc1394_capture_enqueue(cam, frame);
-			memcpy(prev_frame, frame, sizeof(dc1394video_frame_t));
+			memcpy(latest, frame, sizeof(dc1394video_frame_t));
 			frames_read++;
 		}
 	}
 	droppedframes = frames_read - 1;
-	prev_frame->color_filter= bayer_pat;
+	analytics.delivered(droppedframes);
+	timestamp = latest->timestamp;
+	latest->color_filter = bayer_pat;
 
-	if (bayer_met != -1) {
-		if (DC1394_SUCCESS != dc1394_debayer_frames(prev_frame, &end, bayer_met))
-		{
-			fprintf(stderr, "ERROR: Unable to debayer frame\n");
+	return 1;
+}
+
+/* Runs a full frame pipeline on a frame into debayer_buf */
+int camera::debayer(dc1394video_frame_t* frame) {
+	if (reserveDebayerBuffer(frame->size[0], frame->size[1], frame->data_depth) < 0)
+		return -1;
+
+	pixel_rect all = {0, 0, (int)frame->size[0], (int)frame->size[1]};
+	if (pipeline.convert(frame->image, frame->size[0], frame->size[1], frame->data_depth,
+						 all, debayer_buf, 0) < 0) {
+		fprintf(stderr, "ERROR: Unable to debayer frame\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Size of the image read returns for a frame, pixel_bytes is 0 when pixels
+ * are not whole bytes (YUV411) */
+void camera::outputGeometry(const dc1394video_frame_t* frame, int* w, int* h, int* pixel_bytes) {
+	stagedFormat(frame, w, h, pixel_bytes);
+
+	if (pipeline.convert != NULL) {
+		*w >>= pipeline.shift;
+		*h >>= pipeline.shift;
+		*pixel_bytes = pipeline.channels * pipeline.bytes;
+	}
+}
+
+/* Size and bytes per sample of a frame after unpacking and binning, bytes
+ * is 0 when pixels are not whole bytes (YUV411) */
+void camera::stagedFormat(const dc1394video_frame_t* frame, int* w, int* h, int* bytes) {
+	*w = frame->size[0];
+	*h = frame->size[1];
+
+	if (packing != PACKED_NONE)
+		*bytes = narrowUnpack() ? 1 : 2;
+	else if (frame->image_bytes % (*w * *h) == 0)
+		*bytes = frame->image_bytes / (*w * *h);
+	else
+		*bytes = 0;
+
+	if (bin_factor > 1 && (*bytes == 1 || *bytes == 2)) {
+		binnedSize(*w, *h, bin_factor, binBayer(frame), w, h);
+		*bytes = binnedBytes(*bytes, bin_how);
+	}
+}
+
+/* Frames are binned by color when they are raw or will be debayered */
+bool camera::binBayer(const dc1394video_frame_t* frame) {
+	return bayer_met != -1 || frame->color_coding == DC1394_COLOR_CODING_RAW8 ||
+		frame->color_coding == DC1394_COLOR_CODING_RAW16;
+}
+
+/* Bins a frame of whole samples into image, view describes the result */
+int camera::binFrame(const dc1394video_frame_t* frame, cam1394Image* image, dc1394video_frame_t* view) {
+	dc1394video_frame_t src = *frame;
+	size_t pixels = (size_t)src.size[0] * src.size[1];
+	int bytes = src.image_bytes / pixels;
+	if ((bytes != 1 && bytes != 2) || src.image_bytes != pixels * bytes) {
+		fprintf(stderr, "ERROR: Binning needs raw or mono frames\n");
+		return -1;
+	}
+
+	bool bayer = binBayer(&src);
+	int bits = (bytes == 2) ? src.data_depth : 8;
+	int w, h;
+	binnedSize(src.size[0], src.size[1], bin_factor, bayer, &w, &h);
+
+	int size = w * h * binnedBytes(bytes, bin_how);
+	if (image->reserve(size, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate binning buffer\n");
+		return -1;
+	}
+	image->width  = w;
+	image->height = h;
+	image->size   = size;
+
+	if (binPixels(src.image, src.size[0], src.size[1], bytes, bits, bin_factor, bayer, bin_how, image->data) < 0)
+		return -1;
+
+	*view = src;
+	view->image       = image->data;
+	view->size[0]     = w;
+	view->size[1]     = h;
+	view->image_bytes = size;
+	view->data_depth  = binnedDepth(bits, bin_factor, bin_how);
+	if (size != (int)(w * h * bytes))
+		view->color_coding = bayer ? DC1394_COLOR_CODING_RAW16 : DC1394_COLOR_CODING_MONO16;
+
+	return 0;
+}
+
+/* Unpacks a frame of packed samples into image, to 8 bits if narrow */
+int camera::unpackFrame(const dc1394video_frame_t* frame, bool narrow, cam1394Image* image) {
+	size_t pixels = (size_t)frame->size[0] * frame->size[1];
+	if (frame->image_bytes < packedBytes(packing, pixels)) {
+		fprintf(stderr, "ERROR: Frame of %u bytes is too small for %zu packed samples\n",
+				(unsigned int)frame->image_bytes, pixels);
+		return -1;
+	}
+
+	int size = pixels * (narrow ? 1 : 2);
+	if (image->reserve(size, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate unpack buffer\n");
+		return -1;
+	}
+	image->width  = frame->size[0];
+	image->height = frame->size[1];
+	image->size   = size;
+
+	if (narrow)
+		unpackPixels8(frame->image, pixels, packing, image->data);
+	else
+		unpackPixels(frame->image, pixels, packing, (uint16_t*)image->data);
+	return 0;
+}
+
+/* Packed frames that are not debayered or corrected only keep their high bits */
+bool camera::narrowUnpack() {
+	return pipeline.convert == NULL && out_depth == DEPTH_TONEMAP8 && corrector == NULL;
+}
+
+/* Unpacks, corrects and bins a frame into the scratch buffers, packed samples
+ * to 8 bits if narrow, view describes the result */
+int camera::stageFrame(const dc1394video_frame_t* frame, dc1394video_frame_t* view, bool narrow) {
+	*view = *frame;
+
+	if (packing != PACKED_NONE) {
+		if (unpackFrame(frame, narrow, &unpacked) < 0)
+			return -1;
+
+		view->image       = unpacked.data;
+		view->image_bytes = unpacked.size;
+		view->data_depth  = narrow ? 8 : packing;
+	}
+
+	if (corrector != NULL) {
+		size_t pixels = (size_t)view->size[0] * view->size[1];
+		if (view->image_bytes % pixels != 0) {
+			fprintf(stderr, "ERROR: Calibration needs raw or mono frames\n");
 			return -1;
 		}
 
-		if (image->data != NULL)
-			image->destroy();
-		image->width  = end.size[0];
-		image->height = end.size[1];
-		image->size   = end.image_bytes;
-		image->data   = new uchar[image->size]();
-		memcpy(image->data, end.image, image->size);
-	} else {
-		if (image->data != NULL)
-			image->destroy();
-		image->width  = prev_frame->size[0];
-		image->height = prev_frame->size[1];
-		image->size   = prev_frame->image_bytes;
-		image->data   = new uchar[image->size]();
-		memcpy(image->data, prev_frame->image, image->size);
+		/* corrected out of the DMA buffer, or in place after unpacking */
+		if (view->image != unpacked.data) {
+			if (unpacked.reserve(view->image_bytes, getAllocator()) < 0) {
+				fprintf(stderr, "ERROR: Failed to allocate correction buffer\n");
+				return -1;
+			}
+			unpacked.width  = view->size[0];
+			unpacked.height = view->size[1];
+			unpacked.size   = view->image_bytes;
+		}
+
+		if (corrector->apply(view->image, unpacked.data, view->size[0], view->size[1],
+							 view->image_bytes / pixels, view->data_depth) < 0)
+			return -1;
+		view->image = unpacked.data;
 	}
 
-	free(end.image);
-	free(prev_frame);
+	if (bin_factor > 1 && binFrame(view, &binned, view) < 0)
+		return -1;
+
 	return 0;
 }
 
-#ifndef NOOPENCV
-cv::Mat camera::read()
-{
+/* Unpacks and corrects a frame into view if needed and meters it.
+ * Returns the frame to convert, NULL if failure. */
+dc1394video_frame_t* camera::prepareFrame(dc1394video_frame_t* frame, dc1394video_frame_t* view) {
+	/* the rest of the path sees packed and corrected frames as plain 8 or 16 bit ones */
+	if (packing != PACKED_NONE || corrector != NULL || bin_factor > 1) {
+		if (stageFrame(frame, view, narrowUnpack()) < 0)
+			return NULL;
+		frame = view;
+	}
+
+	if (exposure != NULL) {
+		size_t pixels = (size_t)frame->size[0] * frame->size[1];
+		int bytes = frame->image_bytes / pixels;
+		if ((bytes == 1 || bytes == 2) && frame->image_bytes == pixels * bytes)
+			exposure->update(frame->image, frame->size[0], frame->size[1], bytes, frame->data_depth);
+	}
+
+	return frame;
+}
+
+/* Writes the rectangle roi of the output image straight to dst */
+int camera::convertRegion(dc1394video_frame_t* frame, const pixel_rect& roi, uchar* dst, size_t stride) {
+	dc1394video_frame_t view;
+	if ((frame = prepareFrame(frame, &view)) == NULL)
+		return -1;
+
+	int w, h, pixel_bytes;
+	outputGeometry(frame, &w, &h, &pixel_bytes);
+
+	if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+		roi.x + roi.width > w || roi.y + roi.height > h) {
+		fprintf(stderr, "ERROR: Region %dx%d+%d+%d is outside the %dx%d image\n",
+				roi.width, roi.height, roi.x, roi.y, w, h);
+		return -1;
+	}
+
+	if (pipeline.convert == NULL) {
+		if (pixel_bytes == 0) {
+			if (roi.width != w || roi.height != h) {
+				fprintf(stderr, "ERROR: Regions of packed YUV411 frames are not supported\n");
+				return -1;
+			}
+			memcpy(dst, frame->image, frame->image_bytes);
+			return 0;
+		}
+
+		copyRegion(frame->image, (size_t)w * pixel_bytes, roi, pixel_bytes, dst, stride);
+		return 0;
+	}
+
+	/* one set of color parameters for the whole frame */
+	std::shared_ptr<const color_tables> tables;
+	if (color != NULL)
+		tables = color->tables();
+	int bits = (pipeline.bytes == 1) ? 8 : frame->data_depth;
+
+	/* a whole packed frame can be written straight to dst by any converter */
+	bool whole = (roi.width == w && roi.height == h && stride == (size_t)w * pixel_bytes);
+	if (pipeline.full_frame && !whole) {
+		if (debayer(frame) < 0)
+			return -1;
+
+		copyRegion(debayer_buf, (size_t)w * pixel_bytes, roi, pixel_bytes, dst, stride);
+		if (tables)
+			color_stage::apply(*tables, dst, roi.width, roi.height, stride, pipeline.bytes, bits, out_order);
+		return 0;
+	}
+
+	/* the color stage runs on bands of rows while they are still in cache */
+	int band = (tables && !pipeline.full_frame) ? COLOR_BAND_ROWS : roi.height;
+	for (int y = 0; y < roi.height; y += band) {
+		pixel_rect part = {roi.x, roi.y + y, roi.width, std::min(band, roi.height - y)};
+		uchar *out = dst + (size_t)y * stride;
+
+		if (pipeline.convert(frame->image, frame->size[0], frame->size[1], frame->data_depth,
+							 part, out, stride) < 0) {
+			fprintf(stderr, "ERROR: Unable to debayer frame\n");
+			return -1;
+		}
+		if (tables)
+			color_stage::apply(*tables, out, part.width, part.height, stride, pipeline.bytes, bits, out_order);
+	}
+
+	return 0;
+}
+
+int camera::read(cam1394Image* image) {
 	if (!cam)
 	{
 		fprintf(stderr, "ERROR: Camera not initialized\n");
 		exit(1);
 	}
 	
-	const int W = width;
-	const int H = height;
-	dc1394video_frame_t end;
-	dc1394video_frame_t * frame;
-	dc1394video_frame_t * prev_frame;
-	prev_frame = (dc1394video_frame_t *)malloc(sizeof(dc1394video_frame_t));
-	prev_frame->id = 255;
-	dc1394error_t err;
-	end.image = (unsigned char*)malloc(W * H * 3 * sizeof(unsigned char));
-	end.color_coding = DC1394_COLOR_CODING_RGB8;
-	
-	
-	int frames_read = 0;
-		
-	err = dc1394_capture_dequeue(cam, DC1394_CAPTURE_POLICY_WAIT, &frame);
-	if (frame != NULL && err == DC1394_SUCCESS)
+	dc1394video_frame_t frame;
+	if (grabFrame(&frame) < 0)
+		return -1;
+
+	int w, h, pixel_bytes;
+	outputGeometry(&frame, &w, &h, &pixel_bytes);
+	int size = pixel_bytes ? w * h * pixel_bytes : frame.image_bytes;
+
+	if (image->reserve(size, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	image->width  = w;
+	image->height = h;
+	image->size   = size;
+
+	pixel_rect all = {0, 0, w, h};
+	return convertRegion(&frame, all, image->data, (size_t)w * pixel_bytes);
+}
+
+int camera::read(uchar* dst, size_t stride, int x, int y, int width, int height) {
+	if (!cam)
 	{
-		dc1394_capture_enqueue(cam, frame);
-		memcpy(prev_frame, frame, sizeof(dc1394video_frame_t));
-		frames_read++;
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
 	}
 
-	while (1)
+	dc1394video_frame_t frame;
+	if (grabFrame(&frame) < 0)
+		return -1;
+
+	pixel_rect roi = {x, y, width, height};
+	return convertRegion(&frame, roi, dst, stride);
+}
+
+int camera::poll(cam1394Image* image) {
+	if (!cam)
 	{
-		err = dc1394_capture_dequeue(cam, DC1394_CAPTURE_POLICY_POLL, &frame);
-		if (frame == NULL && err == DC1394_SUCCESS && prev_frame->id != 255)
-			break;
-		else if (frame != NULL && err == DC1394_SUCCESS)
-		{
-			dc1394_capture_enqueue(cam, frame);
-			memcpy(prev_frame, frame, sizeof(dc1394video_frame_t));
-			frames_read++;
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
+	}
+
+	dc1394video_frame_t frame;
+	int ret = grabFrame(&frame, false);
+	if (ret <= 0)
+		return ret;
+
+	int w, h, pixel_bytes;
+	outputGeometry(&frame, &w, &h, &pixel_bytes);
+	int size = pixel_bytes ? w * h * pixel_bytes : frame.image_bytes;
+
+	if (image->reserve(size, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	image->width  = w;
+	image->height = h;
+	image->size   = size;
+
+	pixel_rect all = {0, 0, w, h};
+	if (convertRegion(&frame, all, image->data, (size_t)w * pixel_bytes) < 0)
+		return -1;
+
+	return 1;
+}
+
+int camera::getFileDescriptor() {
+	if (!cam)
+		return -1;
+
+	return dc1394_capture_get_fileno(cam);
+}
+
+int camera::readRaw(cam1394Image* image) {
+	if (!cam)
+	{
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
+	}
+
+	return (grabRaw(image, true) < 0) ? -1 : 0;
+}
+
+int camera::pollRaw(cam1394Image* image) {
+	if (!cam)
+	{
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
+	}
+
+	return grabRaw(image, false);
+}
+
+/* Copies the newest frame as it came from the camera.
+ * Returns 1 with a frame, 0 if wait is false and no frame was ready. */
+int camera::grabRaw(cam1394Image* image, bool wait) {
+	dc1394video_frame_t frame;
+	int ret = grabFrame(&frame, wait);
+	if (ret <= 0)
+		return ret;
+
+	if (image->reserve(frame.image_bytes, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	image->width  = frame.size[0];
+	image->height = frame.size[1];
+	image->size   = frame.image_bytes;
+	memcpy(image->data, frame.image, frame.image_bytes);
+	image->depth  = frame.data_depth;
+	image->coding = frame.color_coding;
+
+	return 1;
+}
+
+int camera::readLazy(lazy_frame* frame) {
+	dc1394color_coding_t coding;
+	int depth;
+
+	if (packing == PACKED_NONE && corrector == NULL && bin_factor == 1) {
+		cam1394Image *raw = frame->fill();
+		if (readRaw(raw) < 0)
+			return -1;
+		coding = raw->coding;
+		depth  = raw->depth;
+	} else {
+		/* staged as for read, but lazy frames convert from whole samples */
+		dc1394video_frame_t raw, view;
+		if (grabFrame(&raw) < 0 || stageFrame(&raw, &view, false) < 0)
+			return -1;
+
+		cam1394Image *dst = frame->fill();
+		if (dst->reserve(view.image_bytes, getAllocator()) < 0) {
+			fprintf(stderr, "ERROR: Failed to allocate image\n");
+			return -1;
 		}
+		dst->width  = view.size[0];
+		dst->height = view.size[1];
+		dst->size   = view.image_bytes;
+		memcpy(dst->data, view.image, view.image_bytes);
+
+		bool bayer = packing != PACKED_NONE || binBayer(&raw);
+		if (view.image_bytes == (uint64_t)view.size[0] * view.size[1])
+			coding = bayer ? DC1394_COLOR_CODING_RAW8 : DC1394_COLOR_CODING_MONO8;
+		else
+			coding = bayer ? DC1394_COLOR_CODING_RAW16 : DC1394_COLOR_CODING_MONO16;
+		depth = view.data_depth;
+
+		dst->depth  = depth;
+		dst->coding = coding;
 	}
-	droppedframes = frames_read - 1;
-	prev_frame->color_filter= bayer_pat;
 
-	int bits = prev_frame->image_bytes/(prev_frame->size[0]*prev_frame->size[1]) * 8;
+	frame->describe(coding, bayer_pat,
+					bayer_met == -1 ? DC1394_BAYER_METHOD_BILINEAR : bayer_met,
+					depth, getAllocator());
+	frame->timestamp = timestamp;
+	frame->dropped   = droppedframes;
+	frame->changed   = changed;
+	frame->guid      = guid;
 
+	return 0;
+}
+
+int camera::readTensor(tensor_exporter* exp, const std::vector<pixel_rect>& rois, float* tensor) {
+	if (!cam)
+	{
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
+	}
+
+	dc1394video_frame_t raw, view;
+	if (grabFrame(&raw) < 0)
+		return -1;
+
+	dc1394video_frame_t* frame = prepareFrame(&raw, &view);
+	if (frame == NULL)
+		return -1;
+
+	size_t pixels = (size_t)frame->size[0] * frame->size[1];
+	int bytes = frame->image_bytes / pixels;
+	if ((bytes != 1 && bytes != 2) || frame->image_bytes != pixels * bytes) {
+		fprintf(stderr, "ERROR: Tensor export needs raw or mono frames\n");
+		return -1;
+	}
+
+	dc1394color_filter_t pattern = (pipeline.convert != NULL) ? bayer_pat : (dc1394color_filter_t)0;
+	return exp->run(frame->image, frame->size[0], frame->size[1], bytes,
+					bytes == 2 ? frame->data_depth : 8, pattern, rois, tensor);
+}
+
+int camera::convert(const cam1394Image* raw, cam1394Image* image) {
+	/* only the fields convertRegion looks at */
+	dc1394video_frame_t frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.image       = raw->data;
+	frame.size[0]     = raw->width;
+	frame.size[1]     = raw->height;
+	frame.image_bytes = raw->size;
+	frame.data_depth  = raw->depth;
+	frame.color_coding = raw->coding;
+
+	int w, h, pixel_bytes;
+	outputGeometry(&frame, &w, &h, &pixel_bytes);
+	int size = pixel_bytes ? w * h * pixel_bytes : raw->size;
+
+	if (image->reserve(size, getAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	image->width  = w;
+	image->height = h;
+	image->size   = size;
+
+	pixel_rect all = {0, 0, w, h};
+	return convertRegion(&frame, all, image->data, (size_t)w * pixel_bytes);
+}
+
+#ifndef NOOPENCV
+cv::Mat camera::read()
+{
+	if (!cam)
+	{
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
+	}
+	
 	cv::Mat ret;
-	if (bayer_met != -1) {
-		if (DC1394_SUCCESS != dc1394_debayer_frames(prev_frame, &end, bayer_met))
-		{
-			fprintf(stderr, "ERROR: Unable to debayer frame\n");
-		}
+	dc1394video_frame_t frame;
+	if (grabFrame(&frame) < 0)
+		return ret;
 
-		cv::Mat final(H, W, getOpenCVbits(bits, 3), end.image);
-		final.copyTo(ret);
-	} else {
-		cv::Mat final(H, W, getOpenCVbits(bits, 1), prev_frame->image);
-		final.copyTo(ret);
+	int w, h, pixel_bytes;
+	outputGeometry(&frame, &w, &h, &pixel_bytes);
+
+	cv::Mat final;
+	final.allocator = getAllocator()->matAllocator();
+	final.create(h, w, outputType(&frame));
+	pixel_rect all = {0, 0, w, h};
+	if (convertRegion(&frame, all, final.data, final.step) < 0)
+		return ret;
+
+	return final;
+}
+
+int camera::read(cv::Mat& dst, const cv::Rect& roi)
+{
+	if (!cam)
+	{
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		exit(1);
 	}
 
-	timestamp = prev_frame->timestamp;
-	free(end.image);
-	free(prev_frame);
-	return ret;
+	dc1394video_frame_t frame;
+	if (grabFrame(&frame) < 0)
+		return -1;
+
+	int type = outputType(&frame);
+	if (dst.empty()) {
+		dst.allocator = getAllocator()->matAllocator();
+		dst.create(roi.height, roi.width, type);
+	} else if (dst.rows != roi.height || dst.cols != roi.width || dst.type() != type) {
+		fprintf(stderr, "ERROR: Destination does not match the %dx%d region\n", roi.width, roi.height);
+		return -1;
+	}
+
+	pixel_rect rect = {roi.x, roi.y, roi.width, roi.height};
+	return convertRegion(&frame, rect, dst.data, dst.step);
+}
+
+/* OpenCV type of the image read returns for a frame */
+int camera::outputType(const dc1394video_frame_t* frame) {
+	if (pipeline.convert != NULL)
+		return getOpenCVbits(pipeline.bytes * 8, pipeline.channels);
+
+	int w, h, bytes;
+	stagedFormat(frame, &w, &h, &bytes);
+	return getOpenCVbits(bytes * 8, 1);
 }
 #endif
 
+/* Starts a fresh set of drop counters for a newly set up DMA ring */
+void camera::resetAnalytics() {
+	double period = 0;
+	if (abs_fps > 0)
+		period = 1e6 / abs_fps;
+	else if (_video_mode < DC1394_VIDEO_MODE_FORMAT7_MIN)
+		period = 1e6 / frameRateValue(_fps);
+
+	analytics.reset(dma_buffers, period);
+}
+
+frame_stats camera::getFrameStats() {
+	return analytics.get();
+}
+
+void camera::setDropCallback(double bus_rate, double consumer_rate, drop_callback cb, void* user) {
+	analytics.setDropCallback(bus_rate, consumer_rate, cb, user);
+}
+
 long camera::getTimestamp()
 {
 	return timestamp;
@@ -1021,6 +1652,11 @@ int camera::getNumDroppedFrames()
 	return droppedframes;
 }
 
+bool camera::frameChanged()
+{
+	return changed;
+}
+
 void camera::printGUID()
 {
 	printf("GUID of attached camera is: %016lX\n", guid);
@@ -1031,54 +1667,217 @@ long camera::getGUID() {
 }
 
 int camera::setVideoMode(const char* video_mode) {
-	if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_OFF)) {
-		clean_up();
-		fprintf(stderr, "ERROR: Failed to stop transmission\n");
-		return -1;	
-	} else if (DC1394_SUCCESS != dc1394_capture_stop(cam)) {
-		clean_up();
-		fprintf(stderr, "ERROR: Failed to stop capture\n");
-		return -1;	
+	mode_switch sw;
+	if (prepareSwitch(video_mode, -1, &sw) < 0)
+		return -1;
+
+	return commitSwitch(&sw);
+}
+
+int camera::setFrameRate(float fps) {
+	mode_switch sw;
+	if (prepareSwitch(videoModeNames[_video_mode - STARTVIDEOMODE], fps, &sw) < 0)
+		return -1;
+
+	return commitSwitch(&sw);
+}
+
+int camera::prepareSwitch(const char* mode_name, float fps, mode_switch* sw) {
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
 	}
 
-	int ret;
-	if ((ret = _setVideoMode(video_mode)) < 0)
-		return ret;
+	sw->prepared = false;
 
-	if (DC1394_SUCCESS != dc1394_capture_setup(cam, 10, DC1394_CAPTURE_FLAGS_DEFAULT)) {
-		clean_up();
-		fprintf(stderr, "ERROR: Failed to start capture\n");
-		return -1;	
-	} else if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_ON)) {
-		clean_up();
-		fprintf(stderr, "ERROR: Failed to start transmission\n");
-		return -1;	
+	int i;
+	for (i = 0; i < DC1394_VIDEO_MODE_NUM; i++) {
+		if (!strcasecmp(mode_name, videoModeNames[i]))
+			break;
+	}
+
+	dc1394video_mode_t mode = (dc1394video_mode_t)(i + STARTVIDEOMODE);
+	const video_mode *info = findVideoMode(mode);
+	if (i == DC1394_VIDEO_MODE_NUM || info == NULL) {
+		fprintf(stderr, "ERROR: invalid video mode: %s\n", mode_name);
+		return -1;
 	}
 
+	/* everything below comes from the capability cache, the camera is not touched */
+	dc1394framerate_t rate = (dc1394framerate_t)0;
+	if (!info->format7) {
+		if (fps <= 0) {
+			if (getBestFrameRate(&rate, mode) < 0)
+				return -1;
+		} else if (convertFrameRate(fps, &rate, mode) < 0) {
+			fprintf(stderr, "ERROR: invalid frame rate %f for %s\n", fps, mode_name);
+			return -1;
+		}
+	}
+
+	uint32_t w, h, depth;
+	dc1394color_coding_t coding;
+	if (info->format7) {
+		w = info->format7_mode.size_x;
+		h = info->format7_mode.size_y;
+		coding = info->format7_mode.color_coding;
+	} else if (DC1394_SUCCESS != dc1394_get_image_size_from_video_mode(cam, mode, &w, &h) ||
+			   DC1394_SUCCESS != dc1394_get_color_coding_from_video_mode(cam, mode, &coding)) {
+		fprintf(stderr, "ERROR: Failed to convert video mode to image size\n");
+		return -1;
+	}
+
+	if (DC1394_SUCCESS != dc1394_get_color_coding_data_depth(coding, &depth))
+		depth = 8;
+
+	if (reserveDebayerBuffer(w, h, depth) < 0)
+		return -1;
+
+	sw->mode      = mode;
+	sw->framerate = rate;
+	sw->width     = w;
+	sw->height    = h;
+	sw->blackout  = 0;
+	sw->prepared  = true;
 	return 0;
 }
 
-int camera::setFrameRate(float fps) {
+int camera::commitSwitch(mode_switch* sw) {
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
+	} else if (!sw->prepared) {
+		fprintf(stderr, "ERROR: Video mode switch was not prepared\n");
+		return -1;
+	}
+
+	Timer blackout;
+	blackout.start();
+
 	if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_OFF)) {
-		clean_up();
 		fprintf(stderr, "ERROR: Failed to stop transmission\n");
 		return -1;	
-	} else if (DC1394_SUCCESS != dc1394_capture_stop(cam)) {
-		clean_up();
-		fprintf(stderr, "ERROR: Failed to stop capture\n");
-		return -1;	
 	}
+	dc1394_capture_stop(cam);
 
-	int ret;
-	if ((ret = _setFrameRate(fps)) < 0)
-		return ret;
+	if (startCapture(sw->mode, sw->framerate) < 0) {
+		fprintf(stderr, "ERROR: Failed to switch to %s, restoring %s\n",
+				videoModeNames[sw->mode - STARTVIDEOMODE], videoModeNames[_video_mode - STARTVIDEOMODE]);
 
-	if (DC1394_SUCCESS != dc1394_capture_setup(cam, 10, DC1394_CAPTURE_FLAGS_DEFAULT)) {
-		clean_up();
+		if (startCapture(_video_mode, _fps) < 0) {
+			clean_up();
+			fprintf(stderr, "ERROR: Failed to restore video mode\n");
+			return -1;
+		}
+		resetAnalytics();
+
+		blackout.end();
+		sw->blackout = blackout.elapsed() * 1000;
+		return -1;
+	}
+
+	blackout.end();
+	sw->blackout = blackout.elapsed() * 1000;
+
+	_video_mode = sw->mode;
+	_fps        = sw->framerate;
+	width       = sw->width;
+	height      = sw->height;
+
+	/* give the rate back to the video mode */
+	if (abs_fps > 0) {
+		dc1394_feature_set_mode(cam, DC1394_FEATURE_FRAME_RATE, DC1394_FEATURE_MODE_AUTO);
+		abs_fps = 0;
+	}
+
+	resetAnalytics();
+	return updatePipeline();
+}
+
+std::vector<float> camera::getFrameRates() {
+	std::vector<float> rates;
+	const video_mode *info = findVideoMode(_video_mode);
+	if (info == NULL)
+		return rates;
+
+	for (size_t i = 0; i < info->framerates.size(); i++)
+		rates.push_back(frameRateValue(info->framerates[i]));
+	return rates;
+}
+
+float camera::getFrameRate() {
+	if (abs_fps > 0)
+		return abs_fps;
+	if (_video_mode < DC1394_VIDEO_MODE_FORMAT7_MIN)
+		return frameRateValue(_fps);
+
+	float fps = 0;
+	if (cam != NULL)
+		dc1394_feature_get_absolute_value(cam, DC1394_FEATURE_FRAME_RATE, &fps);
+	return fps;
+}
+
+int camera::getAbsoluteFrameRateRange(float* min, float* max) {
+	dc1394bool_t present = DC1394_FALSE;
+
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
+	} else if (DC1394_SUCCESS != dc1394_feature_is_present(cam, DC1394_FEATURE_FRAME_RATE, &present) || !present) {
+		return -1;
+	} else if (DC1394_SUCCESS != dc1394_feature_get_absolute_boundaries(cam, DC1394_FEATURE_FRAME_RATE, min, max)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int camera::setAbsoluteFrameRate(float fps) {
+	if (!cam) {
+		fprintf(stderr, "ERROR: Camera not initialized\n");
+		return -1;
+	}
+
+	if (DC1394_SUCCESS != dc1394_feature_set_mode(cam, DC1394_FEATURE_FRAME_RATE, DC1394_FEATURE_MODE_MANUAL))
+	{
+		fprintf(stderr, "ERROR: Unable to set frame rate mode\n");
+		return -1;
+	}
+	if (DC1394_SUCCESS != dc1394_feature_set_absolute_control(cam, DC1394_FEATURE_FRAME_RATE, DC1394_ON))
+	{
+		fprintf(stderr, "ERROR: Unable to enable absolute frame rate control\n");
+		return -1;
+	}
+	if (DC1394_SUCCESS != dc1394_feature_set_absolute_value(cam, DC1394_FEATURE_FRAME_RATE, fps))
+	{
+		fprintf(stderr, "ERROR: Unable to set frame rate to %f\n", fps);
+		return -1;
+	}
+
+	/* gaps in the timestamps are measured against the new period from now on */
+	abs_fps = fps;
+	resetAnalytics();
+	return 0;
+}
+
+void camera::setGovernor(rate_governor* gov) {
+	governor = gov;
+}
+
+/* Sets the mode and rate and starts capture, leaves capture stopped on failure */
+int camera::startCapture(dc1394video_mode_t mode, dc1394framerate_t rate) {
+	if (DC1394_SUCCESS != dc1394_video_set_mode(cam, mode)) {
+		fprintf(stderr, "ERROR: Failed to set the video mode\n");
+		return -1;
+	} else if (mode < DC1394_VIDEO_MODE_FORMAT7_MIN &&
+			   DC1394_SUCCESS != dc1394_video_set_framerate(cam, rate)) {
+		fprintf(stderr, "ERROR: Failed to set the framerate\n");
+		return -1;
+	} else if (DC1394_SUCCESS != dc1394_capture_setup(cam, dma_buffers, DC1394_CAPTURE_FLAGS_DEFAULT)) {
 		fprintf(stderr, "ERROR: Failed to start capture\n");
 		return -1;	
 	} else if (DC1394_SUCCESS != dc1394_video_set_transmission(cam, DC1394_ON)) {
-		clean_up();
+		dc1394_capture_stop(cam);
 		fprintf(stderr, "ERROR: Failed to start transmission\n");
 		return -1;	
 	}
@@ -1086,12 +1885,87 @@ int camera::setFrameRate(float fps) {
 	return 0;
 }
 
+/* Grows the debayer output buffer to hold a w x h RGB image of the given depth */
+int camera::reserveDebayerBuffer(int w, int h, int depth) {
+	size_t size = (size_t)w * h * 3 * (depth > 8 ? 2 : 1);
+	frame_allocator *alloc = getAllocator();
+	if (size <= debayer_size && alloc == debayer_alloc)
+		return 0;
+
+	freeDebayerBuffer();
+	debayer_buf = (uchar*)alloc->allocate(size);
+	if (debayer_buf == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate debayer buffer\n");
+		return -1;
+	}
+
+	debayer_size  = size;
+	debayer_alloc = alloc;
+	return 0;
+}
+
+void camera::freeDebayerBuffer() {
+	if (debayer_alloc != NULL)
+		debayer_alloc->deallocate(debayer_buf);
+	debayer_buf   = NULL;
+	debayer_size  = 0;
+	debayer_alloc = NULL;
+}
+
+int camera::setRealtime(const realtime_settings& settings) {
+	rt = settings;
+	if (cam == NULL)
+		return 0;
+
+	return applyRealtime();
+}
+
+realtime_settings camera::getRealtime() {
+	return rt;
+}
+
+realtime_report camera::getRealtimeReport() {
+	rt_report.buffer = placed.last();
+	return rt_report;
+}
+
+/* Pins the calling thread and picks the node host buffers go on */
+int camera::applyRealtime() {
+	int ret = applyThreadSettings(rt.cpus, rt.priority, &rt_report.capture);
+
+	int node = rt.numa_node;
+	if (node == -1)
+		node = rt_report.capture.node;
+	rt_report.numa_node = (node < 0) ? -1 : node;
+
+	placed.configure(rt_report.numa_node, rt.huge_pages, rt.lock_memory);
+
+	/* buffers allocated before the change are placed again on the next read */
+	if (debayer_alloc == &placed)
+		freeDebayerBuffer();
+
+	return ret;
+}
+
+void camera::setAllocator(frame_allocator* alloc) {
+	allocator = alloc;
+}
+
+frame_allocator* camera::getAllocator() {
+	if (allocator != NULL)
+		return allocator;
+	if (rt.numa_node != -2 || rt.huge_pages || rt.lock_memory)
+		return &placed;
+	return heapAllocator();
+}
+
 void camera::printVideoMode() {
 	printf("Video Mode: %s\n", videoModeNames[_video_mode - STARTVIDEOMODE]);
 }
 
 void camera::printFrameRate() {
-	printf("Frame Rate: %f\n", videoFrameRates[_fps - STARTFRAMERATE]);
+	/* Format7 modes and absolute rates have no fixed frame rate */
+	printf("Frame Rate: %f\n", getFrameRate());
 }
 
 #ifndef NOOPENCV
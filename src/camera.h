@@ -28,10 +28,20 @@
 #ifndef NOOPENCV
 #include <cv.h>
 #include <highgui.h>
+#else
+typedef unsigned char uchar;
 #endif
 
+#include <cstddef>
 #include <vector>
 
+#include "pixelpipe.h"
+#include "framestats.h"
+#include "realtime.h"
+#include "allocator.h"
+#include "changegate.h"
+#include "binning.h"
+
 
 
 //! Contains the camera class definition and other misc variables
@@ -59,6 +69,13 @@ namespace cam1394
 	}
 
 	
+	class lazy_frame;
+	class rate_governor;
+	class raw_corrector;
+	class color_stage;
+	class auto_exposure;
+	class tensor_exporter;
+
 	/*!\brief Structure for holding images grabbed from the camera
 	 */
 	struct cam1394Image {
@@ -68,18 +85,50 @@ namespace cam1394
 		int width;
 		/*!\brief Height of the image in pixels */
 		int height;
-		/*!\brief Size of the \link data \endlink buffer */
+		/*!\brief Size of the image in the \link data \endlink buffer */
 		int size;
-
-		cam1394Image() : data(NULL) {}
+		/*!\brief Number of bytes allocated for \link data \endlink */
+		int capacity;
+		/*!\brief Where \link data \endlink came from, NULL if it was allocated with new[] */
+		frame_allocator *allocator;
+		/*!\brief Significant bits per sample of a frame from camera::readRaw */
+		int depth;
+		/*!\brief Color coding of a frame from camera::readRaw */
+		dc1394color_coding_t coding;
+
+		cam1394Image() : data(NULL), size(0), capacity(0), allocator(NULL),
+			depth(8), coding(DC1394_COLOR_CODING_MONO8) {}
 		/*!\brief destroys cam1394Image
 		 * \return 1 if success, < 0 failure
 		 */
 		int destroy() {
 			if (data != NULL) {
-				delete[] data;
+				if (allocator != NULL)
+					allocator->deallocate(data);
+				else
+					delete[] data;
 				data = NULL;
 			}
+			capacity  = 0;
+			allocator = NULL;
+
+			return 0;
+		}
+
+		/*!\brief makes \link data \endlink hold at least bytes bytes from alloc,
+		 * keeping the current buffer if it already does
+		 * \return 0 if success, < 0 failure
+		 */
+		int reserve(int bytes, frame_allocator* alloc) {
+			if (data != NULL && capacity >= bytes && allocator == alloc)
+				return 0;
+
+			destroy();
+			data = (uchar*)alloc->allocate(bytes);
+			if (data == NULL)
+				return -1;
+			capacity  = bytes;
+			allocator = alloc;
 
 			return 0;
 		}
@@ -104,6 +153,26 @@ namespace cam1394
 		dc1394format7mode_t format7_mode;
 	};
 
+	/*!\brief Structure describing a video mode change prepared by
+	 * camera::prepareSwitch
+	 */
+	struct mode_switch {
+		dc1394video_mode_t mode;
+		dc1394framerate_t framerate;
+
+		/*!\brief Width of the image in pixels after the switch */
+		int width;
+		/*!\brief Height of the image in pixels after the switch */
+		int height;
+
+		/*!\brief Time in ms that capture was stopped by the last camera::commitSwitch */
+		double blackout;
+
+		bool prepared;
+
+		mode_switch() : width(-1), height(-1), blackout(0), prepared(false) {}
+	};
+
 	/*!\brief Structure containing information about a camera
 	 */
 	struct camera_info {
@@ -182,13 +251,105 @@ namespace cam1394
 		/*!\brief Reads an image from a camera
 		 * \return cv::Mat with image if success, an empty cv::Mat if failure
 		 */
-		cv::Mat read();//cv::Mat&);
+		cv::Mat read();
+
+		/*!\brief Reads a rectangle of an image from a camera into dst
+		 *
+		 * Only the pixels inside roi are converted.  dst may be a view into
+		 * a larger cv::Mat, it is written through its own step.
+		 * \param dst	empty to allocate it, otherwise roi.height x roi.width
+		 * 				of the type cv::Mat read() returns
+		 * \param roi	rectangle of the output image to read
+		 * \return 0 if success, <0 if failure
+		 */
+		int read(cv::Mat& dst, const cv::Rect& roi);
 #endif
 
 		/*!\brief Reads an image from a camera
+		 *
+		 * image->data is reused when it is large enough.
 		 * \return 1 if success, < 0 failure
 		 */
 		int read(cam1394Image* image);
+
+		/*!\brief Reads a rectangle of an image from a camera into a caller's buffer
+		 *
+		 * Only the pixels inside the rectangle are converted, straight into dst.
+		 * Pixels are laid out as for read(cam1394Image*).
+		 * \param dst		first pixel of the destination rectangle
+		 * \param stride	bytes between the starts of two rows of dst
+		 * \param x		left column of the rectangle in the output image
+		 * \param y		top row of the rectangle in the output image
+		 * \param width		width of the rectangle in pixels
+		 * \param height	height of the rectangle in pixels
+		 * \return 0 if success, <0 if failure
+		 */
+		int read(uchar* dst, size_t stride, int x, int y, int width, int height);
+
+		/*!\brief Reads an image from a camera if one is ready, without waiting
+		 *
+		 * Meant to be called when #getFileDescriptor is readable.
+		 * \return 1 if an image was read, 0 if none was ready, < 0 failure
+		 */
+		int poll(cam1394Image* image);
+
+		/*!\brief gets the file descriptor of the capture, readable when a
+		 * frame is waiting in the DMA ring
+		 * \return the descriptor, <0 if capture is not set up
+		 */
+		int getFileDescriptor();
+
+		/*!\brief Reads an image from a camera without converting it
+		 *
+		 * The raw frame can be converted later, possibly on another thread,
+		 * with #convert.
+		 * \return 0 if success, < 0 failure
+		 */
+		int readRaw(cam1394Image* image);
+
+		/*!\brief Reads an image from a camera without converting it, if one
+		 * is ready, without waiting
+		 *
+		 * Meant to be called when #getFileDescriptor is readable.
+		 * \return 1 if an image was read, 0 if none was ready, < 0 failure
+		 */
+		int pollRaw(cam1394Image* image);
+
+		/*!\brief Reads an image from a camera into a frame that converts on demand
+		 *
+		 * The frame is unpacked, corrected and binned as for #read, packed
+		 * samples always to 16 bits.  REPR_BGR uses the debayer method given
+		 * at #open, BILINEAR if none was.  Conversions are made with the
+		 * allocator of the camera.
+		 * \return 0 if success, < 0 failure
+		 */
+		int readLazy(lazy_frame* frame);
+
+		/*!\brief Reads regions of a frame into a float NCHW batch
+		 *
+		 * The frame is unpacked and corrected as for #read, then exported
+		 * by exp in one pass.  Frames are taken as bayer when a debayer
+		 * method was given, as mono otherwise.  The color stage is not
+		 * applied.
+		 * \param exp		a started exporter
+		 * \param rois		regions in raw frame pixels
+		 * \param tensor	room for exp->batchSize(rois.size()) floats
+		 * \return 0 if success, < 0 failure
+		 */
+		int readTensor(tensor_exporter* exp, const std::vector<pixel_rect>& rois, float* tensor);
+
+		/*!\brief Converts a frame from #readRaw as #read would have
+		 *
+		 * Unpacking, correction, binning and full frame debayering go
+		 * through scratch buffers of the camera, so conversions, by this
+		 * and by every read but #readRaw, must run on one thread at a time,
+		 * and not while the video mode or bayer settings change.  The
+		 * convert stage of a frame_pipeline converts one frame at a time.
+		 * \param raw	frame from #readRaw
+		 * \param image	filled in with the converted image
+		 * \return 0 if success, < 0 failure
+		 */
+		int convert(const cam1394Image* raw, cam1394Image* image);
 		
 		/*!\brief Sets the brightness of the camera
 		 * \param brightness brightness value
@@ -220,13 +381,39 @@ namespace cam1394
 		 */
 		int setTrigger(int trigger_in);
 
-		/*!\brief Sets the the white balence
+		/*!\brief Sets the the white balence, turning auto white balance off
 		 * \param b_u blue value (0-255)
 		 * \param r_v red value (0-255)
 		 * \return 0 if success, <0 if failure
 		 */
 		int setWhiteBalance(unsigned int b_u, unsigned int r_v);
 
+		/*!\brief Gets the shutter value
+		 * \return 0 if success, <0 if failure
+		 */
+		int getShutter(unsigned int* shutter);
+
+		/*!\brief Gets whether the shutter is controlled by the camera
+		 * \param autoShutter true if the shutter is in auto mode
+		 * \return 0 if success, <0 if failure
+		 */
+		int getShutterMode(bool* autoShutter);
+
+		/*!\brief Gets the gain value
+		 * \return 0 if success, <0 if failure
+		 */
+		int getGain(unsigned int* gain);
+
+		/*!\brief Gets the white balance values
+		 * \return 0 if success, <0 if failure
+		 */
+		int getWhiteBalance(unsigned int* b_u, unsigned int* r_v);
+
+		/*!\brief Gets the range of values a feature accepts
+		 * \return 0 if success, <0 if failure
+		 */
+		int getFeatureRange(dc1394feature_t feature, unsigned int* min, unsigned int* max);
+
 		/*!\brief Sets whether the camera outputs raw
 		 * \param raw True is raw, False is grayscale
 		 * \return 0 if success, <0 if failure
@@ -243,6 +430,57 @@ namespace cam1394
 		 */
 		int getNumDroppedFrames();
 
+		/*!\brief tells whether the last frame passed the change gate
+		 * \return false if the gate found it static, true otherwise
+		 */
+		bool frameChanged();
+
+		/*!\brief gets the drop and DMA ring counters since capture was last set up
+		 *
+		 * Separates frames lost on the bus from frames drained by #read
+		 * because the caller was too slow.
+		 */
+		frame_stats getFrameStats();
+
+		/*!\brief calls cb when a drop rate over the last FRAMESTATS_WINDOW
+		 * seconds crosses a threshold, and again when it falls back.  The
+		 * drop_crossing flags passed to cb tell which rates crossed and which way
+		 * \param bus_rate		fraction of frames lost on the bus, <=0 disables
+		 * \param consumer_rate	fraction of frames drained by #read, <=0 disables
+		 */
+		void setDropCallback(double bus_rate, double consumer_rate, drop_callback cb, void* user);
+
+		/*!\brief sets the thread scheduling and frame buffer placement
+		 *
+		 * The settings are applied by #open to the calling thread, or right
+		 * away to the calling thread if the camera is already open.  Placed
+		 * buffers come from an allocator owned by the camera, so images read
+		 * with them have to be destroyed before the camera.
+		 * \return 0 if everything was applied or will be at #open, <0 if
+		 * something was not, see #getRealtimeReport
+		 */
+		int setRealtime(const realtime_settings& settings);
+
+		/*!\brief gets the settings given to #setRealtime
+		 */
+		realtime_settings getRealtime();
+
+		/*!\brief gets the scheduling and frame buffer placement the camera actually got
+		 */
+		realtime_report getRealtimeReport();
+
+		/*!\brief sets where frame and scratch buffers of #read come from
+		 *
+		 * The allocator must outlive the camera and every image read with it.
+		 * \param alloc	the allocator, NULL for the default, which places
+		 * 				buffers as set by #setRealtime or else uses the heap
+		 */
+		void setAllocator(frame_allocator* alloc);
+
+		/*!\brief gets the allocator #read uses
+		 */
+		frame_allocator* getAllocator();
+
 		/*!\brief prints the GUID of attached camera
 		 */
 		void printGUID();
@@ -264,14 +502,188 @@ namespace cam1394
 		 */
 		int setBayer(const char* method, const char* pattern);
 
-		int setVideoMode(const char*);
+		/*!\brief sets the channel order of debayered frames, RGB by default
+		 * \return 0 if success, <0 if failure
+		 */
+		int setOutputOrder(pixel_order order);
+
+		/*!\brief sets the sample depth of debayered 16 bit frames
+		 * \param depth DEPTH_SOURCE keeps 16 bits, DEPTH_TONEMAP8 maps
+		 * the data depth of the frame to 8 bits
+		 * \return 0 if success, <0 if failure
+		 */
+		int setOutputDepth(pixel_depth depth);
+
+		/*!\brief sets how the samples of Format7 frames are packed
+		 *
+		 * Packed frames are unpacked to 16 bits before debayering, or to
+		 * their 8 most significant bits when they are not debayered and
+		 * the output depth is DEPTH_TONEMAP8.  #readRaw still returns the
+		 * packed bytes.
+		 * \param layout	packing of the samples the camera sends
+		 * \param coding_id	vendor COLOR_CODING_ID that makes the camera send
+		 * 					them, written to the current Format7 mode, 0 to
+		 * 					leave the camera alone
+		 * \return 0 if success, <0 if failure
+		 */
+		int setPacking(pixel_packing layout, unsigned int coding_id = 0);
+
+		/*!\brief gets the packing set with #setPacking */
+		pixel_packing getPacking();
+
+		/*!\brief bins frames in software as they are read
+		 *
+		 * Bayer frames, raw codings or any frame when a debayer method is
+		 * set, are binned by color so the pattern is kept.  Every read path
+		 * but #readRaw returns binned frames, #convert bins frames from
+		 * #readRaw.  Binning follows unpacking and correction.
+		 * \param factor	bin size in each direction, 2 or 4, 1 to stop binning
+		 * \param mode		sum or average the bins
+		 * \return 0 if success, <0 if failure
+		 */
+		int setBinning(int factor, bin_mode mode = BIN_AVERAGE);
+
+		/*!\brief gets the bin size set with #setBinning, 1 when not binning */
+		int getBinning();
+
+		/*!\brief corrects raw frames with a calibration before they are debayered
+		 *
+		 * The whole frame is corrected even when a region is read.  #readRaw
+		 * returns uncorrected frames.
+		 * \param correction the corrector, NULL to stop correcting
+		 * \return 0 if success, <0 if failure
+		 */
+		int setCorrection(raw_corrector* correction);
+
+		/*!\brief applies white balance, a color matrix and gamma to debayered frames
+		 *
+		 * The stage runs on each band of rows right after it is debayered.
+		 * Frames that are not debayered are left alone.
+		 * \param stage the color stage, NULL to remove it
+		 * \return 0 if success, <0 if failure
+		 */
+		int setColorStage(color_stage* stage);
+
+		/*!\brief meters every converted frame and lets ae adjust the camera
+		 *
+		 * Frames are metered raw, after unpacking and correction.
+		 * \param ae the controller, NULL to remove it
+		 * \return 0 if success, <0 if failure
+		 */
+		int setAutoExposure(auto_exposure* ae);
+
+		/*!\brief checks every frame read for change before it is converted
+		 *
+		 * With GATE_DROP static frames are skipped, #read waits for the
+		 * next frame and #poll returns 0.  With GATE_MARK they are returned
+		 * and #frameChanged is false, lazy frames are then never converted
+		 * unless asked for.
+		 * \param gate		the gate, NULL to remove it
+		 * \param action	what to do with static frames
+		 * \return 0 if success, <0 if failure
+		 */
+		int setChangeGate(change_gate* gate, gate_action action = GATE_MARK);
+
+		/*!\brief changes the video mode, keeping the old one if it fails
+		 * \param video_mode the string name of the mode from 
+		 * \link cam1394::videoModeNames \endlink
+		 * \return 0 if success, <0 if failure
+		 */
+		int setVideoMode(const char* video_mode);
+
+		/*!\brief changes the frame rate, keeping the old one if it fails
+		 * \param fps FPS value, floored to closest possible FPS
+		 * \return 0 if success, <0 if failure
+		 */
 		int setFrameRate(float fps);
 
+		/*!\brief Gets the frame rates the current video mode supports
+		 */
+		std::vector<float> getFrameRates();
+
+		/*!\brief Gets the current frame rate in fps, 0 if unknown
+		 */
+		float getFrameRate();
+
+		/*!\brief Gets the range of the absolute FRAME_RATE feature
+		 * \return 0 if success, <0 if the camera has no absolute frame rate control
+		 */
+		int getAbsoluteFrameRateRange(float* min, float* max);
+
+		/*!\brief Sets the frame rate through the absolute FRAME_RATE feature
+		 *
+		 * Unlike #setFrameRate capture keeps running.  The rate holds until
+		 * the next video mode or frame rate switch.
+		 * \return 0 if success, <0 if failure
+		 */
+		int setAbsoluteFrameRate(float fps);
+
+		/*!\brief Lets gov adjust the frame rate before every read
+		 * \param gov	the governor, NULL to remove it
+		 */
+		void setGovernor(rate_governor* gov);
+
+		/*!\brief validates a video mode and frame rate and sizes the host
+		 * buffers for it without touching the running capture
+		 * \param video_mode	the string name of the mode from 
+		 * 						\link cam1394::videoModeNames \endlink
+		 * \param fps			FPS value, <=0 for the fastest rate of the mode
+		 * \param sw			filled in with the prepared switch
+		 * \return 0 if success, <0 if failure
+		 *
+		 * <b> Example </b>
+		 * \code 
+		 * mode_switch preview, full;
+		 * cam.prepareSwitch("640x480_MONO8", 60, &preview);
+		 * cam.prepareSwitch("1280x960_MONO8", 15, &full);
+		 * ...
+		 * if (cam.commitSwitch(&full) == 0)
+		 * 		printf("blackout %f ms\n", full.blackout);
+		 * \endcode
+		 */
+		int prepareSwitch(const char* video_mode, float fps, mode_switch* sw);
+
+		/*!\brief switches to a prepared video mode and frame rate
+		 *
+		 * If the camera refuses the new configuration the previous video
+		 * mode and frame rate are restored.  The time capture was stopped
+		 * is stored in mode_switch::blackout.
+		 * \return 0 if success, <0 if failure
+		 */
+		int commitSwitch(mode_switch* sw);
+
 		void printFrameRate();
 		void printVideoMode();
 
+		/*!\brief gets the capabilities of every connected camera
+		 *
+		 * Cameras that are not in the \link capability_cache \endlink
+		 * are probed and added to it, the rest are answered from the cache.
+		 */
 		std::vector<camera_info> getConnectedCameras();
 
+		/*!\brief gets the capabilities of every connected camera
+		 * \param read_only	if true the cameras are never written to, so
+		 * 					cameras streaming to another process are not
+		 * 					disturbed.  Cached entries are used when present,
+		 * 					the rest are read from the config ROM and inquiry
+		 * 					registers in parallel and not added to the cache.
+		 */
+		std::vector<camera_info> getConnectedCameras(bool read_only);
+
+		/*!\brief gets the capabilities of the attached camera
+		 * \return capabilities loaded at open
+		 */
+		const camera_info& getCapabilities() const { return caps; }
+
+		/*!\brief probes the attached camera again and replaces its cache entry
+		 *
+		 * Capture is stopped while probing and restarted with the current
+		 * video mode and frame rate afterwards.
+		 * \return 0 if success, <0 if failure
+		 */
+		int refreshCapabilities();
+
 	private:
 		uint64_t guid;
 		int width;
@@ -283,13 +695,48 @@ namespace cam1394
 		dc1394bayer_method_t bayer_met;
 		dc1394video_mode_t _video_mode;
 		dc1394framerate_t _fps;
+		pixel_order out_order;
+		pixel_depth out_depth;
+		pixel_packing packing;
+		pixel_pipeline pipeline;
 		
 		long timestamp;
 		int droppedframes;
 
+		camera_info caps;
+
+		uchar *debayer_buf;
+		size_t debayer_size;
+		frame_allocator *debayer_alloc;
+		cam1394Image unpacked;
+		int bin_factor;
+		bin_mode bin_how;
+		cam1394Image binned;
+
+		realtime_settings rt;
+		realtime_report rt_report;
+
+		int dma_buffers;
+		frame_analytics analytics;
+
+		float abs_fps;
+		rate_governor *governor;
+		raw_corrector *corrector;
+		color_stage *color;
+		auto_exposure *exposure;
+		change_gate *gate;
+		gate_action gate_act;
+		bool changed;
+
+		frame_allocator *allocator;
+		host_allocator placed;
+
 		int initCam(const char* cam_guid);
 		int initParam(const char* video_mode, float fps, const char* method, const char* pattern);
 
+		int loadCapabilities(bool refresh);
+		const video_mode* findVideoMode(dc1394video_mode_t) const;
+
 		int getBestVideoMode(dc1394video_mode_t*);
 		int getBestFrameRate(dc1394framerate_t*, dc1394video_mode_t);
 
@@ -297,15 +744,38 @@ namespace cam1394
 		int checkValidVideoMode(dc1394video_mode_t*);
 		void printSupportedVideoModes(dc1394camera_t*);
 
-		int convertFrameRate(float, dc1394framerate_t*);
-		int checkValidFrameRate(dc1394framerate_t* frame_rate);
+		int convertFrameRate(float, dc1394framerate_t*, dc1394video_mode_t);
+		int checkValidFrameRate(dc1394framerate_t* frame_rate, dc1394video_mode_t);
 		void printSupportedFrameRates(dc1394camera_t*, dc1394video_mode_t mode);
 
 		int _setVideoMode(const char*);
 		int _setFrameRate(float fps);
 
+		int startCapture(dc1394video_mode_t, dc1394framerate_t);
+		int updatePipeline();
+		int reloadFormat7Mode();
+		void resetAnalytics();
+		int grabFrame(dc1394video_frame_t* latest, bool wait = true);
+		int grabRaw(cam1394Image* image, bool wait);
+		int dequeueNewest(dc1394video_frame_t* latest, bool wait);
+		int gateFrame(const dc1394video_frame_t* frame);
+		int debayer(dc1394video_frame_t* frame);
+		void outputGeometry(const dc1394video_frame_t* frame, int* w, int* h, int* pixel_bytes);
+		bool narrowUnpack();
+		dc1394video_frame_t* prepareFrame(dc1394video_frame_t* frame, dc1394video_frame_t* view);
+		int stageFrame(const dc1394video_frame_t* frame, dc1394video_frame_t* view, bool narrow);
+		int unpackFrame(const dc1394video_frame_t* frame, bool narrow, cam1394Image* image);
+		bool binBayer(const dc1394video_frame_t* frame);
+		int binFrame(const dc1394video_frame_t* frame, cam1394Image* image, dc1394video_frame_t* view);
+		void stagedFormat(const dc1394video_frame_t* frame, int* w, int* h, int* bytes);
+		int convertRegion(dc1394video_frame_t* frame, const pixel_rect& roi, uchar* dst, size_t stride);
+		int reserveDebayerBuffer(int w, int h, int depth);
+		void freeDebayerBuffer();
+		int applyRealtime();
+
 #ifndef NOOPENCV
 		int getOpenCVbits(int, int); 
+		int outputType(const dc1394video_frame_t* frame);
 #endif
 
 		void clean_up();
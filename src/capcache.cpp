@@ -0,0 +1,490 @@
+//capcache.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+
+#include "capcache.h"
+
+using namespace cam1394;
+
+#define CACHE_HEADER "# cam1394 capability cache v1"
+
+/* Converts a BAYER_TILE_MAPPING register value to a color filter */
+static bool tileToFilter(uint32_t reg, dc1394color_filter_t *pat) {
+	switch (reg) {
+		case 0x52474742:
+			*pat = DC1394_COLOR_FILTER_BGGR;
+			return true;
+		case 0x47425247:
+			*pat = DC1394_COLOR_FILTER_GRBG;
+			return true;
+		case 0x47524247:
+			*pat = DC1394_COLOR_FILTER_GBRG;
+			return true;
+		case 0x42474752:
+			*pat = DC1394_COLOR_FILTER_RGGB;
+			return true;
+		case 0x59595959:
+		default:
+			return false;
+	}
+}
+
+int cam1394::probeCapabilities(dc1394camera_t *camera, camera_info *info) {
+	dc1394error_t err;
+	dc1394framerates_t rates;
+	uint64_t guid = camera->guid;
+	int unit = camera->unit;
+
+	/* Populate the camera_info struct */
+	info->guid      = guid;
+	info->unit      = unit;
+	info->vendor_id = camera->vendor_id;
+	info->model_id  = camera->model_id;
+	info->modes.clear();
+
+	memset(info->vendor, 0, sizeof(info->vendor));
+	memset(info->model,  0, sizeof(info->model));
+	strncpy(info->vendor, camera->vendor, sizeof(info->vendor) - 1);
+	strncpy(info->model,  camera->model,  sizeof(info->model) - 1);
+
+	dc1394video_mode_t cur_mode;
+	uint32_t cur_bayer_out_reg = 0;
+	int ret = 0;
+
+	if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1050, &cur_bayer_out_reg, 1)) {
+		fprintf(stderr, "Failed to get BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
+		return -1;
+	}
+
+	info->raw_control = (cur_bayer_out_reg & 0x80000000) != 0;
+
+	// Get the supported video modes
+	dc1394video_modes_t modes;
+	if (DC1394_SUCCESS != dc1394_video_get_supported_modes(camera, &modes)) {
+		fprintf(stderr, "Failed to get video modes for camera (GUID %016lX unit %d)\n", guid, unit);
+		return -1;
+	}
+
+	if (DC1394_SUCCESS != dc1394_video_get_mode(camera, &cur_mode)) {
+		fprintf(stderr, "Failed to get current video mode for camera (GUID %016lX unit %d)\n", guid, unit);
+		return -1;
+	}
+
+	for (uint32_t m = 0; m < modes.num; m++) {
+		video_mode mode_info;
+
+		mode_info.mode          = modes.modes[m];
+		mode_info.raw           = false;
+		mode_info.raw_control   = false;
+		mode_info.bayer_pattern = (dc1394color_filter_t)-1;
+		mode_info.format7       = false;
+		memset(&mode_info.format7_mode, 0, sizeof(mode_info.format7_mode));
+
+		if (DC1394_SUCCESS != dc1394_video_set_mode(camera, mode_info.mode)) {
+			fprintf(stderr, "Failed to set video mode for camera (GUID %016lX unit %d)\n", guid, unit);
+			ret = -1;
+			break;
+		}
+
+		uint32_t bayer_out_off = 0x80000000;
+		uint32_t bayer_out_on  = 0x80000001;
+		uint32_t bayer_reg_off = 0;
+		uint32_t bayer_reg_on  = 0;
+		dc1394color_filter_t bayer_pat;
+
+		if (info->raw_control) {
+			if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &bayer_out_off, 1)) {
+				fprintf(stderr, "Failed to set BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
+				ret = -1;
+				break;
+			}
+		}
+
+		if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1040, &bayer_reg_off, 1)) {
+			fprintf(stderr, "Failed to get BAYER_TILE_MAPPING register for camera (GUID %016lX unit %d)\n", guid, unit);
+			ret = -1;
+			break;
+		}
+
+		if (info->raw_control) {
+			if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &bayer_out_on, 1)) {
+				fprintf(stderr, "Failed to set BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
+				ret = -1;
+				break;
+			}
+
+			if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1040, &bayer_reg_on, 1)) {
+				fprintf(stderr, "Failed to get BAYER_TILE_MAPPING register for camera (GUID %016lX unit %d)\n", guid, unit);
+				ret = -1;
+				break;
+			}
+		}
+
+		mode_info.raw = tileToFilter(bayer_reg_off, &bayer_pat);
+		if (info->raw_control) {
+			mode_info.raw = tileToFilter(bayer_reg_on, &bayer_pat);
+
+			if (mode_info.raw && bayer_reg_off != bayer_reg_on)
+				mode_info.raw_control = true;
+		}
+
+		if (mode_info.raw)
+			mode_info.bayer_pattern = bayer_pat;
+
+		if (mode_info.mode < DC1394_VIDEO_MODE_FORMAT7_MIN) {
+			// Get framerates
+			err = dc1394_video_get_supported_framerates(camera, mode_info.mode, &rates);
+
+			if (err != DC1394_SUCCESS) {
+				fprintf(stderr, "Failed to get framerates for camera (GUID %016lX unit %d)\n", guid, unit);
+				ret = -1;
+				break;
+			}
+
+			for (uint32_t f = 0; f < rates.num; f++) {
+				mode_info.framerates.push_back(rates.framerates[f]);
+			}
+
+		} else if (mode_info.mode >= DC1394_VIDEO_MODE_FORMAT7_MIN &&
+				   mode_info.mode <= DC1394_VIDEO_MODE_FORMAT7_MAX) {
+			// Get format 7 mode
+			mode_info.format7 = true;
+			err = dc1394_format7_get_mode_info(camera, mode_info.mode, &mode_info.format7_mode);
+
+			if (err != DC1394_SUCCESS) {
+				fprintf(stderr, "Failed to get format 7 mode for camera (GUID %016lX unit %d)\n", guid, unit);
+				ret = -1;
+				break;
+			}
+		}
+
+		info->modes.push_back(mode_info);
+	}
+
+	if (DC1394_SUCCESS != dc1394_set_control_registers(camera, 0x1050, &cur_bayer_out_reg, 1)) {
+		fprintf(stderr, "Failed to reset BAYER_MONO_CTRL register for camera (GUID %016lX unit %d)\n", guid, unit);
+	}
+	if (DC1394_SUCCESS != dc1394_video_set_mode(camera, cur_mode)) {
+		fprintf(stderr, "Failed to reset video mode for camera (GUID %016lX unit %d)\n", guid, unit);
+	}
+
+	return ret;
+}
+
+int cam1394::probeCapabilitiesReadOnly(dc1394camera_t *camera, camera_info *info) {
+	dc1394framerates_t rates;
+	uint64_t guid = camera->guid;
+	int unit = camera->unit;
+
+	info->guid      = guid;
+	info->unit      = unit;
+	info->vendor_id = camera->vendor_id;
+	info->model_id  = camera->model_id;
+	info->modes.clear();
+
+	memset(info->vendor, 0, sizeof(info->vendor));
+	memset(info->model,  0, sizeof(info->model));
+	strncpy(info->vendor, camera->vendor, sizeof(info->vendor) - 1);
+	strncpy(info->model,  camera->model,  sizeof(info->model) - 1);
+
+	dc1394video_mode_t cur_mode;
+	uint32_t bayer_out_reg = 0;
+	uint32_t bayer_reg = 0;
+
+	/* cameras without the Point Grey registers simply have no raw control */
+	if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1050, &bayer_out_reg, 1))
+		bayer_out_reg = 0;
+	if (DC1394_SUCCESS != dc1394_get_control_registers(camera, 0x1040, &bayer_reg, 1))
+		bayer_reg = 0;
+
+	info->raw_control = (bayer_out_reg & 0x80000000) != 0;
+
+	dc1394video_modes_t modes;
+	if (DC1394_SUCCESS != dc1394_video_get_supported_modes(camera, &modes)) {
+		fprintf(stderr, "Failed to get video modes for camera (GUID %016lX unit %d)\n", guid, unit);
+		return -1;
+	}
+
+	if (DC1394_SUCCESS != dc1394_video_get_mode(camera, &cur_mode)) {
+		fprintf(stderr, "Failed to get current video mode for camera (GUID %016lX unit %d)\n", guid, unit);
+		return -1;
+	}
+
+	for (uint32_t m = 0; m < modes.num; m++) {
+		video_mode mode_info;
+
+		mode_info.mode          = modes.modes[m];
+		mode_info.raw           = false;
+		mode_info.raw_control   = false;
+		mode_info.bayer_pattern = (dc1394color_filter_t)-1;
+		mode_info.format7       = false;
+		memset(&mode_info.format7_mode, 0, sizeof(mode_info.format7_mode));
+
+		if (mode_info.mode == cur_mode)
+			mode_info.raw = tileToFilter(bayer_reg, &mode_info.bayer_pattern);
+
+		if (mode_info.mode < DC1394_VIDEO_MODE_FORMAT7_MIN) {
+			if (DC1394_SUCCESS != dc1394_video_get_supported_framerates(camera, mode_info.mode, &rates)) {
+				fprintf(stderr, "Failed to get framerates for camera (GUID %016lX unit %d)\n", guid, unit);
+				return -1;
+			}
+
+			for (uint32_t f = 0; f < rates.num; f++) {
+				mode_info.framerates.push_back(rates.framerates[f]);
+			}
+		} else if (mode_info.mode <= DC1394_VIDEO_MODE_FORMAT7_MAX) {
+			mode_info.format7 = true;
+			if (DC1394_SUCCESS != dc1394_format7_get_mode_info(camera, mode_info.mode, &mode_info.format7_mode)) {
+				fprintf(stderr, "Failed to get format 7 mode for camera (GUID %016lX unit %d)\n", guid, unit);
+				return -1;
+			}
+		}
+
+		info->modes.push_back(mode_info);
+	}
+
+	return 0;
+}
+
+capability_cache& capability_cache::instance() {
+	static capability_cache cache;
+	return cache;
+}
+
+capability_cache::capability_cache() {
+	const char *env = getenv("CAM1394_CACHE");
+	const char *home = getenv("HOME");
+
+	if (env != NULL)
+		_path = env;
+	else if (home != NULL)
+		_path = std::string(home) + "/.cam1394_capabilities";
+
+	load();
+}
+
+int capability_cache::lookup(uint64_t guid, uint32_t vendor_id, uint32_t model_id, camera_info *info) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::map<uint64_t, camera_info>::const_iterator it = entries.find(guid);
+	if (it == entries.end())
+		return -1;
+
+	/* a different camera has shown up with the same GUID, don't trust it */
+	if (it->second.vendor_id != vendor_id || it->second.model_id != model_id)
+		return -1;
+
+	*info = it->second;
+	return 0;
+}
+
+int capability_cache::store(const camera_info& info) {
+	std::lock_guard<std::mutex> guard(lock);
+	entries[info.guid] = info;
+	return save();
+}
+
+int capability_cache::invalidate(uint64_t guid) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (guid == 0)
+		entries.clear();
+	else
+		entries.erase(guid);
+	return save();
+}
+
+/* Writes the cache to a temporary file and renames it over the old one */
+int capability_cache::save() {
+	if (_path.empty())
+		return 0;
+
+	std::string tmp = _path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "w");
+	if (f == NULL) {
+		fprintf(stderr, "ERROR: Failed to write capability cache %s\n", tmp.c_str());
+		return -1;
+	}
+
+	fprintf(f, "%s\n", CACHE_HEADER);
+
+	std::map<uint64_t, camera_info>::const_iterator it;
+	for (it = entries.begin(); it != entries.end(); it++) {
+		const camera_info& c = it->second;
+		fprintf(f, "camera %016llX %d %u %u %d %u\n", (unsigned long long)c.guid, c.unit,
+				c.vendor_id, c.model_id, c.raw_control ? 1 : 0, (unsigned int)c.modes.size());
+		fprintf(f, "vendor %s\n", c.vendor);
+		fprintf(f, "model %s\n", c.model);
+
+		for (size_t m = 0; m < c.modes.size(); m++) {
+			const video_mode& v = c.modes[m];
+			fprintf(f, "mode %d %d %d %d %d %u", v.mode, v.raw ? 1 : 0, v.raw_control ? 1 : 0,
+					v.bayer_pattern, v.format7 ? 1 : 0, (unsigned int)v.framerates.size());
+			for (size_t r = 0; r < v.framerates.size(); r++)
+				fprintf(f, " %d", v.framerates[r]);
+			fprintf(f, "\n");
+
+			if (v.format7) {
+				const dc1394format7mode_t& f7 = v.format7_mode;
+				fprintf(f, "format7 %d %u %u %u %u %u %u %u %u %u %u %d %u %u %u %u %llu %d %u",
+						f7.present, f7.size_x, f7.size_y, f7.max_size_x, f7.max_size_y,
+						f7.pos_x, f7.pos_y, f7.unit_size_x, f7.unit_size_y,
+						f7.unit_pos_x, f7.unit_pos_y, f7.color_coding, f7.pixnum,
+						f7.packet_size, f7.unit_packet_size, f7.max_packet_size,
+						(unsigned long long)f7.total_bytes, f7.color_filter,
+						f7.color_codings.num);
+				for (uint32_t i = 0; i < f7.color_codings.num; i++)
+					fprintf(f, " %d", f7.color_codings.codings[i]);
+				fprintf(f, "\n");
+			}
+		}
+	}
+
+	if (fclose(f) != 0 || rename(tmp.c_str(), _path.c_str()) != 0) {
+		fprintf(stderr, "ERROR: Failed to write capability cache %s\n", _path.c_str());
+		remove(tmp.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Copies the rest of a "key value" line into a fixed size string */
+static void readString(const char *line, const char *key, char *dst, size_t size) {
+	size_t len = strlen(key);
+	memset(dst, 0, size);
+	if (strncmp(line, key, len) != 0 || line[len] != ' ')
+		return;
+
+	strncpy(dst, line + len + 1, size - 1);
+	dst[strcspn(dst, "\n")] = '\0';
+}
+
+/* Reads the cache file, entries that fail to parse are dropped */
+int capability_cache::load() {
+	if (_path.empty())
+		return 0;
+
+	FILE *f = fopen(_path.c_str(), "r");
+	if (f == NULL)
+		return -1;
+
+	char line[1024];
+	if (fgets(line, sizeof(line), f) == NULL || strncmp(line, CACHE_HEADER, strlen(CACHE_HEADER)) != 0) {
+		fprintf(stderr, "WARNING: Ignoring capability cache %s with unknown format\n", _path.c_str());
+		fclose(f);
+		return -1;
+	}
+
+	camera_info *cur = NULL;
+	video_mode *cur_mode = NULL;
+	bool bad = false;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		unsigned long long guid;
+		unsigned int vendor_id, model_id;
+		int unit, raw_control, nmodes, n, pos;
+
+		if (sscanf(line, "camera %llx %d %u %u %d %d", &guid, &unit, &vendor_id, &model_id, &raw_control, &nmodes) == 6) {
+			camera_info info;
+			info.guid        = guid;
+			info.unit        = unit;
+			info.vendor_id   = vendor_id;
+			info.model_id    = model_id;
+			info.raw_control = raw_control != 0;
+			info.vendor[0]   = '\0';
+			info.model[0]    = '\0';
+			cur = &(entries[info.guid] = info);
+			cur_mode = NULL;
+		} else if (cur == NULL) {
+			bad = true;
+		} else if (!strncmp(line, "vendor ", 7)) {
+			readString(line, "vendor", cur->vendor, sizeof(cur->vendor));
+		} else if (!strncmp(line, "model ", 6)) {
+			readString(line, "model", cur->model, sizeof(cur->model));
+		} else if (!strncmp(line, "mode ", 5)) {
+			video_mode v;
+			int mode, raw, rawc, pat, f7;
+			if (sscanf(line, "mode %d %d %d %d %d %d%n", &mode, &raw, &rawc, &pat, &f7, &n, &pos) != 6) {
+				bad = true;
+				continue;
+			}
+			v.mode          = (dc1394video_mode_t)mode;
+			v.raw           = raw != 0;
+			v.raw_control   = rawc != 0;
+			v.bayer_pattern = (dc1394color_filter_t)pat;
+			v.format7       = f7 != 0;
+			memset(&v.format7_mode, 0, sizeof(v.format7_mode));
+
+			const char *p = line + pos;
+			for (int r = 0; r < n; r++) {
+				int rate, used;
+				if (sscanf(p, " %d%n", &rate, &used) != 1) {
+					bad = true;
+					break;
+				}
+				v.framerates.push_back((dc1394framerate_t)rate);
+				p += used;
+			}
+
+			cur->modes.push_back(v);
+			cur_mode = &cur->modes.back();
+		} else if (!strncmp(line, "format7 ", 8) && cur_mode != NULL) {
+			dc1394format7mode_t& f7 = cur_mode->format7_mode;
+			int present, coding, filter;
+			unsigned long long total;
+			if (sscanf(line, "format7 %d %u %u %u %u %u %u %u %u %u %u %d %u %u %u %u %llu %d %u%n",
+					   &present, &f7.size_x, &f7.size_y, &f7.max_size_x, &f7.max_size_y,
+					   &f7.pos_x, &f7.pos_y, &f7.unit_size_x, &f7.unit_size_y,
+					   &f7.unit_pos_x, &f7.unit_pos_y, &coding, &f7.pixnum,
+					   &f7.packet_size, &f7.unit_packet_size, &f7.max_packet_size,
+					   &total, &filter, &f7.color_codings.num, &pos) != 19 ||
+				f7.color_codings.num > DC1394_COLOR_CODING_NUM) {
+				bad = true;
+				continue;
+			}
+			f7.mode         = cur_mode->mode;
+			f7.present      = (dc1394bool_t)present;
+			f7.color_coding = (dc1394color_coding_t)coding;
+			f7.total_bytes  = total;
+			f7.color_filter = (dc1394color_filter_t)filter;
+
+			const char *p = line + pos;
+			for (uint32_t i = 0; i < f7.color_codings.num; i++) {
+				int c, used;
+				if (sscanf(p, " %d%n", &c, &used) != 1) {
+					bad = true;
+					break;
+				}
+				f7.color_codings.codings[i] = (dc1394color_coding_t)c;
+				p += used;
+			}
+		}
+	}
+
+	fclose(f);
+
+	if (bad) {
+		fprintf(stderr, "WARNING: Capability cache %s is corrupt, discarding it\n", _path.c_str());
+		entries.clear();
+		return -1;
+	}
+
+	return 0;
+}
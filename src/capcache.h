@@ -0,0 +1,111 @@
+//capcache.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file capcache.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef CAPCACHE_H
+#define CAPCACHE_H
+
+#include "camera.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace cam1394
+{
+	/*!
+	 * \class capability_cache
+	 * \brief Process wide cache of \link camera_info \endlink descriptors
+	 *
+	 * Probing a camera for its capabilities means switching it through
+	 * every video mode, so the results are kept in memory after the first
+	 * probe and persisted to disk keyed by GUID, vendor id and model id.
+	 * The file defaults to $HOME/.cam1394_capabilities and can be moved
+	 * with the CAM1394_CACHE environment variable.  Setting CAM1394_CACHE
+	 * to an empty string keeps the cache in memory only.
+	 */
+	class capability_cache
+	{
+	public:
+		/*!\brief Gets the process wide cache, loading it from disk on first use
+		 */
+		static capability_cache& instance();
+
+		/*!\brief Looks up the capabilities of a camera
+		 * \param guid		GUID of the camera
+		 * \param vendor_id	vendor id reported by the config ROM
+		 * \param model_id	model id reported by the config ROM
+		 * \param info		filled in with the cached descriptor
+		 * \return 0 if found, <0 if there is no matching entry
+		 */
+		int lookup(uint64_t guid, uint32_t vendor_id, uint32_t model_id, camera_info* info);
+
+		/*!\brief Adds or replaces a descriptor and writes the cache to disk
+		 * \return 0 if success, <0 if the cache could not be saved
+		 */
+		int store(const camera_info& info);
+
+		/*!\brief Drops the descriptor of a camera from memory and disk
+		 * \param guid GUID of the camera, 0 drops every entry
+		 * \return 0 if success, <0 if the cache could not be saved
+		 */
+		int invalidate(uint64_t guid);
+
+		/*!\brief Gets the path of the cache file
+		 * \return path, empty if the cache is memory only
+		 */
+		const std::string& path() const { return _path; }
+
+	private:
+		capability_cache();
+
+		int load();
+		int save();
+
+		std::string _path;
+		std::map<uint64_t, camera_info> entries;
+		std::mutex lock;
+	};
+
+	/*!\brief Probes a camera for its capabilities
+	 *
+	 * Switches the camera through every supported video mode and toggles
+	 * the BAYER_MONO_CTRL register to read the bayer tile of each mode.
+	 * The original video mode and register value are restored afterwards.
+	 * \param camera	camera to probe, must not be capturing
+	 * \param info		filled in with the capabilities
+	 * \return 0 if success, <0 if failure
+	 */
+	int probeCapabilities(dc1394camera_t* camera, camera_info* info);
+
+	/*!\brief Probes a camera for its capabilities without writing to it
+	 *
+	 * Only the config ROM and the inquiry registers are read, so this is
+	 * safe on a camera that another process is streaming from.  The bayer
+	 * tile can only be read for the video mode the camera is currently in,
+	 * every other mode is reported as not raw.
+	 * \param camera	camera to probe
+	 * \param info		filled in with the capabilities
+	 * \return 0 if success, <0 if failure
+	 */
+	int probeCapabilitiesReadOnly(dc1394camera_t* camera, camera_info* info);
+};
+#endif
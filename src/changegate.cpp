@@ -0,0 +1,189 @@
+//changegate.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "changegate.h"
+
+using namespace cam1394;
+
+change_gate::change_gate(const gate_settings& settings) : settings(settings) {
+	memset(&stats, 0, sizeof(stats));
+	reset();
+}
+
+void change_gate::setSettings(const gate_settings& s) {
+	std::lock_guard<std::mutex> guard(lock);
+	settings = s;
+	have_reference = false;
+}
+
+void change_gate::reset() {
+	std::lock_guard<std::mutex> guard(lock);
+	have_reference = false;
+	since_keyframe = 0;
+	last_width = last_height = last_layout = 0;
+}
+
+/* Top 8 bits of sample x of row */
+template<int BYTES, bool PACKED>
+static inline unsigned int topByte(const unsigned char* row, int x, int shift) {
+	if (PACKED)
+		/* only even samples are read, their high bits are the first byte of a pair */
+		return row[(x >> 1) * 3];
+	if (BYTES == 2)
+		return ((const uint16_t*)row)[x] >> shift;
+	return row[x];
+}
+
+template<int BYTES, bool PACKED>
+static void cellMeans(const unsigned char* data, size_t stride, int width, int height, int shift,
+					  int grid_width, int grid_height, int samples, uint8_t* cells) {
+	int count = samples * samples;
+
+	for (int gy = 0; gy < grid_height; gy++) {
+		int y0 = (int)((int64_t)height * gy / grid_height);
+		int y1 = (int)((int64_t)height * (gy + 1) / grid_height);
+
+		for (int gx = 0; gx < grid_width; gx++) {
+			int x0 = (int)((int64_t)width * gx / grid_width);
+			int x1 = (int)((int64_t)width * (gx + 1) / grid_width);
+			unsigned int sum = 0;
+
+			/* samples sit in the middle of evenly spaced strips of the cell */
+			for (int sy = 0; sy < samples; sy++) {
+				const unsigned char* row = data + (y0 + ((2 * sy + 1) * (y1 - y0)) / (2 * samples)) * stride;
+				for (int sx = 0; sx < samples; sx++) {
+					int x = x0 + ((2 * sx + 1) * (x1 - x0)) / (2 * samples);
+					sum += topByte<BYTES, PACKED>(row, PACKED ? x & ~1 : x, shift);
+				}
+			}
+			cells[gy * grid_width + gx] = (uint8_t)((sum + count / 2) / count);
+		}
+	}
+}
+
+void change_gate::signature(const unsigned char* data, int width, int height, int bytes, int bits,
+							pixel_packing packing) {
+	int cells = settings.grid_width * settings.grid_height;
+	current.assign((cells + 15) & ~15, 0);
+
+	int shift = (bits > 8) ? bits - 8 : 0;
+	if (packing != PACKED_NONE)
+		cellMeans<1, true>(data, packedBytes(packing, width), width, height, 0,
+						   settings.grid_width, settings.grid_height, settings.samples, &current[0]);
+	else if (bytes == 2)
+		cellMeans<2, false>(data, (size_t)width * 2, width, height, shift,
+							settings.grid_width, settings.grid_height, settings.samples, &current[0]);
+	else
+		cellMeans<1, false>(data, width, width, height, 0,
+							settings.grid_width, settings.grid_height, settings.samples, &current[0]);
+}
+
+/* Sums the absolute differences of two signatures and counts the cells
+ * that differ by more than threshold */
+static uint64_t compareCells(const uint8_t* a, const uint8_t* b, size_t length, uint8_t threshold,
+							 int* changed) {
+	uint64_t sad = 0;
+	int count = 0;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i limit = _mm_set1_epi8((char)threshold);
+	__m128i zero = _mm_setzero_si128();
+	__m128i total = zero;
+
+	for (; i + 16 <= length; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		total = _mm_add_epi64(total, _mm_sad_epu8(va, vb));
+
+		/* |a - b| > threshold, unsigned saturation leaves 0 otherwise */
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		__m128i over = _mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero);
+		count += 16 - __builtin_popcount(_mm_movemask_epi8(over));
+	}
+	sad = (uint64_t)_mm_cvtsi128_si32(total) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+#endif
+
+	for (; i < length; i++) {
+		int diff = abs((int)a[i] - (int)b[i]);
+		sad += diff;
+		count += diff > threshold;
+	}
+
+	*changed = count;
+	return sad;
+}
+
+int change_gate::check(const unsigned char* data, int width, int height, int bytes, int bits,
+					   pixel_packing packing) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (settings.grid_width <= 0 || settings.grid_height <= 0 || settings.samples <= 0 ||
+		settings.grid_width * settings.samples > width || settings.grid_height * settings.samples > height) {
+		fprintf(stderr, "ERROR: Change gate grid does not fit a %dx%d frame\n", width, height);
+		return -1;
+	}
+	if (packing == PACKED_NONE && bytes != 1 && bytes != 2) {
+		fprintf(stderr, "ERROR: Change gate needs 1 or 2 bytes per sample\n");
+		return -1;
+	}
+
+	signature(data, width, height, bytes, bits, packing);
+	stats.frames++;
+
+	/* a new geometry or layout has nothing to compare with */
+	int layout = (packing != PACKED_NONE) ? packing : bytes;
+	if (!have_reference || width != last_width || height != last_height || layout != last_layout) {
+		reference.swap(current);
+		have_reference = true;
+		since_keyframe = 0;
+		last_width  = width;
+		last_height = height;
+		last_layout = layout;
+		stats.changed_cells = settings.grid_width * settings.grid_height;
+		stats.score = 1;
+		return 1;
+	}
+
+	int cells = settings.grid_width * settings.grid_height;
+	uint8_t threshold = (uint8_t)(settings.cell_threshold * 255 + 0.5f);
+	uint64_t sad = compareCells(&current[0], &reference[0], current.size(), threshold, &stats.changed_cells);
+	stats.score = (double)sad / ((double)cells * 255);
+
+	bool keyframe = settings.keyframe_interval > 0 && ++since_keyframe > settings.keyframe_interval;
+	if (stats.changed_cells >= settings.min_cells || keyframe) {
+		reference.swap(current);
+		since_keyframe = 0;
+		return 1;
+	}
+
+	stats.unchanged++;
+	return 0;
+}
+
+gate_stats change_gate::get() {
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
@@ -0,0 +1,134 @@
+//changegate.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+/*!
+ * \file changegate.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef CHANGEGATE_H
+#define CHANGEGATE_H
+
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "pixelpipe.h"
+
+namespace cam1394
+{
+	/*!\brief What camera::read does with a frame the gate finds static
+	 */
+	enum gate_action {
+		/*!\brief Return it, camera::frameChanged tells it apart */
+		GATE_MARK = 0,
+		/*!\brief Skip it and wait for the next frame */
+		GATE_DROP = 1
+	};
+
+	/*!\brief Grid and thresholds of a change_gate
+	 */
+	struct gate_settings {
+		/*!\brief Cells of the signature across the frame */
+		int grid_width;
+		/*!\brief Cells of the signature down the frame */
+		int grid_height;
+		/*!\brief Samples per cell in each direction */
+		int samples;
+		/*!\brief A cell whose mean moved by more than this fraction of full
+		 * scale has changed */
+		float cell_threshold;
+		/*!\brief A frame with at least this many changed cells has changed */
+		int min_cells;
+		/*!\brief Let a frame through after this many static ones, 0 never */
+		int keyframe_interval;
+
+		gate_settings() : grid_width(32), grid_height(24), samples(4), cell_threshold(0.03f),
+			min_cells(1), keyframe_interval(0) {}
+	};
+
+	/*!\brief Counters of a change_gate
+	 */
+	struct gate_stats {
+		/*!\brief Frames checked */
+		uint64_t frames;
+		/*!\brief Frames found static */
+		uint64_t unchanged;
+		/*!\brief Changed cells of the last frame */
+		int changed_cells;
+		/*!\brief Mean absolute difference of the cells of the last frame,
+		 * as a fraction of full scale */
+		double score;
+	};
+
+	/*!
+	 * \class change_gate
+	 * \brief Tells frames of a static scene apart from frames that changed
+	 *
+	 * A frame is reduced to a grid of cell means taken from a few samples
+	 * per cell, the 8 most significant bits of each.  The grid is compared
+	 * with that of the last frame that changed, with SSE2 SAD, so slow
+	 * drift adds up until it counts as change.  Attach it with
+	 * camera::setChangeGate.
+	 */
+	class change_gate
+	{
+	public:
+		change_gate(const gate_settings& settings);
+
+		/*!\brief Replaces the grid and thresholds, the next frame changes */
+		void setSettings(const gate_settings& settings);
+
+		/*!\brief Forgets the reference frame, the next frame changes */
+		void reset();
+
+		/*!\brief Compares a raw frame with the last frame that changed
+		 * \param data		raw samples
+		 * \param width		width of the frame in samples
+		 * \param height	height of the frame
+		 * \param bytes		bytes per sample, 1 or 2, ignored for packed frames
+		 * \param bits		significant bits per sample
+		 * \param packing	packing of the samples
+		 * \return 1 if the frame changed, 0 if it is static, <0 if failure
+		 */
+		int check(const unsigned char* data, int width, int height, int bytes, int bits,
+				  pixel_packing packing = PACKED_NONE);
+
+		/*!\brief Gets a copy of the counters */
+		gate_stats get();
+
+	private:
+		void signature(const unsigned char* data, int width, int height, int bytes, int bits,
+					   pixel_packing packing);
+
+		std::mutex lock;
+		gate_settings settings;
+		gate_stats stats;
+
+		/* cell means, padded with zeros to a multiple of 16 */
+		std::vector<uint8_t> current;
+		std::vector<uint8_t> reference;
+		bool have_reference;
+		int since_keyframe;
+		int last_width;
+		int last_height;
+		int last_layout;
+	};
+};
+#endif
@@ -0,0 +1,202 @@
+//colorstage.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "colorstage.h"
+
+using namespace cam1394;
+
+/* What color_stage::set derives from the settings, never changed once published */
+struct cam1394::color_tables {
+	color_settings settings;
+	/*!\brief matrix * gains in COLOR_MATRIX_BITS fixed point, R, G, B order */
+	int coef[9];
+	bool linear;
+
+	mutable std::once_flag built[17];
+	mutable std::vector<uint16_t> curves[17];
+
+	/* The gamma curve for samples of bits significant bits, built on first use */
+	const uint16_t* curve(int bits) const {
+		std::call_once(built[bits], [this, bits] {
+			int maxv = (1 << bits) - 1;
+			curves[bits].resize(maxv + 1);
+			for (int i = 0; i <= maxv; i++)
+				curves[bits][i] = (uint16_t)(maxv * pow((double)i / maxv, 1 / settings.gamma) + 0.5);
+		});
+		return &curves[bits][0];
+	}
+};
+
+color_stage::color_stage() {
+	set(color_settings());
+}
+
+int color_stage::set(const color_settings& settings) {
+	std::shared_ptr<color_tables> t(new color_tables);
+	const int one = 1 << COLOR_MATRIX_BITS;
+
+	if (settings.gamma <= 0) {
+		fprintf(stderr, "ERROR: Gamma must be positive\n");
+		return -1;
+	}
+
+	for (int r = 0; r < 3; r++) {
+		int total = 0;
+		for (int c = 0; c < 3; c++) {
+			int k = (int)lround(settings.matrix[r * 3 + c] * settings.gains[c] * one);
+			t->coef[r * 3 + c] = k;
+			total += abs(k);
+		}
+
+		/* keeps every sum of a 16 bit pixel within 32 bits */
+		if (total >= 8 * one) {
+			fprintf(stderr, "ERROR: Row %d of the color matrix times the gains must stay below 8 in absolute sum\n", r);
+			return -1;
+		}
+	}
+
+	t->settings = settings;
+	t->linear   = (settings.gamma == 1);
+	std::atomic_store(&current, std::shared_ptr<const color_tables>(t));
+	return 0;
+}
+
+color_settings color_stage::get() {
+	return tables()->settings;
+}
+
+std::shared_ptr<const color_tables> color_stage::tables() {
+	return std::atomic_load(&current);
+}
+
+/* One channel of one pixel */
+static inline int mix(const int* k, int a, int b, int c, int maxv) {
+	int v = (k[0] * a + k[1] * b + k[2] * c + (1 << (COLOR_MATRIX_BITS - 1))) >> COLOR_MATRIX_BITS;
+	return v < 0 ? 0 : (v > maxv ? maxv : v);
+}
+
+#ifdef __SSE2__
+static inline __m128i clampLanes(__m128i v, int maxv) {
+	__m128i hi  = _mm_set1_epi32(maxv);
+	__m128i pos = _mm_andnot_si128(_mm_srai_epi32(v, 31), v);
+	__m128i big = _mm_cmpgt_epi32(pos, hi);
+	return _mm_or_si128(_mm_and_si128(big, hi), _mm_andnot_si128(big, pos));
+}
+
+/* Two coefficients in the 16 bit pairs _mm_madd_epi16 multiplies with */
+static inline __m128i pair(int a, int b) {
+	return _mm_set1_epi32((int)((uint32_t)(uint16_t)a | ((uint32_t)(uint16_t)b << 16)));
+}
+
+/* Four pixels, the first two channels of each pixel go in one madd and the
+ * third with the rounding constant in another.  16 bit samples are split
+ * into their high and low bytes so every product stays signed 16 bit. */
+template <typename T>
+static inline void mixQuad(const int* k, T* p, int maxv, const uint16_t* curve) {
+	__m128i ab_lo, c_lo, ab_hi, c_hi;
+	if (sizeof(T) == 1) {
+		ab_lo = _mm_setr_epi16(p[0], p[1], p[3], p[4], p[6], p[7], p[9], p[10]);
+		c_lo  = _mm_setr_epi16(p[2], 1, p[5], 1, p[8], 1, p[11], 1);
+	} else {
+		__m128i ab = _mm_setr_epi16(p[0], p[1], p[3], p[4], p[6], p[7], p[9], p[10]);
+		__m128i c  = _mm_setr_epi16(p[2], 0, p[5], 0, p[8], 0, p[11], 0);
+		__m128i lo = _mm_set1_epi16(0xff);
+		ab_lo = _mm_and_si128(ab, lo);
+		ab_hi = _mm_srli_epi16(ab, 8);
+		c_lo  = _mm_or_si128(_mm_and_si128(c, lo), _mm_set1_epi32(1 << 16));
+		c_hi  = _mm_srli_epi16(c, 8);
+	}
+
+	int32_t out[3][4];
+	for (int i = 0; i < 3; i++) {
+		const int *row = k + i * 3;
+		__m128i ab_k = pair(row[0], row[1]);
+		__m128i acc  = _mm_add_epi32(_mm_madd_epi16(ab_lo, ab_k),
+									 _mm_madd_epi16(c_lo, pair(row[2], 1 << (COLOR_MATRIX_BITS - 1))));
+		if (sizeof(T) != 1) {
+			__m128i high = _mm_add_epi32(_mm_madd_epi16(ab_hi, ab_k), _mm_madd_epi16(c_hi, pair(row[2], 0)));
+			acc = _mm_add_epi32(acc, _mm_slli_epi32(high, 8));
+		}
+		_mm_storeu_si128((__m128i*)out[i], clampLanes(_mm_srai_epi32(acc, COLOR_MATRIX_BITS), maxv));
+	}
+
+	for (int j = 0; j < 4; j++, p += 3) {
+		p[0] = (T)(curve ? curve[out[0][j]] : out[0][j]);
+		p[1] = (T)(curve ? curve[out[1][j]] : out[1][j]);
+		p[2] = (T)(curve ? curve[out[2][j]] : out[2][j]);
+	}
+}
+#endif
+
+template <typename T>
+static void mixRows(const int* k, unsigned char* data, int width, int height, size_t stride, int maxv, const uint16_t* curve) {
+	for (int y = 0; y < height; y++, data += stride) {
+		T *p = (T*)data;
+		int x = 0;
+
+#ifdef __SSE2__
+		for (; x + 4 <= width; x += 4, p += 12)
+			mixQuad<T>(k, p, maxv, curve);
+#endif
+		for (; x < width; x++, p += 3) {
+			int a = p[0], b = p[1], c = p[2];
+			int r0 = mix(k, a, b, c, maxv);
+			int r1 = mix(k + 3, a, b, c, maxv);
+			int r2 = mix(k + 6, a, b, c, maxv);
+			p[0] = (T)(curve ? curve[r0] : r0);
+			p[1] = (T)(curve ? curve[r1] : r1);
+			p[2] = (T)(curve ? curve[r2] : r2);
+		}
+	}
+}
+
+void color_stage::apply(const color_tables& tables, unsigned char* data, int width, int height, size_t stride,
+						int bytes, int bits, pixel_order order) {
+	if (bits <= 0 || bits > 8 * bytes)
+		bits = 8 * bytes;
+	int maxv = (1 << bits) - 1;
+	const uint16_t *curve = tables.linear ? NULL : tables.curve(bits);
+
+	/* the matrix in the channel order of the pixels */
+	int k[9];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++) {
+			int ci = (order == PIXEL_RGB) ? i : 2 - i;
+			int cj = (order == PIXEL_RGB) ? j : 2 - j;
+			k[i * 3 + j] = tables.coef[ci * 3 + cj];
+		}
+
+	if (bytes == 1)
+		mixRows<uint8_t>(k, data, width, height, stride, maxv, curve);
+	else
+		mixRows<uint16_t>(k, data, width, height, stride, maxv, curve);
+}
+
+void color_stage::apply(unsigned char* data, int width, int height, size_t stride, int bytes, int bits, pixel_order order) {
+	std::shared_ptr<const color_tables> t = tables();
+	apply(*t, data, width, height, stride, bytes, bits, order);
+}
@@ -0,0 +1,107 @@
+//colorstage.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file colorstage.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef COLORSTAGE_H
+#define COLORSTAGE_H
+
+#include <memory>
+
+#include "pixelpipe.h"
+
+namespace cam1394
+{
+	/*!\brief Fraction bits of the fixed point color matrix */
+	const int COLOR_MATRIX_BITS = 12;
+
+	/*!\brief Parameters of a color_stage
+	 *
+	 * Each output pixel is gamma(matrix * (gains * rgb)).
+	 */
+	struct color_settings {
+		/*!\brief White balance gains of red, green and blue */
+		float gains[3];
+		/*!\brief Color correction matrix, row major, rows and columns in R, G, B order */
+		float matrix[9];
+		/*!\brief Gamma of the output curve, 1 for linear */
+		float gamma;
+
+		color_settings() : gamma(1) {
+			for (int i = 0; i < 3; i++)
+				gains[i] = 1;
+			for (int i = 0; i < 9; i++)
+				matrix[i] = (i % 4 == 0) ? 1 : 0;
+		}
+	};
+
+	struct color_tables;
+
+	/*!
+	 * \class color_stage
+	 * \brief White balance, color correction matrix and gamma in one pass
+	 *
+	 * The gains are folded into the matrix, which is applied in fixed
+	 * point with SSE2, and the gamma curve is a table per sample depth.
+	 * #set builds new tables and swaps them in atomically, a frame that is
+	 * being corrected keeps the tables it started with.  Attach it with
+	 * camera::setColorStage.
+	 */
+	class color_stage
+	{
+	public:
+		color_stage();
+
+		/*!\brief Replaces the parameters, safe while frames are corrected
+		 * \return 0 if success, <0 if the matrix is out of range
+		 */
+		int set(const color_settings& settings);
+
+		/*!\brief Gets the current parameters */
+		color_settings get();
+
+		/*!\brief Gets the tables to correct one frame with
+		 *
+		 * Hold on to them for the whole frame so it is never corrected with
+		 * two sets of parameters.
+		 */
+		std::shared_ptr<const color_tables> tables();
+
+		/*!\brief Corrects rows of 3 channel pixels in place
+		 * \param tables	tables from #tables
+		 * \param data		first pixel of the first row
+		 * \param width		pixels per row
+		 * \param height	number of rows
+		 * \param stride	bytes between two rows
+		 * \param bytes		bytes per channel, 1 or 2
+		 * \param bits		significant bits per channel
+		 * \param order		channel order of the pixels
+		 */
+		static void apply(const color_tables& tables, unsigned char* data, int width, int height, size_t stride,
+						  int bytes, int bits, pixel_order order);
+
+		/*!\brief Corrects a whole image with the current tables */
+		void apply(unsigned char* data, int width, int height, size_t stride, int bytes, int bits, pixel_order order);
+
+	private:
+		std::shared_ptr<const color_tables> current;
+	};
+};
+#endif
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <cstdio>
+#include <vector>
+#include "camera.h"
+#include "multiplexer.h"
+
+using namespace std;
+using namespace cam1394;
+
+static void handler(camera* cam, cam1394Image* image, void* user) {
+    int *frames = (int*)user;
+    (*frames)++;
+    cout << hex << cam->getGUID() << dec << " frame " << *frames << " "
+         << image->width << "x" << image->height << endl;
+}
+
+int main() {
+    camera probe;
+    vector<camera_info> infos = probe.getConnectedCameras(true);
+    vector<camera*> cams;
+    vector<int> frames(infos.size(), 0);
+    camera_multiplexer mux;
+
+    for (size_t i = 0; i < infos.size(); i++) {
+        char guid[32];
+        sprintf(guid, "%016lX", (unsigned long)infos[i].guid);
+
+        camera *c = new camera;
+        if (c->open(guid) < 0 || mux.add(c, handler, &frames[i]) < 0) {
+            delete c;
+            continue;
+        }
+        cams.push_back(c);
+    }
+
+    /* every camera is serviced from this one thread */
+    for (int i = 0; i < 1000; i++)
+        if (mux.run(1000) < 0)
+            break;
+
+    for (size_t i = 0; i < cams.size(); i++) {
+        mux.remove(cams[i]);
+        delete cams[i];
+    }
+    return 0;
+}
@@ -17,7 +17,12 @@ int main() {
     if (a.open("00B09D0100AF05C1", "640x480_MONO8", 60, "SIMPLE", "BGGR") < 0)
         return -1;
 
-    a.setVideoMode("1280x960_MONO8");
+    mode_switch preview, full;
+    if (a.prepareSwitch("640x480_MONO8", 60, &preview) < 0 ||
+        a.prepareSwitch("1280x960_MONO8", 15, &full) < 0)
+        return -1;
+
+    a.commitSwitch(&full);
 
     a.printGUID();
     a.printVideoMode();
@@ -34,7 +39,13 @@ int main() {
         numDropped += a.getNumDroppedFrames();
         //cout << camRead.elapsed()*1000 << "ms, " << numDropped << endl;
 
-        if (count == 0) {}
+        if (count == 0) {
+            mode_switch *next = (aimage.cols == full.width) ? &preview : &full;
+            if (a.commitSwitch(next) == 0)
+                cout << "switched to " << next->width << "x" << next->height
+                     << " in " << next->blackout << "ms" << endl;
+            count = 200;
+        }
 
         count--;
     }
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <unistd.h>
+#include "camera.h"
+#include "pipeline.h"
+
+using namespace std;
+using namespace cam1394;
+
+/* a slow consumer, the queue in front of it drops the oldest frames */
+static int average(pipeline_frame* frame, void* user) {
+    unsigned long sum = 0;
+    for (int i = 0; i < frame->image.size; i++)
+        sum += frame->image.data[i];
+
+    *(double*)user = (double)sum / frame->image.size;
+    usleep(30000);
+    return 0;
+}
+
+int main() {
+    camera a;
+    double mean = 0;
+
+    if (a.open("NONE", "640x480_MONO8", 60, "BILINEAR", "BGGR") < 0)
+        return 1;
+
+    frame_pipeline p(&a, 2);
+    p.addConvertStage(4, OVERFLOW_BLOCK);
+    p.addStage("average", average, &mean, 2, OVERFLOW_DROP_OLDEST);
+
+    if (p.start() < 0)
+        return 1;
+
+    for (int s = 0; s < 5; s++) {
+        sleep(1);
+        cout << "mean " << mean << endl;
+        for (int i = 0; i < p.numStages(); i++) {
+            stage_stats st;
+            p.getStats(i, &st);
+            cout << "  " << p.stageName(i) << ": " << st.processed << " frames, "
+                 << st.dropped << " dropped, " << st.average_us << " us avg, "
+                 << st.max_us << " us max, queue high water " << st.queue_high_water << endl;
+        }
+    }
+
+    p.stop();
+    return 0;
+}
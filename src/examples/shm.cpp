@@ -0,0 +1,51 @@
+#include <iostream>
+#include <cstring>
+#include "camera.h"
+#include "shmring.h"
+
+using namespace std;
+using namespace cam1394;
+
+int main(int argc, char **argv) {
+    if (argc < 2 || (strcmp(argv[1], "pub") && strcmp(argv[1], "sub"))) {
+        cout << "usage: " << argv[0] << " pub|sub" << endl;
+        return 1;
+    }
+
+    cam1394Image img;
+
+    if (!strcmp(argv[1], "sub")) {
+        frame_subscriber sub;
+        frame_meta meta;
+
+        if (sub.open("/cam1394_example") < 0)
+            return 1;
+
+        while (sub.read(&meta, &img, 1000) >= 0) {
+            cout << "frame " << meta.seq << " " << meta.width << "x" << meta.height
+                 << " skipped " << sub.getSkipped() << endl;
+        }
+
+        img.destroy();
+        return 0;
+    }
+
+    camera a;
+    frame_publisher pub;
+
+    if (a.open("NONE", "640x480_MONO8", 60, NULL, NULL) < 0)
+        return 1;
+
+    if (pub.open("/cam1394_example", 8, 640 * 480 * 3) < 0)
+        return 1;
+
+    while (1) {
+        if (a.read(&img) < 0)
+            return 1;
+
+        pub.publish(&img, a.getGUID(), a.getTimestamp(), a.getNumDroppedFrames());
+    }
+
+    img.destroy();
+    return 0;
+}
@@ -0,0 +1,204 @@
+//fanout.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+
+#include "fanout.h"
+
+using namespace cam1394;
+
+/* how long the capture thread waits for a free frame before checking for stop */
+#define POOL_WAIT_MS 100
+
+frame_fanout::frame_fanout(camera* cam, int pool_size) :
+	cam(cam), pool(pool_size), running(false), seq(0), stalls(0) {}
+
+frame_fanout::~frame_fanout() {
+	stop();
+	for (size_t i = 0; i < sinks.size(); i++)
+		delete sinks[i];
+}
+
+int frame_fanout::addSink(const char* name, sink_func func, void* user, int queue_size) {
+	if (func == NULL || queue_size < 1) {
+		fprintf(stderr, "ERROR: Sink %s needs a function and a queue of at least one frame\n", name);
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (running) {
+		fprintf(stderr, "ERROR: Sinks can not be added to a running fanout\n");
+		return -1;
+	}
+
+	sink *s = new sink;
+	s->name      = name;
+	s->func      = func;
+	s->user      = user;
+	s->capacity  = queue_size;
+	s->total_lag = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+
+	sinks.push_back(s);
+	return sinks.size() - 1;
+}
+
+int frame_fanout::start() {
+	std::lock_guard<std::mutex> guard(lock);
+	if (running)
+		return 0;
+
+	running = true;
+	for (size_t i = 0; i < sinks.size(); i++)
+		sinks[i]->thread = std::thread(&frame_fanout::sinkLoop, this, sinks[i]);
+	if (cam != NULL)
+		capture = std::thread(&frame_fanout::captureLoop, this);
+
+	return 0;
+}
+
+void frame_fanout::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!running)
+			return;
+		running = false;
+		for (size_t i = 0; i < sinks.size(); i++)
+			sinks[i]->ready.notify_all();
+	}
+
+	if (capture.joinable())
+		capture.join();
+	for (size_t i = 0; i < sinks.size(); i++) {
+		sinks[i]->thread.join();
+
+		std::lock_guard<std::mutex> guard(lock);
+		sinks[i]->queue.clear();
+		sinks[i]->stats.queue_depth = 0;
+	}
+}
+
+void frame_fanout::publish(const frame_ref& frame) {
+	std::lock_guard<std::mutex> guard(lock);
+	seq = frame.seq();
+
+	for (size_t i = 0; i < sinks.size(); i++) {
+		sink *s = sinks[i];
+
+		/* dropping the oldest reference may return that frame to the pool */
+		if (s->queue.size() >= s->capacity) {
+			s->queue.pop_front();
+			s->stats.dropped++;
+		}
+
+		s->queue.push_back(frame);
+		s->stats.queue_depth = s->queue.size();
+		if (s->stats.queue_depth > s->stats.queue_high_water)
+			s->stats.queue_high_water = s->stats.queue_depth;
+		s->ready.notify_one();
+	}
+}
+
+void frame_fanout::captureLoop() {
+	realtime_settings rt = cam->getRealtime();
+	applyThreadSettings(rt.cpus, rt.priority, NULL);
+
+	uint64_t n = 0;
+	while (1) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!running)
+				break;
+		}
+
+		/* every frame is still held by a sink, the DMA ring keeps filling meanwhile */
+		frame_ref ref = pool.acquire(POOL_WAIT_MS);
+		if (ref.empty()) {
+			std::lock_guard<std::mutex> guard(lock);
+			stalls++;
+			continue;
+		}
+
+		if (cam->readLazy(ref.writable()) < 0)
+			continue;
+
+		ref.setSeq(++n);
+		publish(ref);
+	}
+}
+
+void frame_fanout::sinkLoop(sink* s) {
+	if (cam != NULL) {
+		realtime_settings rt = cam->getRealtime();
+		applyThreadSettings(rt.worker_cpus, rt.worker_priority, NULL);
+	}
+
+	std::unique_lock<std::mutex> lk(lock);
+	while (1) {
+		s->ready.wait(lk, [&] { return !running || !s->queue.empty(); });
+		if (!running)
+			break;
+
+		frame_ref frame = s->queue.front();
+		s->queue.pop_front();
+
+		s->stats.queue_depth = s->queue.size();
+		s->stats.lag = seq - frame.seq();
+		if (s->stats.lag > s->stats.max_lag)
+			s->stats.max_lag = s->stats.lag;
+		s->total_lag += s->stats.lag;
+		s->stats.delivered++;
+		s->stats.average_lag = (double)s->total_lag / s->stats.delivered;
+		lk.unlock();
+
+		s->func(frame, s->user);
+		frame.reset();
+
+		lk.lock();
+	}
+}
+
+frame_pool& frame_fanout::getPool() {
+	return pool;
+}
+
+int frame_fanout::numSinks() {
+	std::lock_guard<std::mutex> guard(lock);
+	return sinks.size();
+}
+
+const char* frame_fanout::sinkName(int sink) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (sink < 0 || sink >= (int)sinks.size())
+		return NULL;
+	return sinks[sink]->name.c_str();
+}
+
+int frame_fanout::getStats(int sink, sink_stats* stats) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (sink < 0 || sink >= (int)sinks.size())
+		return -1;
+
+	*stats = sinks[sink]->stats;
+	return 0;
+}
+
+uint64_t frame_fanout::getPoolStalls() {
+	std::lock_guard<std::mutex> guard(lock);
+	return stalls;
+}
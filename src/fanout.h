@@ -0,0 +1,156 @@
+//fanout.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file fanout.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.h"
+#include "framepool.h"
+
+namespace cam1394
+{
+	/*!\brief Receives a frame from a frame_fanout
+	 * \param frame	the frame, the sink may keep copies of the reference
+	 * \param user	pointer given to frame_fanout::addSink
+	 */
+	typedef void (*sink_func)(const frame_ref& frame, void* user);
+
+	/*!\brief Counters of one sink of a frame_fanout
+	 */
+	struct sink_stats {
+		/*!\brief Frames handed to the sink */
+		uint64_t delivered;
+		/*!\brief Frames dropped from the queue of the sink because it fell behind */
+		uint64_t dropped;
+
+		/*!\brief Frames waiting for the sink */
+		int queue_depth;
+		/*!\brief Most frames that were ever waiting for the sink */
+		int queue_high_water;
+
+		/*!\brief Frames published after the last frame the sink got */
+		uint64_t lag;
+		/*!\brief Largest lag seen */
+		uint64_t max_lag;
+		/*!\brief Average lag per delivered frame */
+		double average_lag;
+	};
+
+	/*!
+	 * \class frame_fanout
+	 * \brief Hands every frame of a camera to several sinks without copying it
+	 *
+	 * Frames are read with camera::readLazy into a frame_pool and the same
+	 * reference is queued for every sink, each running on its own thread.
+	 * A frame goes back to the pool when the last sink is done with it, and
+	 * conversions one sink asks for are shared with the others.  A sink that
+	 * falls behind loses its oldest queued frames, the others are not held
+	 * back.
+	 */
+	class frame_fanout
+	{
+	public:
+		/*!\param cam			an open camera, NULL if frames are only given to #publish
+		 * \param pool_size	frames in the pool, should cover every sink queue
+		 * 					plus one frame per sink and one being read
+		 */
+		frame_fanout(camera* cam, int pool_size);
+		~frame_fanout();
+
+		/*!\brief Adds a sink, only while stopped
+		 * \param queue_size	frames that may wait for the sink
+		 * \return index of the sink if success, <0 if failure
+		 */
+		int addSink(const char* name, sink_func func, void* user, int queue_size);
+
+		/*!\brief Starts the sink threads and, with a camera, the capture thread
+		 * \return 0 if success, <0 if failure
+		 */
+		int start();
+
+		/*!\brief Stops every thread, frames still queued are released */
+		void stop();
+
+		/*!\brief Queues a frame for every sink
+		 *
+		 * Called by the capture thread, or by the application when the
+		 * fanout has no camera.
+		 */
+		void publish(const frame_ref& frame);
+
+		/*!\brief Gets the pool frames are read into */
+		frame_pool& getPool();
+
+		/*!\brief Gets the number of sinks */
+		int numSinks();
+
+		/*!\brief Gets the name of a sink */
+		const char* sinkName(int sink);
+
+		/*!\brief Gets the counters of a sink
+		 * \return 0 if success, <0 if there is no such sink
+		 */
+		int getStats(int sink, sink_stats* stats);
+
+		/*!\brief Gets how often the capture thread found the pool empty */
+		uint64_t getPoolStalls();
+
+	private:
+		struct sink {
+			std::string name;
+			sink_func func;
+			void *user;
+
+			std::deque<frame_ref> queue;
+			size_t capacity;
+			std::condition_variable ready;
+			std::thread thread;
+
+			sink_stats stats;
+			uint64_t total_lag;
+		};
+
+		void captureLoop();
+		void sinkLoop(sink* s);
+
+		camera *cam;
+		frame_pool pool;
+
+		std::mutex lock;
+		bool running;
+		uint64_t seq;
+		uint64_t stalls;
+
+		std::vector<sink*> sinks;
+		std::thread capture;
+	};
+};
+#endif
@@ -0,0 +1,219 @@
+//framemeter.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "framemeter.h"
+
+using namespace cam1394;
+
+/* Sums and clipped counts of the even and odd samples of a row */
+struct row_totals {
+	uint64_t sum[2];
+	uint64_t clipped[2];
+};
+
+#ifdef __SSE2__
+static int rowTotalsSSE2(const uint8_t* p, int n, int clip, row_totals* t) {
+	const __m128i even = _mm_set1_epi16(0x00ff);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i level = _mm_set1_epi8((char)(clip > 255 ? 255 : clip));
+	__m128i sum_even = zero, sum_odd = zero;
+	int x = 0;
+
+	for (; x + 16 <= n; x += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + x));
+		sum_even = _mm_add_epi64(sum_even, _mm_sad_epu8(_mm_and_si128(v, even), zero));
+		sum_odd  = _mm_add_epi64(sum_odd,  _mm_sad_epu8(_mm_andnot_si128(even, v), zero));
+
+		int over = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, level), v));
+		t->clipped[0] += __builtin_popcount(over & 0x5555);
+		t->clipped[1] += __builtin_popcount(over & 0xaaaa);
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, sum_even);
+	t->sum[0] += lanes[0] + lanes[1];
+	_mm_storeu_si128((__m128i*)lanes, sum_odd);
+	t->sum[1] += lanes[0] + lanes[1];
+	return x;
+}
+
+static int rowTotalsSSE2(const uint16_t* p, int n, int clip, row_totals* t) {
+	const __m128i low  = _mm_set1_epi32(0xffff);
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	const __m128i level = _mm_set1_epi16((short)((clip - 1) ^ 0x8000));
+	__m128i sum_even = _mm_setzero_si128(), sum_odd = sum_even;
+	int x = 0;
+
+	/* 32 bit lanes hold a row of up to 65536 samples */
+	for (; x + 8 <= n; x += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + x));
+		sum_even = _mm_add_epi32(sum_even, _mm_and_si128(v, low));
+		sum_odd  = _mm_add_epi32(sum_odd,  _mm_srli_epi32(v, 16));
+
+		/* unsigned v >= clip as a signed compare around 0x8000 */
+		int over = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(v, flip), level));
+		t->clipped[0] += __builtin_popcount(over & 0x3333) / 2;
+		t->clipped[1] += __builtin_popcount(over & 0xcccc) / 2;
+	}
+
+	uint32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, sum_even);
+	t->sum[0] += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_si128((__m128i*)lanes, sum_odd);
+	t->sum[1] += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return x;
+}
+#endif
+
+/* n contiguous samples starting at an even column */
+template <typename T>
+static void rowTotals(const T* p, int n, int clip, row_totals* t) {
+	int x = 0;
+#ifdef __SSE2__
+	if (n < 65536)
+		x = rowTotalsSSE2(p, n, clip, t);
+#endif
+	for (; x < n; x++) {
+		t->sum[x & 1] += p[x];
+		t->clipped[x & 1] += (p[x] >= clip);
+	}
+}
+
+template <typename T>
+static void meterRegion(const T* data, int width, const pixel_rect& r, int cell, int stride,
+						const int chan[2][2], int clip, int shift, meter_result* res, uint64_t sums[METER_CHANNELS]) {
+	int step = stride * cell;
+
+	for (int y = r.y; y + cell <= r.y + r.height; y += step) {
+		for (int dy = 0; dy < cell; dy++) {
+			const T *row = data + (size_t)(y + dy) * width;
+			const int *c = chan[dy];
+
+			if (stride == 1) {
+				/* contiguous, even and odd columns are the two sites of the row */
+				row_totals t;
+				memset(&t, 0, sizeof(t));
+				rowTotals(row + r.x, r.width, clip, &t);
+				for (int k = 0; k < 2; k++) {
+					sums[c[k]]         += t.sum[k];
+					res->clipped[c[k]] += t.clipped[k];
+					res->samples[c[k]] += (r.width + 1 - k) / 2;
+				}
+				for (int x = r.x; x < r.x + r.width; x++) {
+					int bin = row[x] >> shift;
+					res->histogram[c[(x - r.x) & 1]][bin < METER_BINS ? bin : METER_BINS - 1]++;
+				}
+			} else {
+				for (int x = r.x; x + cell <= r.x + r.width; x += step) {
+					for (int dx = 0; dx < cell; dx++) {
+						int v = row[x + dx];
+						int bin = v >> shift;
+						int ch = c[dx];
+						sums[ch] += v;
+						res->clipped[ch] += (v >= clip);
+						res->samples[ch]++;
+						res->histogram[ch][bin < METER_BINS ? bin : METER_BINS - 1]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+int cam1394::meterFrame(const unsigned char* data, int width, int height, int bytes, int bits,
+						const meter_settings& settings, meter_result* result) {
+	if (bytes != 1 && bytes != 2) {
+		fprintf(stderr, "ERROR: Frames are metered on raw or mono samples of 8 or 16 bits\n");
+		return -1;
+	}
+	if (bits <= 0 || bits > 8 * bytes)
+		bits = 8 * bytes;
+
+	int maxv  = (1 << bits) - 1;
+	int shift = bits > 8 ? bits - 8 : 0;
+	int clip  = (int)ceil(settings.clip_level * maxv);
+	if (clip < 1)
+		clip = 1;
+
+	bool bayer = settings.pattern >= DC1394_COLOR_FILTER_MIN && settings.pattern <= DC1394_COLOR_FILTER_MAX;
+	int cell = bayer ? 2 : 1;
+
+	/* the channel of each site of a bayer cell */
+	int chan[2][2] = {{METER_GREEN, METER_GREEN}, {METER_GREEN, METER_GREEN}};
+	if (bayer) {
+		int ry = (settings.pattern == DC1394_COLOR_FILTER_RGGB || settings.pattern == DC1394_COLOR_FILTER_GRBG) ? 0 : 1;
+		int rx = (settings.pattern == DC1394_COLOR_FILTER_RGGB || settings.pattern == DC1394_COLOR_FILTER_GBRG) ? 0 : 1;
+		chan[ry][rx]         = METER_RED;
+		chan[1 - ry][1 - rx] = METER_BLUE;
+	}
+
+	/* regions on the cell grid and inside the frame */
+	std::vector<meter_region> regions = settings.regions;
+	if (regions.empty()) {
+		meter_region all = {{0, 0, width, height}, 1};
+		regions.push_back(all);
+	}
+
+	double cells = 0;
+	for (size_t i = 0; i < regions.size(); i++) {
+		pixel_rect& r = regions[i].rect;
+		int x1 = std::min(r.x + r.width, width), y1 = std::min(r.y + r.height, height);
+		r.x = std::max(r.x, 0) & ~(cell - 1);
+		r.y = std::max(r.y, 0) & ~(cell - 1);
+		r.width  = std::max(x1 - r.x, 0) & ~(cell - 1);
+		r.height = std::max(y1 - r.y, 0) & ~(cell - 1);
+		cells += (double)r.width * r.height / (cell * cell);
+	}
+
+	int stride = std::max(settings.stride, 1);
+	if (settings.max_samples > 0 && cells / ((double)stride * stride) > settings.max_samples)
+		stride = (int)ceil(sqrt(cells / settings.max_samples));
+
+	memset(result, 0, sizeof(*result));
+	result->stride = stride;
+
+	double weighted[METER_CHANNELS] = {0, 0, 0};
+	double weights[METER_CHANNELS]  = {0, 0, 0};
+	for (size_t i = 0; i < regions.size(); i++) {
+		uint64_t sums[METER_CHANNELS] = {0, 0, 0};
+		uint64_t before[METER_CHANNELS];
+		memcpy(before, result->samples, sizeof(before));
+
+		if (bytes == 1)
+			meterRegion(data, width, regions[i].rect, cell, stride, chan, clip, shift, result, sums);
+		else
+			meterRegion((const uint16_t*)data, width, regions[i].rect, cell, stride, chan, clip, shift, result, sums);
+
+		for (int c = 0; c < METER_CHANNELS; c++) {
+			weighted[c] += regions[i].weight * sums[c];
+			weights[c]  += regions[i].weight * (result->samples[c] - before[c]);
+		}
+	}
+
+	for (int c = 0; c < METER_CHANNELS; c++)
+		result->mean[c] = (weights[c] > 0) ? weighted[c] / weights[c] / maxv : 0;
+
+	return 0;
+}
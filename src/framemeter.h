@@ -0,0 +1,101 @@
+//framemeter.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file framemeter.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef FRAMEMETER_H
+#define FRAMEMETER_H
+
+#include <dc1394/dc1394.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pixelpipe.h"
+
+namespace cam1394
+{
+	/*!\brief Bins of the histograms in meter_result, the top 8 bits of a sample */
+	const int METER_BINS = 256;
+
+	/*!\brief Color channels a meter tells apart */
+	enum meter_channel {
+		METER_RED = 0,
+		METER_GREEN = 1,
+		METER_BLUE = 2,
+		METER_CHANNELS = 3
+	};
+
+	/*!\brief A metering region and how much its mean counts */
+	struct meter_region {
+		pixel_rect rect;
+		float weight;
+	};
+
+	/*!\brief What part of a raw frame is measured and how
+	 */
+	struct meter_settings {
+		/*!\brief Regions in raw pixels, the whole frame if empty */
+		std::vector<meter_region> regions;
+		/*!\brief Bayer pattern of the frames, 0 for mono frames where
+		 * every sample counts as green */
+		dc1394color_filter_t pattern;
+		/*!\brief Measure every stride-th bayer cell (or pixel) in both directions */
+		int stride;
+		/*!\brief Raise stride until at most this many cells are measured, 0 for no limit */
+		int max_samples;
+		/*!\brief Samples at or above this fraction of full scale count as clipped */
+		float clip_level;
+
+		meter_settings() : pattern((dc1394color_filter_t)0), stride(1), max_samples(0), clip_level(0.98f) {}
+	};
+
+	/*!\brief Statistics of one raw frame
+	 */
+	struct meter_result {
+		/*!\brief Histogram per channel of the top 8 bits of the samples */
+		uint32_t histogram[METER_CHANNELS][METER_BINS];
+		/*!\brief Region weighted mean per channel, as a fraction of full scale */
+		double mean[METER_CHANNELS];
+		/*!\brief Clipped samples per channel */
+		uint64_t clipped[METER_CHANNELS];
+		/*!\brief Samples measured per channel */
+		uint64_t samples[METER_CHANNELS];
+		/*!\brief Stride used after applying meter_settings::max_samples */
+		int stride;
+	};
+
+	/*!\brief Measures a raw bayer or mono frame
+	 *
+	 * Sums and clipped counts of contiguous rows are taken with SSE2, the
+	 * histograms are filled from the same samples.
+	 * \param data		raw samples
+	 * \param width		width of the frame
+	 * \param height	height of the frame
+	 * \param bytes		bytes per sample, 1 or 2
+	 * \param bits		significant bits per sample
+	 * \param settings	regions, pattern and sampling
+	 * \param result	filled in with the statistics
+	 * \return 0 if success, <0 if the settings do not fit the frame
+	 */
+	int meterFrame(const unsigned char* data, int width, int height, int bytes, int bits,
+				   const meter_settings& settings, meter_result* result);
+};
+#endif
@@ -0,0 +1,131 @@
+//framepool.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <chrono>
+
+#include "framepool.h"
+
+using namespace cam1394;
+
+frame_ref::frame_ref() : s(NULL) {}
+
+frame_ref::frame_ref(slot* s) : s(s) {}
+
+frame_ref::frame_ref(const frame_ref& other) : s(other.s) {
+	if (s != NULL)
+		s->refs++;
+}
+
+frame_ref& frame_ref::operator=(const frame_ref& other) {
+	if (other.s != NULL)
+		other.s->refs++;
+	reset();
+	s = other.s;
+	return *this;
+}
+
+frame_ref::~frame_ref() {
+	reset();
+}
+
+void frame_ref::reset() {
+	if (s != NULL && --s->refs == 0)
+		s->pool->release(s);
+	s = NULL;
+}
+
+bool frame_ref::empty() const {
+	return s == NULL;
+}
+
+const cam1394Image* frame_ref::get(frame_repr repr) const {
+	if (s == NULL)
+		return NULL;
+	return s->frame.get(repr);
+}
+
+#ifndef NOOPENCV
+cv::Mat frame_ref::mat(frame_repr repr) const {
+	if (s == NULL)
+		return cv::Mat();
+	return s->frame.mat(repr);
+}
+#endif
+
+lazy_frame* frame_ref::writable() {
+	if (s == NULL || s->refs != 1)
+		return NULL;
+	return &s->frame;
+}
+
+const lazy_frame* frame_ref::frame() const {
+	return s ? &s->frame : NULL;
+}
+
+uint64_t frame_ref::seq() const {
+	return s ? s->seq : 0;
+}
+
+void frame_ref::setSeq(uint64_t seq) {
+	if (s != NULL)
+		s->seq = seq;
+}
+
+frame_pool::frame_pool(int frames) {
+	for (int i = 0; i < frames; i++) {
+		frame_ref::slot *s = new frame_ref::slot;
+		s->refs = 0;
+		s->seq  = 0;
+		s->pool = this;
+		slots.push_back(s);
+		free_slots.push_back(s);
+	}
+}
+
+frame_pool::~frame_pool() {
+	for (size_t i = 0; i < slots.size(); i++)
+		delete slots[i];
+}
+
+frame_ref frame_pool::acquire(int timeout_ms) {
+	std::unique_lock<std::mutex> lk(lock);
+
+	if (timeout_ms < 0)
+		freed.wait(lk, [this] { return !free_slots.empty(); });
+	else if (!freed.wait_for(lk, std::chrono::milliseconds(timeout_ms), [this] { return !free_slots.empty(); }))
+		return frame_ref();
+
+	frame_ref::slot *s = free_slots.back();
+	free_slots.pop_back();
+	s->refs = 1;
+	return frame_ref(s);
+}
+
+void frame_pool::release(frame_ref::slot* s) {
+	std::lock_guard<std::mutex> guard(lock);
+	free_slots.push_back(s);
+	freed.notify_one();
+}
+
+int frame_pool::available() {
+	std::lock_guard<std::mutex> guard(lock);
+	return free_slots.size();
+}
+
+int frame_pool::size() {
+	return slots.size();
+}
@@ -0,0 +1,134 @@
+//framepool.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file framepool.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "lazyframe.h"
+
+namespace cam1394
+{
+	class frame_pool;
+
+	/*!
+	 * \class frame_ref
+	 * \brief Counted reference to a frame of a frame_pool
+	 *
+	 * Copies share the frame, which goes back to the pool when the last
+	 * copy is destroyed or reset.  A shared frame is immutable apart from
+	 * its cached conversions, see lazy_frame::get.
+	 */
+	class frame_ref
+	{
+	public:
+		frame_ref();
+		frame_ref(const frame_ref& other);
+		frame_ref& operator=(const frame_ref& other);
+		~frame_ref();
+
+		/*!\brief Drops this reference */
+		void reset();
+
+		/*!\brief Tells whether the reference points to no frame */
+		bool empty() const;
+
+		/*!\brief Gets a representation of the frame, see lazy_frame::get */
+		const cam1394Image* get(frame_repr repr) const;
+
+#ifndef NOOPENCV
+		/*!\brief Gets a representation of the frame, see lazy_frame::mat */
+		cv::Mat mat(frame_repr repr) const;
+#endif
+
+		/*!\brief Gets the frame to fill it
+		 * \return the frame, NULL if it is shared with another reference
+		 */
+		lazy_frame* writable();
+
+		/*!\brief Gets the frame, to be used read only */
+		const lazy_frame* frame() const;
+
+		/*!\brief Number of the frame, set by whoever filled it */
+		uint64_t seq() const;
+		void setSeq(uint64_t seq);
+
+	private:
+		friend class frame_pool;
+
+		struct slot {
+			lazy_frame frame;
+			std::atomic<int> refs;
+			uint64_t seq;
+			frame_pool *pool;
+		};
+
+		frame_ref(slot* s);
+
+		slot *s;
+	};
+
+	/*!
+	 * \class frame_pool
+	 * \brief A fixed set of frames handed out as frame_ref
+	 *
+	 * Frames keep their buffers between uses, so a steady stream of frames
+	 * of the same size allocates nothing.  The pool has to outlive every
+	 * reference to its frames.
+	 */
+	class frame_pool
+	{
+	public:
+		/*!\param frames number of frames in the pool */
+		frame_pool(int frames);
+		~frame_pool();
+
+		/*!\brief Takes a free frame
+		 * \param timeout_ms	longest time to wait for one, <0 waits forever
+		 * \return a unique reference, empty if no frame became free in time
+		 */
+		frame_ref acquire(int timeout_ms);
+
+		/*!\brief Gets the number of free frames */
+		int available();
+
+		/*!\brief Gets the number of frames in the pool */
+		int size();
+
+	private:
+		friend class frame_ref;
+
+		void release(frame_ref::slot* s);
+
+		std::mutex lock;
+		std::condition_variable freed;
+		std::vector<frame_ref::slot*> slots;
+		std::vector<frame_ref::slot*> free_slots;
+	};
+};
+#endif
@@ -0,0 +1,179 @@
+//framestats.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <cstring>
+#include <ctime>
+
+#include "framestats.h"
+
+using namespace cam1394;
+
+/* a timestamp gap this many periods long means frames were lost on the bus */
+#define GAP_PERIODS 1.5
+
+static int64_t monotonicSecond() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+frame_analytics::frame_analytics() :
+	bus_threshold(0), consumer_threshold(0), callback(NULL), callback_user(NULL) {
+	reset(0, 0);
+}
+
+void frame_analytics::reset(int ring_size, double period_us) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	memset(&stats, 0, sizeof(stats));
+	memset(window, 0, sizeof(window));
+	stats.ring_size = ring_size;
+
+	period          = period_us;
+	estimate_period = period_us <= 0;
+	last_timestamp  = 0;
+	last_id         = -1;
+
+	bus_exceeded      = false;
+	consumer_exceeded = false;
+}
+
+frame_analytics::bucket& frame_analytics::current() {
+	int64_t sec = monotonicSecond();
+	bucket& b = window[sec % FRAMESTATS_WINDOW];
+
+	if (b.second != sec) {
+		memset(&b, 0, sizeof(b));
+		b.second = sec;
+	}
+	return b;
+}
+
+void frame_analytics::dequeued(const dc1394video_frame_t* frame, bool first) {
+	std::lock_guard<std::mutex> guard(lock);
+	bucket& b = current();
+
+	stats.frames++;
+	b.frames++;
+
+	if (last_id >= 0 && stats.ring_size > 0 && (int)frame->id != (last_id + 1) % stats.ring_size)
+		stats.ring_gaps++;
+	last_id = frame->id;
+
+	if (last_timestamp != 0 && frame->timestamp > last_timestamp) {
+		double delta = frame->timestamp - last_timestamp;
+
+		if (period > 0 && delta > GAP_PERIODS * period) {
+			uint32_t missing = (uint32_t)(delta / period + 0.5) - 1;
+			stats.bus_drops += missing;
+			b.bus_drops += missing;
+		} else if (estimate_period) {
+			period = (period > 0) ? period + (delta - period) / 16 : delta;
+		}
+	}
+	last_timestamp = frame->timestamp;
+
+	int behind = frame->frames_behind;
+	if (behind > stats.ring_high_water)
+		stats.ring_high_water = behind;
+
+	if (first) {
+		stats.lag = behind;
+		b.reads++;
+		b.lag += behind;
+
+		if (stats.ring_size > 0 && behind >= stats.ring_size - 1) {
+			stats.overruns++;
+			b.overruns++;
+		}
+	}
+}
+
+/* Sums the buckets that are still inside the window */
+void frame_analytics::updateRates() {
+	int64_t now = monotonicSecond();
+	uint64_t frames = 0, reads = 0, bus = 0, consumer = 0, overruns = 0, lag = 0;
+	int seconds = 0;
+
+	for (int i = 0; i < FRAMESTATS_WINDOW; i++) {
+		const bucket& b = window[i];
+		if (b.second == 0 || now - b.second >= FRAMESTATS_WINDOW)
+			continue;
+
+		frames   += b.frames;
+		reads    += b.reads;
+		bus      += b.bus_drops;
+		consumer += b.consumer_drops;
+		overruns += b.overruns;
+		lag      += b.lag;
+		seconds++;
+	}
+
+	stats.bus_drop_rate      = (frames + bus > 0) ? (double)bus / (frames + bus) : 0;
+	stats.consumer_drop_rate = (frames > 0) ? (double)consumer / frames : 0;
+	stats.overrun_rate       = (seconds > 0) ? (double)overruns / seconds : 0;
+	stats.average_lag        = (reads > 0) ? (double)lag / reads : 0;
+}
+
+void frame_analytics::delivered(int drained) {
+	frame_stats copy;
+	int crossings = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		bucket& b = current();
+
+		stats.delivered++;
+		stats.consumer_drops += drained;
+		b.consumer_drops += drained;
+		updateRates();
+
+		if (bus_threshold > 0 && (stats.bus_drop_rate > bus_threshold) != bus_exceeded) {
+			bus_exceeded = !bus_exceeded;
+			crossings |= bus_exceeded ? DROP_BUS_ABOVE : DROP_BUS_BELOW;
+		}
+		if (consumer_threshold > 0 && (stats.consumer_drop_rate > consumer_threshold) != consumer_exceeded) {
+			consumer_exceeded = !consumer_exceeded;
+			crossings |= consumer_exceeded ? DROP_CONSUMER_ABOVE : DROP_CONSUMER_BELOW;
+		}
+
+		if (callback == NULL)
+			crossings = 0;
+		copy = stats;
+	}
+
+	/* called without the lock so the callback may read the counters again */
+	if (crossings)
+		callback(copy, crossings, callback_user);
+}
+
+void frame_analytics::setDropCallback(double bus_rate, double consumer_rate, drop_callback cb, void* user) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	bus_threshold      = bus_rate;
+	consumer_threshold = consumer_rate;
+	bus_exceeded       = false;
+	consumer_exceeded  = false;
+	callback           = cb;
+	callback_user      = user;
+}
+
+frame_stats frame_analytics::get() {
+	std::lock_guard<std::mutex> guard(lock);
+	updateRates();
+	return stats;
+}
@@ -0,0 +1,161 @@
+//framestats.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file framestats.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <dc1394/dc1394.h>
+#include <stdint.h>
+
+#include <mutex>
+
+namespace cam1394
+{
+	/*!\brief Number of one second buckets in the sliding window */
+	const int FRAMESTATS_WINDOW = 10;
+
+	/*!\brief Drop and ring health counters of a camera
+	 *
+	 * Bus drops are frames that never reached the DMA ring, found from gaps
+	 * in the frame timestamps.  Ring gaps are discontinuities in the ring
+	 * buffer ids.  Consumer drops are frames that reached the ring but were
+	 * drained by camera::read without being returned.
+	 */
+	struct frame_stats {
+		/*!\brief Frames dequeued from the DMA ring */
+		uint64_t frames;
+		/*!\brief Frames returned by camera::read */
+		uint64_t delivered;
+		/*!\brief Frames missing between consecutive timestamps */
+		uint64_t bus_drops;
+		/*!\brief Discontinuities in dc1394video_frame_t::id */
+		uint64_t ring_gaps;
+		/*!\brief Frames drained from the ring without being returned */
+		uint64_t consumer_drops;
+		/*!\brief Times the ring was found full, the kernel drops frames then */
+		uint64_t overruns;
+
+		/*!\brief Size of the DMA ring in frames */
+		int ring_size;
+		/*!\brief Largest frames_behind seen since the last reset */
+		int ring_high_water;
+		/*!\brief frames_behind of the newest frame of the last read */
+		int lag;
+
+		/*!\brief Bus drops per dequeued frame over the sliding window */
+		double bus_drop_rate;
+		/*!\brief Consumer drops per dequeued frame over the sliding window */
+		double consumer_drop_rate;
+		/*!\brief Overruns per second over the sliding window */
+		double overrun_rate;
+		/*!\brief Average frames_behind at the start of a read over the sliding window */
+		double average_lag;
+	};
+
+	/*!\brief Threshold crossings reported to a drop_callback, or'ed together
+	 */
+	enum drop_crossing {
+		/*!\brief The bus drop rate went above its threshold */
+		DROP_BUS_ABOVE      = 1,
+		/*!\brief The bus drop rate fell back below its threshold */
+		DROP_BUS_BELOW      = 2,
+		/*!\brief The consumer drop rate went above its threshold */
+		DROP_CONSUMER_ABOVE = 4,
+		/*!\brief The consumer drop rate fell back below its threshold */
+		DROP_CONSUMER_BELOW = 8
+	};
+
+	/*!\brief Called when a drop rate crosses its threshold
+	 * \param stats		counters at the time of the crossing
+	 * \param crossings	drop_crossing flags of every rate that crossed
+	 * 					in this update
+	 * \param user		pointer given to frame_analytics::setDropCallback
+	 */
+	typedef void (*drop_callback)(const frame_stats& stats, int crossings, void* user);
+
+	/*!
+	 * \class frame_analytics
+	 * \brief Tracks frame drops and DMA ring occupancy of one camera
+	 */
+	class frame_analytics
+	{
+	public:
+		frame_analytics();
+
+		/*!\brief Clears every counter, called when capture is set up again
+		 * \param ring_size		number of DMA buffers
+		 * \param period_us		expected time between frames in us, 0 to estimate it
+		 */
+		void reset(int ring_size, double period_us);
+
+		/*!\brief Records a frame taken from the DMA ring
+		 * \param frame	the dequeued frame
+		 * \param first	true for the first frame of a camera::read
+		 */
+		void dequeued(const dc1394video_frame_t* frame, bool first);
+
+		/*!\brief Records the end of a camera::read
+		 * \param drained frames read from the ring but not returned
+		 */
+		void delivered(int drained);
+
+		/*!\brief Sets a callback for the windowed drop rates
+		 * \param bus_rate		bus drop rate that triggers the callback, <=0 disables
+		 * \param consumer_rate	consumer drop rate that triggers the callback, <=0 disables
+		 */
+		void setDropCallback(double bus_rate, double consumer_rate, drop_callback cb, void* user);
+
+		/*!\brief Gets a copy of the counters */
+		frame_stats get();
+
+	private:
+		struct bucket {
+			int64_t second;
+			uint32_t frames;
+			uint32_t reads;
+			uint32_t bus_drops;
+			uint32_t consumer_drops;
+			uint32_t overruns;
+			uint64_t lag;
+		};
+
+		bucket& current();
+		void updateRates();
+
+		std::mutex lock;
+		frame_stats stats;
+		bucket window[FRAMESTATS_WINDOW];
+
+		double period;
+		bool estimate_period;
+		uint64_t last_timestamp;
+		int last_id;
+
+		double bus_threshold;
+		double consumer_threshold;
+		bool bus_exceeded;
+		bool consumer_exceeded;
+		drop_callback callback;
+		void *callback_user;
+	};
+};
+#endif
@@ -0,0 +1,148 @@
+//governor.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <ctime>
+#include <algorithm>
+
+#include "governor.h"
+
+using namespace cam1394;
+
+static double now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+rate_governor::rate_governor(camera* cam, const governor_settings& settings) :
+	cam(cam), settings(settings), callback(NULL), callback_user(NULL), calm_since(-1) {
+	float lo, hi;
+	continuous = (cam->getAbsoluteFrameRateRange(&lo, &hi) == 0 && hi > 0);
+
+	rate = cam->getFrameRate();
+	if (this->settings.max_fps <= 0)
+		this->settings.max_fps = rate;
+	if (continuous) {
+		this->settings.min_fps = std::max(this->settings.min_fps, lo);
+		this->settings.max_fps = std::min(this->settings.max_fps, hi);
+	}
+
+	snapshot(cam->getFrameStats());
+}
+
+void rate_governor::setCallback(rate_callback cb, void* user) {
+	callback      = cb;
+	callback_user = user;
+}
+
+float rate_governor::getRate() {
+	return rate;
+}
+
+bool rate_governor::isContinuous() {
+	return continuous;
+}
+
+void rate_governor::snapshot(const frame_stats& stats) {
+	start_frames   = stats.frames;
+	start_drops    = stats.consumer_drops;
+	start_overruns = stats.overruns;
+	interval_start = now();
+	lag_sum        = 0;
+	lag_samples    = 0;
+}
+
+/* Next rate down or up, the same rate if there is none within the limits */
+float rate_governor::pickRate(bool lower) {
+	if (continuous) {
+		float next = lower ? rate * settings.step_down : rate * settings.step_up;
+		return std::max(settings.min_fps, std::min(settings.max_fps, next));
+	}
+
+	/* the closest rate of the video mode in the requested direction */
+	std::vector<float> rates = cam->getFrameRates();
+	float best = rate;
+	for (size_t i = 0; i < rates.size(); i++) {
+		float r = rates[i];
+		if (r < settings.min_fps || r > settings.max_fps)
+			continue;
+		if (lower && r < rate && (best == rate || r > best))
+			best = r;
+		else if (!lower && r > rate && (best == rate || r < best))
+			best = r;
+	}
+	return best;
+}
+
+int rate_governor::update() {
+	frame_stats stats = cam->getFrameStats();
+
+	/* counters start over after capture is set up again */
+	if (stats.frames < start_frames) {
+		snapshot(stats);
+		return 0;
+	}
+
+	lag_sum += stats.lag;
+	lag_samples++;
+
+	double t = now();
+	if ((t - interval_start) * 1000 < settings.interval_ms)
+		return 0;
+
+	uint64_t frames = stats.frames - start_frames;
+	double drops    = frames ? (double)(stats.consumer_drops - start_drops) / frames : 0;
+	double lag      = lag_samples ? lag_sum / lag_samples : 0;
+	bool overrun    = stats.overruns > start_overruns;
+	snapshot(stats);
+
+	if (frames == 0)
+		return 0;
+
+	float next = rate;
+	if (drops > settings.high_drop || lag > settings.high_lag || overrun) {
+		next = pickRate(true);
+		calm_since = -1;
+	} else if (drops <= settings.low_drop && lag <= settings.low_lag) {
+		if (calm_since < 0)
+			calm_since = t;
+		else if ((t - calm_since) * 1000 >= settings.raise_after_ms)
+			next = pickRate(false);
+	} else {
+		calm_since = -1;
+	}
+
+	if (next == rate)
+		return 0;
+
+	int ret = continuous ? cam->setAbsoluteFrameRate(next) : cam->setFrameRate(next);
+	if (ret < 0)
+		return -1;
+
+	float old = rate;
+	rate = next;
+	/* wait a full calm period again before the next raise */
+	calm_since = (next > old) ? t : -1;
+
+	/* the change reset the camera counters */
+	snapshot(cam->getFrameStats());
+
+	if (callback != NULL)
+		callback(old, next, stats, callback_user);
+
+	return 1;
+}
@@ -0,0 +1,132 @@
+//governor.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file governor.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Limits and thresholds of a rate_governor
+	 *
+	 * The rate goes down when the consumer drop rate or lag goes above its
+	 * high mark, and only goes up again after both stayed below their low
+	 * marks for raise_after_ms.
+	 */
+	struct governor_settings {
+		/*!\brief Lowest rate the governor sets in fps */
+		float min_fps;
+		/*!\brief Highest rate the governor sets in fps, 0 for the rate at #rate_governor creation */
+		float max_fps;
+
+		/*!\brief Consumer drops per dequeued frame that make the rate go down */
+		double high_drop;
+		/*!\brief Consumer drops per dequeued frame below which the rate may go up */
+		double low_drop;
+		/*!\brief Average frames waiting at a read that make the rate go down */
+		double high_lag;
+		/*!\brief Average frames waiting at a read below which the rate may go up */
+		double low_lag;
+
+		/*!\brief Factor applied to the rate when lowering it */
+		double step_down;
+		/*!\brief Factor applied to the rate when raising it */
+		double step_up;
+
+		/*!\brief Time over which drops and lag are measured in ms */
+		int interval_ms;
+		/*!\brief Time the consumer must keep up before the rate goes up in ms */
+		int raise_after_ms;
+
+		governor_settings() : min_fps(1), max_fps(0), high_drop(0.2), low_drop(0.02),
+			high_lag(2), low_lag(0.5), step_down(0.75), step_up(1.15),
+			interval_ms(1000), raise_after_ms(5000) {}
+	};
+
+	/*!\brief Called when a rate_governor changes the frame rate
+	 * \param old_fps	rate before the change
+	 * \param new_fps	rate after the change
+	 * \param stats		counters the decision was made on
+	 * \param user		pointer given to rate_governor::setCallback
+	 */
+	typedef void (*rate_callback)(float old_fps, float new_fps, const frame_stats& stats, void* user);
+
+	/*!
+	 * \class rate_governor
+	 * \brief Lowers the frame rate of a camera while its reader falls behind
+	 *
+	 * Uses the absolute FRAME_RATE feature when the camera has it, which
+	 * changes the rate without stopping capture, and camera::setFrameRate
+	 * with the rates of the video mode otherwise.  Attached with
+	 * camera::setGovernor it runs on the reading thread before every read.
+	 */
+	class rate_governor
+	{
+	public:
+		rate_governor(camera* cam, const governor_settings& settings);
+
+		/*!\brief Sets a function called after every rate change */
+		void setCallback(rate_callback cb, void* user);
+
+		/*!\brief Looks at the counters of the camera and changes the rate if needed
+		 *
+		 * Must be called from the thread that reads the camera.
+		 * \return 1 if the rate changed, 0 if not, <0 if changing it failed
+		 */
+		int update();
+
+		/*!\brief Gets the rate the governor last set, or found at creation */
+		float getRate();
+
+		/*!\brief Tells whether the absolute FRAME_RATE feature is used */
+		bool isContinuous();
+
+	private:
+		float pickRate(bool lower);
+		void snapshot(const frame_stats& stats);
+
+		camera *cam;
+		governor_settings settings;
+		rate_callback callback;
+		void *callback_user;
+
+		bool continuous;
+		float rate;
+
+		/*!\brief counters at the start of the interval */
+		uint64_t start_frames;
+		uint64_t start_drops;
+		uint64_t start_overruns;
+		double interval_start;
+		double lag_sum;
+		int lag_samples;
+
+		/*!\brief when the consumer started keeping up, <0 while it does not */
+		double calm_since;
+	};
+};
+#endif
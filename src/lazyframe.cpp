@@ -0,0 +1,230 @@
+//lazyframe.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+
+#include "lazyframe.h"
+
+using namespace cam1394;
+
+/* ITU-R BT.601 luma weights in 8 bit fixed point */
+#define LUMA_B 29
+#define LUMA_G 150
+#define LUMA_R 77
+
+lazy_frame::lazy_frame() : timestamp(0), dropped(0), changed(true), guid(0),
+	coding(DC1394_COLOR_CODING_MONO8), pattern((dc1394color_filter_t)-1),
+	method(DC1394_BAYER_METHOD_BILINEAR), bits(8), alloc(heapAllocator()) {
+	for (int i = 0; i < REPR_COUNT; i++)
+		ready[i] = false;
+}
+
+lazy_frame::~lazy_frame() {
+	for (int i = 0; i < REPR_COUNT; i++)
+		images[i].destroy();
+}
+
+cam1394Image* lazy_frame::fill() {
+	for (int i = 0; i < REPR_COUNT; i++)
+		ready[i] = false;
+	return &images[REPR_RAW];
+}
+
+void lazy_frame::describe(dc1394color_coding_t coding, dc1394color_filter_t pattern,
+						  dc1394bayer_method_t method, int bits, frame_allocator* alloc) {
+	this->coding  = coding;
+	this->pattern = pattern;
+	this->method  = method;
+	this->bits    = bits;
+	this->alloc   = alloc;
+	ready[REPR_RAW] = true;
+}
+
+bool lazy_frame::cached(frame_repr repr) {
+	return repr >= 0 && repr < REPR_COUNT && ready[repr];
+}
+
+const cam1394Image* lazy_frame::get(frame_repr repr) {
+	if (repr < 0 || repr >= REPR_COUNT)
+		return NULL;
+	if (ready[repr])
+		return &images[repr];
+
+	/* one thread converts, the others wait for it and share the result */
+	std::lock_guard<std::mutex> guard(locks[repr]);
+	if (!ready[repr]) {
+		if (!ready[REPR_RAW] || convert(repr) < 0)
+			return NULL;
+		ready[repr] = true;
+	}
+
+	return &images[repr];
+}
+
+int lazy_frame::convert(frame_repr repr) {
+	pixel_pipeline p;
+	bool bayer = selectPipeline(coding, pattern, method, PIXEL_BGR, &p) == 0;
+
+	switch (repr) {
+		case REPR_BGR:
+			return bayer ? convertBayer(repr, method) : convertMono(repr);
+		case REPR_HALF:
+			return bayer ? convertBayer(repr, DC1394_BAYER_METHOD_DOWNSAMPLE) : convertMono(repr);
+		case REPR_GRAY:
+			return bayer ? convertGray() : convertMono(repr);
+		default:
+			return -1;
+	}
+}
+
+int lazy_frame::convertBayer(frame_repr repr, dc1394bayer_method_t m) {
+	const cam1394Image *raw = &images[REPR_RAW];
+	cam1394Image *out = &images[repr];
+	pixel_pipeline p;
+
+	if (selectPipeline(coding, pattern, m, PIXEL_BGR, &p) < 0)
+		return -1;
+
+	int w = raw->width >> p.shift;
+	int h = raw->height >> p.shift;
+	int size = w * h * p.channels * p.bytes;
+
+	if (out->reserve(size, alloc) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	out->width  = w;
+	out->height = h;
+	out->size   = size;
+
+	pixel_rect all = {0, 0, w, h};
+	if (p.convert(raw->data, raw->width, raw->height, bits, all, out->data, (size_t)w * p.channels * p.bytes) < 0) {
+		fprintf(stderr, "ERROR: Unable to debayer frame\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+template <typename T>
+static void bgrToGray(const T* src, T* dst, int pixels) {
+	for (int i = 0; i < pixels; i++, src += 3)
+		dst[i] = (T)((src[0] * LUMA_B + src[1] * LUMA_G + src[2] * LUMA_R + 128) >> 8);
+}
+
+/* Gray of a bayer frame is taken from the BGR conversion, which is then cached too */
+int lazy_frame::convertGray() {
+	const cam1394Image *bgr = get(REPR_BGR);
+	if (bgr == NULL)
+		return -1;
+
+	cam1394Image *out = &images[REPR_GRAY];
+	int size = bgr->size / 3;
+
+	if (out->reserve(size, alloc) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	out->width  = bgr->width;
+	out->height = bgr->height;
+	out->size   = size;
+
+	if (size == bgr->width * bgr->height)
+		bgrToGray<uint8_t>(bgr->data, out->data, bgr->width * bgr->height);
+	else
+		bgrToGray<uint16_t>((const uint16_t*)bgr->data, (uint16_t*)out->data, bgr->width * bgr->height);
+
+	return 0;
+}
+
+/* Full or half size gray or BGR from single channel samples, the half size
+ * image averages each 2x2 block */
+template <typename T>
+static void monoToImage(const T* src, int w, int h, int shift, int channels, T* dst) {
+	int ow = w >> shift, oh = h >> shift;
+
+	for (int y = 0; y < oh; y++) {
+		for (int x = 0; x < ow; x++, dst += channels) {
+			int v;
+			if (shift) {
+				const T *p = src + (2 * y) * w + 2 * x;
+				v = (p[0] + p[1] + p[w] + p[w + 1] + 2) >> 2;
+			} else {
+				v = src[y * w + x];
+			}
+			for (int c = 0; c < channels; c++)
+				dst[c] = (T)v;
+		}
+	}
+}
+
+int lazy_frame::convertMono(frame_repr repr) {
+	const cam1394Image *raw = &images[REPR_RAW];
+	cam1394Image *out = &images[repr];
+	int bytes;
+
+	switch (coding) {
+		case DC1394_COLOR_CODING_MONO8:
+		case DC1394_COLOR_CODING_RAW8:
+			bytes = 1;
+			break;
+		case DC1394_COLOR_CODING_MONO16:
+		case DC1394_COLOR_CODING_RAW16:
+			bytes = 2;
+			break;
+		default:
+			fprintf(stderr, "ERROR: Frames of this color coding can not be converted\n");
+			return -1;
+	}
+
+	int shift    = (repr == REPR_HALF) ? 1 : 0;
+	int channels = (repr == REPR_GRAY) ? 1 : 3;
+	int w = raw->width >> shift;
+	int h = raw->height >> shift;
+	int size = w * h * channels * bytes;
+
+	if (out->reserve(size, alloc) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate image\n");
+		return -1;
+	}
+	out->width  = w;
+	out->height = h;
+	out->size   = size;
+
+	if (bytes == 1)
+		monoToImage<uint8_t>(raw->data, raw->width, raw->height, shift, channels, out->data);
+	else
+		monoToImage<uint16_t>((const uint16_t*)raw->data, raw->width, raw->height, shift, channels, (uint16_t*)out->data);
+
+	return 0;
+}
+
+#ifndef NOOPENCV
+cv::Mat lazy_frame::mat(frame_repr repr) {
+	const cam1394Image *img = get(repr);
+	if (img == NULL)
+		return cv::Mat();
+
+	int pixels   = img->width * img->height;
+	int channels = (repr == REPR_RAW) ? 1 : (repr == REPR_GRAY ? 1 : 3);
+	int bytes    = img->size / (pixels * channels);
+	int type     = (bytes > 1) ? CV_16UC(channels) : CV_8UC(channels);
+
+	return cv::Mat(img->height, img->width, type, img->data);
+}
+#endif
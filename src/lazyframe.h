@@ -0,0 +1,124 @@
+//lazyframe.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file lazyframe.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef LAZYFRAME_H
+#define LAZYFRAME_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Representations a lazy_frame can hand out
+	 */
+	enum frame_repr {
+		/*!\brief The frame as it came from the camera */
+		REPR_RAW = 0,
+		/*!\brief Full size, 3 channels in BGR order */
+		REPR_BGR,
+		/*!\brief Full size, 1 channel */
+		REPR_GRAY,
+		/*!\brief Half width and height, 3 channels in BGR order */
+		REPR_HALF,
+		REPR_COUNT
+	};
+
+	/*!
+	 * \class lazy_frame
+	 * \brief A raw frame that is converted only when a representation is asked for
+	 *
+	 * Every representation is converted at most once per frame and cached,
+	 * so consumers on different threads share the work, and a frame nobody
+	 * asks anything but REPR_RAW of is never debayered.  Filled by
+	 * camera::readLazy.
+	 */
+	class lazy_frame
+	{
+	public:
+		lazy_frame();
+		~lazy_frame();
+
+		/*!\brief Gets a representation, converting it on first use
+		 *
+		 * Thread safe.  The image stays valid and unchanged until the frame
+		 * is filled again.
+		 * \return the image, NULL if the frame can not be converted to it
+		 */
+		const cam1394Image* get(frame_repr repr);
+
+		/*!\brief Tells whether a representation was already converted */
+		bool cached(frame_repr repr);
+
+#ifndef NOOPENCV
+		/*!\brief Gets a representation as a cv::Mat header over the cached pixels
+		 * \return the image, an empty cv::Mat if it can not be converted
+		 */
+		cv::Mat mat(frame_repr repr);
+#endif
+
+		/*!\brief Gets the raw image to fill and drops every cached conversion
+		 *
+		 * Not thread safe, nobody may use the frame while it is filled.
+		 */
+		cam1394Image* fill();
+
+		/*!\brief Describes the raw image after #fill
+		 * \param coding	color coding of the raw pixels
+		 * \param pattern	bayer pattern, anything else for non bayer frames
+		 * \param method	debayer method for REPR_BGR
+		 * \param bits		significant bits of 16 bit samples
+		 * \param alloc		allocator for the conversions
+		 */
+		void describe(dc1394color_coding_t coding, dc1394color_filter_t pattern,
+					  dc1394bayer_method_t method, int bits, frame_allocator* alloc);
+
+		/*!\brief See camera::getTimestamp */
+		long timestamp;
+		/*!\brief See camera::getNumDroppedFrames */
+		int dropped;
+		/*!\brief See camera::frameChanged */
+		bool changed;
+		/*!\brief GUID of the camera */
+		uint64_t guid;
+
+	private:
+		int convert(frame_repr repr);
+		int convertBayer(frame_repr repr, dc1394bayer_method_t method);
+		int convertGray();
+		int convertMono(frame_repr repr);
+
+		cam1394Image images[REPR_COUNT];
+		std::mutex locks[REPR_COUNT];
+		std::atomic<bool> ready[REPR_COUNT];
+
+		dc1394color_coding_t coding;
+		dc1394color_filter_t pattern;
+		dc1394bayer_method_t method;
+		int bits;
+		frame_allocator *alloc;
+	};
+};
+#endif
@@ -0,0 +1,210 @@
+//multiplexer.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cstring>
+
+#include "multiplexer.h"
+
+using namespace cam1394;
+
+/* events handed out per epoll_wait, more stay queued for the next call */
+#define MAX_EVENTS 32
+
+camera_multiplexer::camera_multiplexer() : stopped(false) {
+	epfd   = epoll_create1(EPOLL_CLOEXEC);
+	wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (epfd < 0 || wakefd < 0) {
+		fprintf(stderr, "ERROR: Failed to create epoll set: %s\n", strerror(errno));
+		return;
+	}
+
+	/* level triggered and never read, so a stop wakes every thread */
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events  = EPOLLIN;
+	ev.data.fd = wakefd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+}
+
+camera_multiplexer::~camera_multiplexer() {
+	for (std::map<int, entry*>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		it->second->image.destroy();
+		delete it->second;
+	}
+
+	if (epfd >= 0)
+		::close(epfd);
+	if (wakefd >= 0)
+		::close(wakefd);
+}
+
+int camera_multiplexer::add(camera* cam, frame_handler handler, void* user) {
+	int fd = cam->getFileDescriptor();
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Camera is not capturing\n");
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (entries.count(fd)) {
+		fprintf(stderr, "ERROR: Camera is already registered\n");
+		return -1;
+	}
+
+	entry *e = new entry;
+	e->cam     = cam;
+	e->fd      = fd;
+	e->handler = handler;
+	e->user    = user;
+	e->busy    = false;
+
+	/* one shot so only one thread services a camera, it is rearmed afterwards */
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events  = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		fprintf(stderr, "ERROR: Failed to add camera to epoll set: %s\n", strerror(errno));
+		delete e;
+		return -1;
+	}
+
+	entries[fd] = e;
+	return 0;
+}
+
+int camera_multiplexer::remove(camera* cam) {
+	std::unique_lock<std::mutex> lk(lock);
+
+	std::map<int, entry*>::iterator it;
+	for (it = entries.begin(); it != entries.end(); ++it)
+		if (it->second->cam == cam)
+			break;
+	if (it == entries.end())
+		return -1;
+
+	entry *e = it->second;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, e->fd, NULL);
+	idle.wait(lk, [e] { return !e->busy; });
+
+	entries.erase(e->fd);
+	e->image.destroy();
+	delete e;
+	return 0;
+}
+
+/* Lets a camera fire again after its one shot event, called with the lock held */
+void camera_multiplexer::rearm(int fd) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events  = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/* Reads the newest frame of a ready camera and calls its handler */
+int camera_multiplexer::service(entry* e) {
+	int ret = e->cam->poll(&e->image);
+	if (ret > 0)
+		e->handler(e->cam, &e->image, e->user);
+
+	std::lock_guard<std::mutex> guard(lock);
+	e->busy = false;
+	rearm(e->fd);
+	idle.notify_all();
+
+	return ret;
+}
+
+int camera_multiplexer::run(int timeout_ms) {
+	struct epoll_event events[MAX_EVENTS];
+
+	if (epfd < 0 || wakefd < 0)
+		return -1;
+
+	int n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0) {
+		if (errno == EINTR)
+			return 0;
+		fprintf(stderr, "ERROR: epoll_wait failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	int dispatched = 0;
+	for (int i = 0; i < n; i++) {
+		entry *e = NULL;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (stopped) {
+				/* the cameras not serviced yet fire again after reset */
+				for (; i < n; i++)
+					if (entries.count(events[i].data.fd))
+						rearm(events[i].data.fd);
+				return -1;
+			}
+
+			std::map<int, entry*>::iterator it = entries.find(events[i].data.fd);
+			if (it != entries.end()) {
+				e = it->second;
+				e->busy = true;
+			}
+		}
+
+		/* the wake fd, or a camera removed after the event was queued */
+		if (e == NULL)
+			continue;
+
+		if (service(e) > 0)
+			dispatched++;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	return stopped ? -1 : dispatched;
+}
+
+int camera_multiplexer::loop() {
+	while (1) {
+		if (run(-1) < 0) {
+			std::lock_guard<std::mutex> guard(lock);
+			return stopped ? 0 : -1;
+		}
+	}
+}
+
+void camera_multiplexer::stop() {
+	std::lock_guard<std::mutex> guard(lock);
+	stopped = true;
+
+	uint64_t one = 1;
+	if (write(wakefd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "ERROR: Failed to wake the multiplexer: %s\n", strerror(errno));
+}
+
+void camera_multiplexer::reset() {
+	std::lock_guard<std::mutex> guard(lock);
+	stopped = false;
+
+	uint64_t count;
+	if (read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "ERROR: Failed to reset the multiplexer: %s\n", strerror(errno));
+}
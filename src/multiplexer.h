@@ -0,0 +1,107 @@
+//multiplexer.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file multiplexer.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef MULTIPLEXER_H
+#define MULTIPLEXER_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief Called with each frame of a camera registered with a camera_multiplexer
+	 * \param cam	the camera the frame came from
+	 * \param image	the frame, only valid until the handler returns
+	 * \param user	pointer given to camera_multiplexer::add
+	 */
+	typedef void (*frame_handler)(camera* cam, cam1394Image* image, void* user);
+
+	/*!
+	 * \class camera_multiplexer
+	 * \brief Services many cameras from one epoll set
+	 *
+	 * The capture file descriptors of all cameras are waited on together
+	 * and whichever camera has a frame is read without blocking and its
+	 * handler called.  #run may be called from several threads at once, a
+	 * camera is then serviced by one thread at a time.
+	 */
+	class camera_multiplexer
+	{
+	public:
+		camera_multiplexer();
+		~camera_multiplexer();
+
+		/*!\brief Registers an open camera
+		 * \return 0 if success, <0 if failure
+		 */
+		int add(camera* cam, frame_handler handler, void* user);
+
+		/*!\brief Unregisters a camera, waiting for a handler that is running for it
+		 *
+		 * Must not be called from the handler of that camera.
+		 * \return 0 if success, <0 if the camera was not registered
+		 */
+		int remove(camera* cam);
+
+		/*!\brief Waits for frames once and dispatches them
+		 * \param timeout_ms	longest time to wait, <0 waits until a frame or #stop
+		 * \return number of frames dispatched, <0 if failure or stopped
+		 */
+		int run(int timeout_ms);
+
+		/*!\brief Calls #run until #stop
+		 * \return 0 when stopped, <0 if failure
+		 */
+		int loop();
+
+		/*!\brief Makes #loop and #run return in every thread, also from a handler */
+		void stop();
+
+		/*!\brief Lets #loop and #run be used again after #stop */
+		void reset();
+
+	private:
+		struct entry {
+			camera *cam;
+			int fd;
+			frame_handler handler;
+			void *user;
+			cam1394Image image;
+			bool busy;
+		};
+
+		int service(entry* e);
+		void rearm(int fd);
+
+		int epfd;
+		int wakefd;
+		bool stopped;
+
+		std::mutex lock;
+		std::condition_variable idle;
+		std::map<int, entry*> entries;
+	};
+};
+#endif
@@ -0,0 +1,313 @@
+//pipeline.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+
+#include "pipeline.h"
+#include "Timer.hpp"
+
+using namespace cam1394;
+
+frame_pipeline::frame_pipeline(camera* cam, int threads) :
+	cam(cam), threads(threads < 1 ? 1 : threads), raw(false), running(false), seq(0) {
+	append("capture", NULL, NULL, false, 0, OVERFLOW_BLOCK);
+}
+
+frame_pipeline::~frame_pipeline() {
+	stop();
+
+	for (size_t i = 0; i < stages.size(); i++)
+		delete stages[i];
+	for (size_t i = 0; i < frames.size(); i++) {
+		frames[i]->raw.destroy();
+		frames[i]->image.destroy();
+		delete frames[i];
+	}
+}
+
+int frame_pipeline::append(const char* name, stage_func func, void* user, bool convert,
+						   int queue_size, overflow_policy policy) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (running) {
+		fprintf(stderr, "ERROR: Stages can not be added to a running pipeline\n");
+		return -1;
+	}
+	if (!stages.empty() && queue_size < 1) {
+		fprintf(stderr, "ERROR: Queue of stage %s must hold at least one frame\n", name);
+		return -1;
+	}
+
+	stage *s = new stage;
+	s->name     = name;
+	s->func     = func;
+	s->user     = user;
+	s->convert  = convert;
+	s->capacity = queue_size;
+	s->policy   = policy;
+	s->busy     = false;
+	s->total_us = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+
+	stages.push_back(s);
+	return stages.size() - 1;
+}
+
+int frame_pipeline::addStage(const char* name, stage_func func, void* user, int queue_size, overflow_policy policy) {
+	if (func == NULL) {
+		fprintf(stderr, "ERROR: Stage %s has no function\n", name);
+		return -1;
+	}
+	return append(name, func, user, false, queue_size, policy);
+}
+
+int frame_pipeline::addConvertStage(int queue_size, overflow_policy policy) {
+	if (raw) {
+		fprintf(stderr, "ERROR: Pipeline already has a convert stage\n");
+		return -1;
+	}
+
+	int ret = append("convert", NULL, NULL, true, queue_size, policy);
+	if (ret >= 0)
+		raw = true;
+	return ret;
+}
+
+int frame_pipeline::start() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (running)
+		return 0;
+
+	running = true;
+	seq = 0;
+	capture = std::thread(&frame_pipeline::captureLoop, this);
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&frame_pipeline::workerLoop, this));
+
+	return 0;
+}
+
+void frame_pipeline::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!running)
+			return;
+		running = false;
+	}
+	work.notify_all();
+	space.notify_all();
+
+	/* the capture thread leaves after the frame it is waiting for */
+	capture.join();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+
+	for (size_t i = 1; i < stages.size(); i++) {
+		while (!stages[i]->queue.empty()) {
+			recycle(stages[i]->queue.front());
+			stages[i]->queue.pop_front();
+		}
+		stages[i]->stats.queue_depth = 0;
+	}
+}
+
+int frame_pipeline::numStages() {
+	std::lock_guard<std::mutex> guard(lock);
+	return stages.size();
+}
+
+const char* frame_pipeline::stageName(int stage) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (stage < 0 || stage >= (int)stages.size())
+		return NULL;
+	return stages[stage]->name.c_str();
+}
+
+int frame_pipeline::getStats(int stage, stage_stats* stats) {
+	std::lock_guard<std::mutex> guard(lock);
+	if (stage < 0 || stage >= (int)stages.size())
+		return -1;
+
+	*stats = stages[stage]->stats;
+	return 0;
+}
+
+/* Called with the lock held */
+pipeline_frame* frame_pipeline::takeFrame() {
+	if (!free_frames.empty()) {
+		pipeline_frame *f = free_frames.back();
+		free_frames.pop_back();
+		return f;
+	}
+
+	pipeline_frame *f = new pipeline_frame;
+	frames.push_back(f);
+	return f;
+}
+
+/* Called with the lock held */
+void frame_pipeline::recycle(pipeline_frame* frame) {
+	free_frames.push_back(frame);
+}
+
+/* Called with the lock held */
+void frame_pipeline::finish(stage* s, double us) {
+	s->stats.processed++;
+	s->stats.last_us = us;
+	if (us > s->stats.max_us)
+		s->stats.max_us = us;
+	s->total_us += us;
+	s->stats.average_us = s->total_us / s->stats.processed;
+}
+
+/* Hands a frame to stage index, called with the lock held.  Returns false
+ * if the frame was dropped. */
+bool frame_pipeline::push(size_t index, pipeline_frame* frame, std::unique_lock<std::mutex>& lk) {
+	if (index >= stages.size()) {
+		recycle(frame);
+		return true;
+	}
+
+	stage *s = stages[index];
+	if (s->queue.size() >= s->capacity) {
+		switch (s->policy) {
+			case OVERFLOW_DROP_OLDEST:
+				recycle(s->queue.front());
+				s->queue.pop_front();
+				s->stats.dropped++;
+				break;
+			case OVERFLOW_DROP_NEWEST:
+				recycle(frame);
+				s->stats.dropped++;
+				return false;
+			case OVERFLOW_BLOCK:
+				/* only the capture thread gets here, workers wait in findRunnable */
+				space.wait(lk, [&] { return !running || s->queue.size() < s->capacity; });
+				if (!running) {
+					recycle(frame);
+					return false;
+				}
+				break;
+		}
+	}
+
+	s->queue.push_back(frame);
+	s->stats.queue_depth = s->queue.size();
+	if (s->stats.queue_depth > s->stats.queue_high_water)
+		s->stats.queue_high_water = s->stats.queue_depth;
+	work.notify_one();
+
+	return true;
+}
+
+/* Picks the stage closest to the end that has a frame, is idle and is not
+ * held back by a full blocking queue after it.  Called with the lock held. */
+int frame_pipeline::findRunnable() {
+	for (int i = stages.size() - 1; i >= 1; i--) {
+		stage *s = stages[i];
+		if (s->busy || s->queue.empty())
+			continue;
+
+		if (i + 1 < (int)stages.size()) {
+			stage *next = stages[i + 1];
+			if (next->policy == OVERFLOW_BLOCK && next->queue.size() >= next->capacity)
+				continue;
+		}
+		return i;
+	}
+	return -1;
+}
+
+void frame_pipeline::captureLoop() {
+	realtime_settings rt = cam->getRealtime();
+	applyThreadSettings(rt.cpus, rt.priority, NULL);
+
+	std::unique_lock<std::mutex> lk(lock);
+	stage *s = stages[0];
+
+	while (running) {
+		pipeline_frame *f = takeFrame();
+		lk.unlock();
+
+		Timer t;
+		t.start();
+		int ret = raw ? cam->readRaw(&f->raw) : cam->read(&f->image);
+		t.end();
+
+		f->timestamp = cam->getTimestamp();
+		f->dropped   = cam->getNumDroppedFrames();
+
+		lk.lock();
+		if (ret < 0) {
+			s->stats.errors++;
+			recycle(f);
+			continue;
+		}
+
+		f->seq = seq++;
+		finish(s, t.elapsed() * 1e6);
+		push(1, f, lk);
+	}
+}
+
+void frame_pipeline::workerLoop() {
+	realtime_settings rt = cam->getRealtime();
+	applyThreadSettings(rt.worker_cpus, rt.worker_priority, NULL);
+
+	std::unique_lock<std::mutex> lk(lock);
+
+	while (running) {
+		int i = findRunnable();
+		if (i < 0) {
+			work.wait(lk);
+			continue;
+		}
+
+		stage *s = stages[i];
+		pipeline_frame *f = s->queue.front();
+		s->queue.pop_front();
+		s->stats.queue_depth = s->queue.size();
+		s->busy = true;
+		space.notify_all();
+		lk.unlock();
+
+		Timer t;
+		t.start();
+		int ret = s->convert ? cam->convert(&f->raw, &f->image) : s->func(f, s->user);
+		t.end();
+
+		lk.lock();
+		s->busy = false;
+		finish(s, t.elapsed() * 1e6);
+
+		if (ret < 0) {
+			s->stats.errors++;
+			recycle(f);
+		} else if (ret > 0) {
+			s->stats.filtered++;
+			recycle(f);
+		} else {
+			push(i + 1, f, lk);
+		}
+
+		/* this stage may run again, and the one before may have been waiting for room */
+		work.notify_all();
+	}
+}
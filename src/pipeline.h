@@ -0,0 +1,198 @@
+//pipeline.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file pipeline.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.h"
+
+namespace cam1394
+{
+	/*!\brief A frame travelling through a frame_pipeline
+	 */
+	struct pipeline_frame {
+		/*!\brief Unconverted frame, only used when the pipeline has a convert stage */
+		cam1394Image raw;
+		/*!\brief Converted frame */
+		cam1394Image image;
+
+		/*!\brief Number of the frame since frame_pipeline::start */
+		uint64_t seq;
+		/*!\brief See camera::getTimestamp */
+		long timestamp;
+		/*!\brief See camera::getNumDroppedFrames */
+		int dropped;
+	};
+
+	/*!\brief What a full stage queue does with one more frame
+	 */
+	enum overflow_policy {
+		/*!\brief Drop the oldest queued frame to make room */
+		OVERFLOW_DROP_OLDEST = 0,
+		/*!\brief Drop the frame that does not fit */
+		OVERFLOW_DROP_NEWEST = 1,
+		/*!\brief Hold the frame in the stage before until there is room */
+		OVERFLOW_BLOCK = 2
+	};
+
+	/*!\brief Processes one frame
+	 * \param frame	the frame, only valid until the function returns
+	 * \param user	pointer given to frame_pipeline::addStage
+	 * \return 0 to pass the frame on, >0 to stop it here, <0 on failure
+	 */
+	typedef int (*stage_func)(pipeline_frame* frame, void* user);
+
+	/*!\brief Counters of one pipeline stage
+	 */
+	struct stage_stats {
+		/*!\brief Frames the stage finished */
+		uint64_t processed;
+		/*!\brief Frames the stage stopped by returning >0 */
+		uint64_t filtered;
+		/*!\brief Frames the stage failed on */
+		uint64_t errors;
+		/*!\brief Frames dropped by the overflow policy of the input queue */
+		uint64_t dropped;
+
+		/*!\brief Frames waiting in the input queue */
+		int queue_depth;
+		/*!\brief Most frames that were ever waiting in the input queue */
+		int queue_high_water;
+
+		/*!\brief Time spent on the last frame in us */
+		double last_us;
+		/*!\brief Average time per frame in us */
+		double average_us;
+		/*!\brief Longest time spent on a frame in us */
+		double max_us;
+	};
+
+	/*!
+	 * \class frame_pipeline
+	 * \brief Runs the frames of a camera through a chain of stages
+	 *
+	 * Stage 0 reads the camera on its own thread.  The stages added after
+	 * it are connected by bounded queues and run on a shared pool of worker
+	 * threads.  Each stage handles one frame at a time, so frames leave
+	 * every stage in order while different stages run on different cores.
+	 */
+	class frame_pipeline
+	{
+	public:
+		/*!\param cam		an open camera, only read by the pipeline while it runs
+		 * \param threads	number of worker threads
+		 */
+		frame_pipeline(camera* cam, int threads);
+		~frame_pipeline();
+
+		/*!\brief Appends a stage calling func
+		 * \param name			name for reports
+		 * \param queue_size	frames the input queue holds
+		 * \param policy		what happens when the input queue is full
+		 * \return index of the stage if success, <0 if failure
+		 */
+		int addStage(const char* name, stage_func func, void* user, int queue_size, overflow_policy policy);
+
+		/*!\brief Appends a stage that converts the frames with camera::convert
+		 *
+		 * The capture stage then only copies raw frames out of the DMA ring,
+		 * so debayering runs on the worker threads.
+		 * \return index of the stage if success, <0 if failure
+		 */
+		int addConvertStage(int queue_size, overflow_policy policy);
+
+		/*!\brief Starts reading frames
+		 *
+		 * The capture thread takes the CPU affinity and priority and the
+		 * workers the worker settings of camera::getRealtime.
+		 * \return 0 if success, <0 if failure
+		 */
+		int start();
+
+		/*!\brief Stops the threads, frames still queued are dropped */
+		void stop();
+
+		/*!\brief Gets the number of stages, including the capture stage */
+		int numStages();
+
+		/*!\brief Gets the name of a stage */
+		const char* stageName(int stage);
+
+		/*!\brief Gets the counters of a stage
+		 * \return 0 if success, <0 if there is no such stage
+		 */
+		int getStats(int stage, stage_stats* stats);
+
+	private:
+		struct stage {
+			std::string name;
+			stage_func func;
+			void *user;
+			bool convert;
+
+			std::deque<pipeline_frame*> queue;
+			size_t capacity;
+			overflow_policy policy;
+			bool busy;
+
+			stage_stats stats;
+			double total_us;
+		};
+
+		void captureLoop();
+		void workerLoop();
+		int findRunnable();
+		bool push(size_t index, pipeline_frame* frame, std::unique_lock<std::mutex>& lk);
+		void finish(stage* s, double us);
+		pipeline_frame* takeFrame();
+		void recycle(pipeline_frame* frame);
+		int append(const char* name, stage_func func, void* user, bool convert,
+				   int queue_size, overflow_policy policy);
+
+		camera *cam;
+		int threads;
+		bool raw;
+
+		std::mutex lock;
+		std::condition_variable work;
+		std::condition_variable space;
+		bool running;
+
+		std::vector<stage*> stages;
+		std::vector<pipeline_frame*> frames;
+		std::vector<pipeline_frame*> free_frames;
+		uint64_t seq;
+
+		std::thread capture;
+		std::vector<std::thread> workers;
+	};
+};
+#endif
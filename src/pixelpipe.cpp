@@ -0,0 +1,605 @@
+//pixelpipe.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "camera.h"
+#include "pixelpipe.h"
+
+using namespace cam1394;
+
+/* gamma of the curve that maps deep frames to 8 bit output */
+#define TONE_GAMMA 2.2
+
+/* Position of the red sample in the 2x2 bayer cell, blue is diagonal to it */
+template <dc1394color_filter_t P>
+struct bayer_layout {
+	static const int ry = (P == DC1394_COLOR_FILTER_RGGB || P == DC1394_COLOR_FILTER_GRBG) ? 0 : 1;
+	static const int rx = (P == DC1394_COLOR_FILTER_RGGB || P == DC1394_COLOR_FILTER_GBRG) ? 0 : 1;
+};
+
+/* What a sample at (dy, dx) of the cell is */
+enum bayer_site { SITE_RED, SITE_BLUE, SITE_GREEN_R, SITE_GREEN_B };
+
+template <dc1394color_filter_t P, int DY, int DX>
+struct bayer_site_of {
+	static const int ry = bayer_layout<P>::ry;
+	static const int rx = bayer_layout<P>::rx;
+	static const bayer_site value =
+		(DY == ry && DX == rx) ? SITE_RED :
+		(DY != ry && DX != rx) ? SITE_BLUE :
+		(DY == ry)             ? SITE_GREEN_R : SITE_GREEN_B;
+};
+
+/* Reads a sample, mirroring across the border when CLAMP so the bayer parity is kept */
+template <typename T, bool CLAMP>
+static inline int sample(const T* src, int w, int h, int y, int x) {
+	if (CLAMP) {
+		y = (y < 0) ? -y : (y >= h ? 2 * h - 2 - y : y);
+		x = (x < 0) ? -x : (x >= w ? 2 * w - 2 - x : x);
+	}
+	return src[y * w + x];
+}
+
+/* Tone curve from bits significant bits down to 8, gamma encoded so the
+ * shadows of high dynamic range frames keep their detail */
+static const uint8_t* toneTable(int bits) {
+	static std::once_flag built[17];
+	static std::vector<uint8_t> tables[17];
+
+	std::call_once(built[bits], [bits] {
+		int n = 1 << bits;
+		tables[bits].resize(n);
+		for (int i = 0; i < n; i++)
+			tables[bits][i] = (uint8_t)(255.0 * pow((double)i / (n - 1), 1 / TONE_GAMMA) + 0.5);
+	});
+	return &tables[bits][0];
+}
+
+/* Writes one output pixel, through the tone curve when the output is narrower than the source */
+template <typename U, int O>
+static inline void store(U* out, int r, int g, int b, int maxv, const uint8_t* lut) {
+	if (lut != NULL) {
+		r = lut[r < maxv ? r : maxv];
+		g = lut[g < maxv ? g : maxv];
+		b = lut[b < maxv ? b : maxv];
+	}
+	out[O == PIXEL_RGB ? 0 : 2] = (U)r;
+	out[1]                      = (U)g;
+	out[O == PIXEL_RGB ? 2 : 0] = (U)b;
+}
+
+static inline int clampTo(int v, int maxv) {
+	return v < 0 ? 0 : (v > maxv ? maxv : v);
+}
+
+#ifdef __SSE2__
+/* Four int32 lanes, so the kernels below are written once for scalars and vectors */
+struct lanes {
+	__m128i v;
+
+	lanes() {}
+	explicit lanes(__m128i v) : v(v) {}
+	explicit lanes(int k) : v(_mm_set1_epi32(k)) {}
+};
+
+static inline lanes operator+(lanes a, lanes b) { return lanes(_mm_add_epi32(a.v, b.v)); }
+static inline lanes operator-(lanes a, lanes b) { return lanes(_mm_sub_epi32(a.v, b.v)); }
+static inline lanes operator<<(lanes a, int n) { return lanes(_mm_slli_epi32(a.v, n)); }
+static inline lanes operator>>(lanes a, int n) { return lanes(_mm_srai_epi32(a.v, n)); }
+
+static inline lanes clampTo(lanes a, int maxv) {
+	__m128i hi  = _mm_set1_epi32(maxv);
+	__m128i pos = _mm_andnot_si128(_mm_srai_epi32(a.v, 31), a.v);
+	__m128i big = _mm_cmpgt_epi32(pos, hi);
+	return lanes(_mm_or_si128(_mm_and_si128(big, hi), _mm_andnot_si128(big, pos)));
+}
+
+/* Widens four consecutive samples */
+static inline lanes load4(const uint8_t* p) {
+	int32_t word;
+	memcpy(&word, p, 4);
+	__m128i zero = _mm_setzero_si128();
+	return lanes(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), zero));
+}
+
+static inline lanes load4(const uint16_t* p) {
+	return lanes(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()));
+}
+#endif
+
+/* The neighbourhood of a sample, up to two samples away */
+template <typename V>
+struct taps {
+	V c, n, s, e, w, ne, nw, se, sw;
+	V nn, ss, ee, ww;
+};
+
+/* Plain bilinear, the missing colors are the average of their nearest samples */
+struct bilinear_kernel {
+	static const int radius = 1;
+
+	template <int SITE, typename V>
+	static inline void rgb(const taps<V>& t, int maxv, V& r, V& g, V& b) {
+		if (SITE == SITE_RED || SITE == SITE_BLUE) {
+			V cross = (t.n + t.s + t.e + t.w + V(2)) >> 2;
+			V diag  = (t.ne + t.nw + t.se + t.sw + V(2)) >> 2;
+			r = (SITE == SITE_RED) ? t.c : diag;
+			g = cross;
+			b = (SITE == SITE_RED) ? diag : t.c;
+		} else {
+			V horiz = (t.e + t.w + V(1)) >> 1;
+			V vert  = (t.n + t.s + V(1)) >> 1;
+			r = (SITE == SITE_GREEN_R) ? horiz : vert;
+			g = t.c;
+			b = (SITE == SITE_GREEN_R) ? vert : horiz;
+		}
+	}
+};
+
+/* High quality linear interpolation (Malvar, He and Cutler), bilinear
+ * corrected by the laplacian of the known color.  It overshoots, so the
+ * results are clamped to the data depth of the frame. */
+struct hqlinear_kernel {
+	static const int radius = 2;
+
+	template <int SITE, typename V>
+	static inline void rgb(const taps<V>& t, int maxv, V& r, V& g, V& b) {
+		V diag  = t.ne + t.nw + t.se + t.sw;
+		V far_h = t.ee + t.ww;
+		V far_v = t.nn + t.ss;
+		V c10   = (t.c << 3) + (t.c << 1);
+
+		if (SITE == SITE_RED || SITE == SITE_BLUE) {
+			V far   = far_h + far_v;
+			V green = clampTo(((t.c << 2) + ((t.n + t.s + t.e + t.w) << 1) - far + V(4)) >> 3, maxv);
+			V other = clampTo(((t.c << 3) + (t.c << 2) + (diag << 2) - far - (far << 1) + V(8)) >> 4, maxv);
+			r = (SITE == SITE_RED) ? t.c : other;
+			g = green;
+			b = (SITE == SITE_RED) ? other : t.c;
+		} else {
+			/* the color of this row sits left and right, the other one above and below */
+			V row = clampTo((c10 + ((t.e + t.w) << 3) - ((far_h + diag) << 1) + far_v + V(8)) >> 4, maxv);
+			V col = clampTo((c10 + ((t.n + t.s) << 3) - ((far_v + diag) << 1) + far_h + V(8)) >> 4, maxv);
+			r = (SITE == SITE_GREEN_R) ? row : col;
+			g = t.c;
+			b = (SITE == SITE_GREEN_R) ? col : row;
+		}
+	}
+};
+
+/* One output pixel whose site is known at compile time */
+template <typename K, int SITE, bool CLAMP, typename T, typename U, int O>
+static inline void kernelPixel(const T* src, int w, int h, int y, int x, int maxv, const uint8_t* lut, U* out) {
+	taps<int> t;
+	t.c  = sample<T, CLAMP>(src, w, h, y, x);
+	t.n  = sample<T, CLAMP>(src, w, h, y - 1, x);
+	t.s  = sample<T, CLAMP>(src, w, h, y + 1, x);
+	t.e  = sample<T, CLAMP>(src, w, h, y, x + 1);
+	t.w  = sample<T, CLAMP>(src, w, h, y, x - 1);
+	t.ne = sample<T, CLAMP>(src, w, h, y - 1, x + 1);
+	t.nw = sample<T, CLAMP>(src, w, h, y - 1, x - 1);
+	t.se = sample<T, CLAMP>(src, w, h, y + 1, x + 1);
+	t.sw = sample<T, CLAMP>(src, w, h, y + 1, x - 1);
+	if (K::radius > 1) {
+		t.nn = sample<T, CLAMP>(src, w, h, y - 2, x);
+		t.ss = sample<T, CLAMP>(src, w, h, y + 2, x);
+		t.ee = sample<T, CLAMP>(src, w, h, y, x + 2);
+		t.ww = sample<T, CLAMP>(src, w, h, y, x - 2);
+	}
+
+	int r, g, b;
+	K::template rgb<SITE>(t, maxv, r, g, b);
+	store<U, O>(out, r, g, b, maxv, lut);
+}
+
+/* A sample on row parity DY whose column parity is only known at run time */
+template <typename K, typename T, typename U, dc1394color_filter_t P, int O, int DY>
+static inline void kernelEdge(const T* src, int w, int h, int y, int x, int maxv, const uint8_t* lut, U* out) {
+	if (x & 1)
+		kernelPixel<K, bayer_site_of<P, DY, 1>::value, true, T, U, O>(src, w, h, y, x, maxv, lut, out);
+	else
+		kernelPixel<K, bayer_site_of<P, DY, 0>::value, true, T, U, O>(src, w, h, y, x, maxv, lut, out);
+}
+
+#ifdef __SSE2__
+/* Four output pixels starting at an even column, the even lanes take the
+ * first site of the row and the odd lanes the second */
+template <typename K, typename T, typename U, dc1394color_filter_t P, int O, int DY>
+static inline void kernelQuad(const T* src, int w, int y, int x, int maxv, const uint8_t* lut, U* out) {
+	const T *p = src + (size_t)y * w + x;
+	taps<lanes> t;
+	t.c  = load4(p);
+	t.n  = load4(p - w);
+	t.s  = load4(p + w);
+	t.e  = load4(p + 1);
+	t.w  = load4(p - 1);
+	t.ne = load4(p - w + 1);
+	t.nw = load4(p - w - 1);
+	t.se = load4(p + w + 1);
+	t.sw = load4(p + w - 1);
+	if (K::radius > 1) {
+		t.nn = load4(p - 2 * w);
+		t.ss = load4(p + 2 * w);
+		t.ee = load4(p + 2);
+		t.ww = load4(p - 2);
+	}
+
+	lanes r0, g0, b0, r1, g1, b1;
+	K::template rgb<bayer_site_of<P, DY, 0>::value>(t, maxv, r0, g0, b0);
+	K::template rgb<bayer_site_of<P, DY, 1>::value>(t, maxv, r1, g1, b1);
+
+	const __m128i even = _mm_set_epi32(0, -1, 0, -1);
+	int32_t r[4], g[4], b[4];
+	_mm_storeu_si128((__m128i*)r, _mm_or_si128(_mm_and_si128(even, r0.v), _mm_andnot_si128(even, r1.v)));
+	_mm_storeu_si128((__m128i*)g, _mm_or_si128(_mm_and_si128(even, g0.v), _mm_andnot_si128(even, g1.v)));
+	_mm_storeu_si128((__m128i*)b, _mm_or_si128(_mm_and_si128(even, b0.v), _mm_andnot_si128(even, b1.v)));
+
+	for (int i = 0; i < 4; i++, out += 3)
+		store<U, O>(out, r[i], g[i], b[i], maxv, lut);
+}
+#endif
+
+/* Columns x0 to x1 of row y, only columns and rows near the border need mirroring */
+template <typename K, typename T, typename U, dc1394color_filter_t P, int O, int DY, bool CLAMP>
+static inline void kernelRow(const T* src, int w, int h, int y, int x0, int x1, int maxv, const uint8_t* lut, U* out) {
+	const int R = K::radius;
+	int lo = CLAMP ? x1 : (x0 < R ? R : x0);
+	int hi = CLAMP ? x1 : (x1 > w - R ? w - R : x1);
+	int x = x0;
+
+	for (; x < lo; x++, out += 3)
+		kernelEdge<K, T, U, P, O, DY>(src, w, h, y, x, maxv, lut, out);
+
+	if (x < hi && (x & 1)) {
+		kernelPixel<K, bayer_site_of<P, DY, 1>::value, false, T, U, O>(src, w, h, y, x, maxv, lut, out);
+		x++;
+		out += 3;
+	}
+#ifdef __SSE2__
+	for (; x + 3 < hi; x += 4, out += 12)
+		kernelQuad<K, T, U, P, O, DY>(src, w, y, x, maxv, lut, out);
+#endif
+	for (; x + 1 < hi; x += 2, out += 6) {
+		kernelPixel<K, bayer_site_of<P, DY, 0>::value, false, T, U, O>(src, w, h, y, x,     maxv, lut, out);
+		kernelPixel<K, bayer_site_of<P, DY, 1>::value, false, T, U, O>(src, w, h, y, x + 1, maxv, lut, out + 3);
+	}
+
+	for (; x < x1; x++, out += 3)
+		kernelEdge<K, T, U, P, O, DY>(src, w, h, y, x, maxv, lut, out);
+}
+
+/* Significant bits of a frame, data_depth when the camera reports a sensible one */
+template <typename T>
+static inline int sampleBits(int bits) {
+	return (bits <= 0 || bits > (int)(8 * sizeof(T))) ? 8 * sizeof(T) : bits;
+}
+
+/* The tone curve for a source of bits significant bits, NULL when the output keeps the source depth */
+template <typename T, typename U>
+static inline const uint8_t* toneFor(int bits) {
+	return (sizeof(U) < sizeof(T)) ? toneTable(bits) : NULL;
+}
+
+template <typename K, typename T, typename U, dc1394color_filter_t P, int O>
+static int debayerKernel(const uchar* in, int w, int h, int bits, const pixel_rect& roi, uchar* outp, size_t stride) {
+	const T *src = (const T*)in;
+	int x1 = roi.x + roi.width;
+	const int R = K::radius;
+
+	if (w < 2 * R + 2 || h < 2 * R + 2 || (w & 1) || (h & 1))
+		return -1;
+
+	bits = sampleBits<T>(bits);
+	int maxv = (1 << bits) - 1;
+	const uint8_t *lut = toneFor<T, U>(bits);
+
+	for (int y = roi.y; y < roi.y + roi.height; y++, outp += stride) {
+		U *out = (U*)outp;
+		bool edge = (y < R || y >= h - R);
+
+		if (y & 1) {
+			if (edge)
+				kernelRow<K, T, U, P, O, 1, true>(src, w, h, y, roi.x, x1, maxv, lut, out);
+			else
+				kernelRow<K, T, U, P, O, 1, false>(src, w, h, y, roi.x, x1, maxv, lut, out);
+		} else {
+			if (edge)
+				kernelRow<K, T, U, P, O, 0, true>(src, w, h, y, roi.x, x1, maxv, lut, out);
+			else
+				kernelRow<K, T, U, P, O, 0, false>(src, w, h, y, roi.x, x1, maxv, lut, out);
+		}
+	}
+
+	return 0;
+}
+
+/* NEAREST copies the missing colors from the same cell, SIMPLE also averages the greens */
+template <typename T, typename U, dc1394color_filter_t P, int O, bool AVERAGE>
+static int debayerCell(const uchar* in, int w, int h, int bits, const pixel_rect& roi, uchar* outp, size_t stride) {
+	const int ry = bayer_layout<P>::ry;
+	const int rx = bayer_layout<P>::rx;
+	const T *src = (const T*)in;
+	int x1 = roi.x + roi.width;
+
+	if ((w & 1) || (h & 1))
+		return -1;
+
+	bits = sampleBits<T>(bits);
+	int maxv = (1 << bits) - 1;
+	const uint8_t *lut = toneFor<T, U>(bits);
+
+	for (int y = roi.y; y < roi.y + roi.height; y++, outp += stride) {
+		const T *row0 = src + (y & ~1) * w;
+		const T *row1 = row0 + w;
+		const T *rrow = ry ? row1 : row0;
+		const T *brow = ry ? row0 : row1;
+		/* each green keeps its own value, red and blue sites use the green of their row */
+		bool red_row = ((y & 1) == ry);
+		U *out = (U*)outp;
+		int x = roi.x;
+
+		for (; x < x1; ) {
+			int cx = x & ~1;
+			int r  = rrow[cx + rx];
+			int b  = brow[cx + 1 - rx];
+			int g  = AVERAGE ? (rrow[cx + 1 - rx] + brow[cx + rx] + 1) >> 1
+							 : (red_row ? rrow[cx + 1 - rx] : brow[cx + rx]);
+
+			store<U, O>(out, r, g, b, maxv, lut);
+			out += 3;
+			if (++x < x1 && x == cx + 1) {
+				store<U, O>(out, r, g, b, maxv, lut);
+				out += 3;
+				x++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* One output pixel per bayer cell */
+template <typename T, typename U, dc1394color_filter_t P, int O>
+static int debayerDownsample(const uchar* in, int w, int h, int bits, const pixel_rect& roi, uchar* outp, size_t stride) {
+	const int ry = bayer_layout<P>::ry;
+	const int rx = bayer_layout<P>::rx;
+	const T *src = (const T*)in;
+
+	if ((w & 1) || (h & 1))
+		return -1;
+
+	bits = sampleBits<T>(bits);
+	int maxv = (1 << bits) - 1;
+	const uint8_t *lut = toneFor<T, U>(bits);
+
+	for (int y = roi.y; y < roi.y + roi.height; y++, outp += stride) {
+		const T *rrow = src + (2 * y + ry) * w;
+		const T *brow = src + (2 * y + 1 - ry) * w;
+		U *out = (U*)outp;
+
+		for (int x = 2 * roi.x; x < 2 * (roi.x + roi.width); x += 2, out += 3)
+			store<U, O>(out, rrow[x + rx], (rrow[x + 1 - rx] + brow[x + rx] + 1) >> 1, brow[x + 1 - rx], maxv, lut);
+	}
+
+	return 0;
+}
+
+/* The remaining methods go through libdc1394, which only writes whole packed RGB frames */
+template <typename T, dc1394color_filter_t P, int O, dc1394bayer_method_t M>
+static int debayerLibrary(const uchar* in, int w, int h, int bits, const pixel_rect& roi, uchar* outp, size_t stride) {
+	dc1394error_t err;
+	if (sizeof(T) == 1)
+		err = dc1394_bayer_decoding_8bit(in, outp, w, h, P, M);
+	else
+		err = dc1394_bayer_decoding_16bit((const uint16_t*)in, (uint16_t*)outp, w, h, P, M, sampleBits<T>(bits));
+
+	if (err != DC1394_SUCCESS)
+		return -1;
+
+	if (O == PIXEL_BGR) {
+		T *p = (T*)outp;
+		T *end = p + (size_t)w * h * 3;
+		for (; p < end; p += 3) {
+			T t = p[0];
+			p[0] = p[2];
+			p[2] = t;
+		}
+	}
+
+	return 0;
+}
+
+/* Sets up a libdc1394 method, which can only keep the source depth */
+template <typename T, typename U, dc1394color_filter_t P, int O, dc1394bayer_method_t M>
+static int selectLibrary(pixel_pipeline* pipe) {
+	if (sizeof(U) != sizeof(T))
+		return -1;
+
+	pipe->convert    = debayerLibrary<T, P, O, M>;
+	pipe->full_frame = true;
+	return 0;
+}
+
+template <typename T, typename U, dc1394color_filter_t P, int O>
+static int selectMethod(dc1394bayer_method_t method, pixel_pipeline* pipe) {
+	pipe->channels   = 3;
+	pipe->bytes      = sizeof(U);
+	pipe->shift      = 0;
+	pipe->full_frame = false;
+
+	switch (method) {
+		case DC1394_BAYER_METHOD_NEAREST:
+			pipe->convert = debayerCell<T, U, P, O, false>;
+			break;
+		case DC1394_BAYER_METHOD_SIMPLE:
+			pipe->convert = debayerCell<T, U, P, O, true>;
+			break;
+		case DC1394_BAYER_METHOD_BILINEAR:
+			pipe->convert = debayerKernel<bilinear_kernel, T, U, P, O>;
+			break;
+		case DC1394_BAYER_METHOD_HQLINEAR:
+			pipe->convert = debayerKernel<hqlinear_kernel, T, U, P, O>;
+			break;
+		case DC1394_BAYER_METHOD_DOWNSAMPLE:
+			pipe->convert = debayerDownsample<T, U, P, O>;
+			pipe->shift   = 1;
+			break;
+		case DC1394_BAYER_METHOD_EDGESENSE:
+			return selectLibrary<T, U, P, O, DC1394_BAYER_METHOD_EDGESENSE>(pipe);
+		case DC1394_BAYER_METHOD_VNG:
+			return selectLibrary<T, U, P, O, DC1394_BAYER_METHOD_VNG>(pipe);
+		case DC1394_BAYER_METHOD_AHD:
+			return selectLibrary<T, U, P, O, DC1394_BAYER_METHOD_AHD>(pipe);
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+template <typename T, typename U, int O>
+static int selectPattern(dc1394color_filter_t pattern, dc1394bayer_method_t method, pixel_pipeline* pipe) {
+	switch (pattern) {
+		case DC1394_COLOR_FILTER_RGGB:
+			return selectMethod<T, U, DC1394_COLOR_FILTER_RGGB, O>(method, pipe);
+		case DC1394_COLOR_FILTER_GBRG:
+			return selectMethod<T, U, DC1394_COLOR_FILTER_GBRG, O>(method, pipe);
+		case DC1394_COLOR_FILTER_GRBG:
+			return selectMethod<T, U, DC1394_COLOR_FILTER_GRBG, O>(method, pipe);
+		case DC1394_COLOR_FILTER_BGGR:
+			return selectMethod<T, U, DC1394_COLOR_FILTER_BGGR, O>(method, pipe);
+		default:
+			return -1;
+	}
+}
+
+template <typename T, typename U>
+static int selectOrder(dc1394color_filter_t pattern, dc1394bayer_method_t method, pixel_order order, pixel_pipeline* pipe) {
+	if (order == PIXEL_BGR)
+		return selectPattern<T, U, PIXEL_BGR>(pattern, method, pipe);
+	return selectPattern<T, U, PIXEL_RGB>(pattern, method, pipe);
+}
+
+int cam1394::selectPipeline(dc1394color_coding_t coding, dc1394color_filter_t pattern,
+							dc1394bayer_method_t method, pixel_order order, pixel_pipeline* pipe,
+							pixel_depth depth) {
+	int ret;
+	pixel_pipeline p;
+
+	switch (coding) {
+		case DC1394_COLOR_CODING_MONO8:
+		case DC1394_COLOR_CODING_RAW8:
+			ret = selectOrder<uint8_t, uint8_t>(pattern, method, order, &p);
+			break;
+		case DC1394_COLOR_CODING_MONO16:
+		case DC1394_COLOR_CODING_RAW16:
+			if (depth == DEPTH_TONEMAP8)
+				ret = selectOrder<uint16_t, uint8_t>(pattern, method, order, &p);
+			else
+				ret = selectOrder<uint16_t, uint16_t>(pattern, method, order, &p);
+			break;
+		default:
+			ret = -1;
+	}
+
+	if (ret == 0)
+		*pipe = p;
+	return ret;
+}
+
+void cam1394::copyRegion(const unsigned char* src, size_t src_stride, const pixel_rect& roi,
+						 int pixel_bytes, unsigned char* dst, size_t dst_stride) {
+	const unsigned char *row = src + roi.y * src_stride + (size_t)roi.x * pixel_bytes;
+	size_t bytes = (size_t)roi.width * pixel_bytes;
+
+	if (src_stride == dst_stride && bytes == src_stride) {
+		memcpy(dst, row, bytes * roi.height);
+		return;
+	}
+
+	for (int y = 0; y < roi.height; y++, row += src_stride, dst += dst_stride)
+		memcpy(dst, row, bytes);
+}
+
+size_t cam1394::packedBytes(pixel_packing packing, size_t pixels) {
+	return pixels / 2 * 3;
+}
+
+/* Two samples from the three bytes a, b, c */
+static inline void unpackPair(int a, int b, int c, int low, uint16_t* dst) {
+	int mask = (1 << low) - 1;
+	dst[0] = (uint16_t)((a << low) | (b & mask));
+	dst[1] = (uint16_t)((c << low) | ((b >> 4) & mask));
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UNPACK_SSSE3
+#include <tmmintrin.h>
+
+/* Eight samples from every twelve bytes, picked when the cpu has SSSE3.
+ * Each 16 bit lane gets the byte with its high bits above the shared
+ * byte, then the low bits are moved into place. */
+__attribute__((target("ssse3")))
+static size_t unpackSSSE3(const unsigned char* src, size_t pixels, int low, uint16_t* dst) {
+	const __m128i order = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+	const __m128i high  = _mm_set1_epi16((short)(0xff << low));
+	const __m128i mask  = _mm_set1_epi16((short)((1 << low) - 1));
+	const __m128i even  = _mm_set1_epi32(0xffff);
+	size_t bytes = pixels / 2 * 3;
+	size_t i = 0;
+
+	/* the loads read 16 bytes for 12, stop before they run past the frame */
+	for (; i / 2 * 3 + 16 <= bytes; i += 8, src += 12, dst += 8) {
+		__m128i v   = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), order);
+		__m128i hi  = _mm_and_si128(_mm_srli_epi16(v, 8 - low), high);
+		__m128i lo  = _mm_or_si128(_mm_and_si128(even, v), _mm_andnot_si128(even, _mm_srli_epi16(v, 4)));
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(hi, _mm_and_si128(lo, mask)));
+	}
+
+	return i;
+}
+#endif
+
+void cam1394::unpackPixels(const unsigned char* src, size_t pixels, pixel_packing packing, uint16_t* dst) {
+	int low = packing - 8;
+	size_t i = 0;
+
+#ifdef UNPACK_SSSE3
+	if (__builtin_cpu_supports("ssse3"))
+		i = unpackSSSE3(src, pixels, low, dst);
+#endif
+
+	for (src += i / 2 * 3; i + 1 < pixels; i += 2, src += 3)
+		unpackPair(src[0], src[1], src[2], low, dst + i);
+}
+
+void cam1394::unpackPixels8(const unsigned char* src, size_t pixels, pixel_packing packing, uint8_t* dst) {
+	/* the high bits are whole bytes, the shared byte is skipped */
+	for (size_t i = 0; i + 1 < pixels; i += 2, src += 3) {
+		dst[i]     = src[0];
+		dst[i + 1] = src[2];
+	}
+}
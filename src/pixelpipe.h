@@ -0,0 +1,159 @@
+//pixelpipe.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file pixelpipe.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef PIXELPIPE_H
+#define PIXELPIPE_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <dc1394/dc1394.h>
+
+namespace cam1394
+{
+	/*!\brief Channel order of debayered output
+	 */
+	enum pixel_order {
+		PIXEL_RGB = 0,
+		PIXEL_BGR = 1
+	};
+
+	/*!\brief Sample depth of debayered output
+	 */
+	enum pixel_depth {
+		/*!\brief Same depth as the raw frame */
+		DEPTH_SOURCE = 0,
+		/*!\brief 16 bit frames are tone mapped to 8 bits in the same pass */
+		DEPTH_TONEMAP8 = 1
+	};
+
+	/*!\brief Sample packing of Format7 frames
+	 *
+	 * Two samples are packed into three bytes, the high bits of the first
+	 * sample in byte 0, those of the second in byte 2, and the low bits of
+	 * the first and second sample in the low and high nibble of byte 1.
+	 * This is the Mono12Packed/Mono10Packed layout of GenICam and the
+	 * packed 12 bit layout of Point Grey cameras.
+	 */
+	enum pixel_packing {
+		/*!\brief Samples are whole bytes */
+		PACKED_NONE = 0,
+		/*!\brief Two 10 bit samples in three bytes */
+		PACKED_10 = 10,
+		/*!\brief Two 12 bit samples in three bytes */
+		PACKED_12 = 12
+	};
+
+	/*!\brief A rectangle of an image in pixels
+	 */
+	struct pixel_rect {
+		int x;
+		int y;
+		int width;
+		int height;
+	};
+
+	/*!\brief Converts a rectangle of one raw frame
+	 * \param src		packed source pixels, width * height samples
+	 * \param width		width of the source in pixels
+	 * \param height	height of the source in pixels
+	 * \param bits		significant bits per sample of the source, the data
+	 * 					depth of the frame
+	 * \param roi		rectangle of the output image to write, in output pixels
+	 * \param dst		first output pixel of the rectangle
+	 * \param stride	bytes between the starts of two output rows
+	 * \return 0 if success, <0 if failure
+	 */
+	typedef int (*pixel_converter)(const unsigned char* src, int width, int height, int bits,
+								   const pixel_rect& roi, unsigned char* dst, size_t stride);
+
+	/*!\brief A conversion chosen once for a color coding, bayer pattern,
+	 * debayer method and output order
+	 *
+	 * The converter is a template instantiation for that combination, so
+	 * the per frame loops run with constant strides and no pattern or
+	 * depth branches.
+	 */
+	struct pixel_pipeline {
+		pixel_converter convert;
+
+		/*!\brief Channels per output pixel */
+		int channels;
+		/*!\brief Bytes per output channel */
+		int bytes;
+		/*!\brief Output is (width >> shift) x (height >> shift) */
+		int shift;
+		/*!\brief convert ignores roi and stride and always writes the whole
+		 * packed frame, so a rectangle has to be copied out of it */
+		bool full_frame;
+
+		pixel_pipeline() : convert(NULL), channels(0), bytes(0), shift(0), full_frame(false) {}
+	};
+
+	/*!\brief Picks the debayer converter for a source format
+	 * \param coding	color coding of the camera frames, RAW/MONO 8 or 16
+	 * \param pattern	bayer pattern of the sensor
+	 * \param method	debayer method, NEAREST, SIMPLE, BILINEAR, HQLINEAR
+	 * 					and DOWNSAMPLE are native, the rest go through libdc1394
+	 * \param order		channel order of the output
+	 * \param pipe		filled in with the converter
+	 * \param depth		depth of the output, the libdc1394 methods only
+	 * 					support DEPTH_SOURCE
+	 * \return 0 if success, <0 if the combination is not supported
+	 */
+	int selectPipeline(dc1394color_coding_t coding, dc1394color_filter_t pattern,
+					   dc1394bayer_method_t method, pixel_order order, pixel_pipeline* pipe,
+					   pixel_depth depth = DEPTH_SOURCE);
+
+	/*!\brief Gets the bytes taken by packed samples
+	 * \param packing	the packing, not PACKED_NONE
+	 * \param pixels	number of samples, a multiple of two
+	 */
+	size_t packedBytes(pixel_packing packing, size_t pixels);
+
+	/*!\brief Unpacks samples to 16 bits, the values keep their bit depth
+	 * \param src		packed samples
+	 * \param pixels	number of samples, a multiple of two
+	 * \param packing	the packing, not PACKED_NONE
+	 * \param dst		room for pixels samples
+	 */
+	void unpackPixels(const unsigned char* src, size_t pixels, pixel_packing packing, uint16_t* dst);
+
+	/*!\brief Unpacks samples to their 8 most significant bits
+	 * \param src		packed samples
+	 * \param pixels	number of samples, a multiple of two
+	 * \param packing	the packing, not PACKED_NONE
+	 * \param dst		room for pixels samples
+	 */
+	void unpackPixels8(const unsigned char* src, size_t pixels, pixel_packing packing, uint8_t* dst);
+
+	/*!\brief Copies a rectangle between two strided images
+	 * \param src			first pixel of the source image
+	 * \param src_stride	bytes between two source rows
+	 * \param roi			rectangle of the source to copy
+	 * \param pixel_bytes	bytes per pixel of both images
+	 * \param dst			first pixel of the destination rectangle
+	 * \param dst_stride	bytes between two destination rows
+	 */
+	void copyRegion(const unsigned char* src, size_t src_stride, const pixel_rect& roi,
+					int pixel_bytes, unsigned char* dst, size_t dst_stride);
+};
+#endif
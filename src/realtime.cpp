@@ -0,0 +1,174 @@
+//realtime.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+
+#include "realtime.h"
+
+using namespace cam1394;
+
+/* from linux/mempolicy.h, so libnuma is not needed */
+#define CAM1394_MPOL_PREFERRED	1
+#define CAM1394_MPOL_F_NODE		(1 << 0)
+#define CAM1394_MPOL_F_ADDR		(1 << 1)
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static void currentThread(thread_report* report) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	report->cpus.clear();
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; c++)
+			if (CPU_ISSET(c, &set))
+				report->cpus.push_back(c);
+	}
+
+	struct sched_param param;
+	if (pthread_getschedparam(pthread_self(), &report->policy, &param) == 0)
+		report->priority = param.sched_priority;
+
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+		report->cpu  = cpu;
+		report->node = node;
+	}
+}
+
+int cam1394::applyThreadSettings(const std::vector<int>& cpus, int priority, thread_report* report) {
+	int ret = 0;
+
+	if (!cpus.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t i = 0; i < cpus.size(); i++)
+			if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+				CPU_SET(cpus[i], &set);
+
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err != 0) {
+			fprintf(stderr, "WARNING: Failed to set CPU affinity: %s\n", strerror(err));
+			ret = -1;
+		} else {
+			/* move now instead of at the next time slice so getcpu reports the new CPU */
+			sched_yield();
+		}
+	}
+
+	if (priority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err != 0) {
+			fprintf(stderr, "WARNING: Failed to set SCHED_FIFO priority %d: %s\n", priority, strerror(err));
+			ret = -1;
+		}
+	}
+
+	if (report != NULL)
+		currentThread(report);
+
+	return ret;
+}
+
+static void* mapPages(size_t size, bool huge) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+	if (huge)
+		flags |= MAP_HUGETLB;
+#else
+	if (huge)
+		return MAP_FAILED;
+#endif
+	return mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+int cam1394::allocHostBuffer(size_t size, int node, bool huge, bool lock, host_buffer* buf) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	host_buffer b;
+	void *data = MAP_FAILED;
+
+	b.size = size;
+
+	/* explicit huge pages need a reserved pool, fall back to normal pages without one */
+	if (huge) {
+		b.mapped = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+		data = mapPages(b.mapped, true);
+		b.huge = (data != MAP_FAILED);
+	}
+	if (data == MAP_FAILED) {
+		b.mapped = (size + page - 1) & ~(page - 1);
+		data = mapPages(b.mapped, false);
+	}
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map %zu bytes of frame memory: %s\n", size, strerror(errno));
+		return -1;
+	}
+	b.data = data;
+
+#ifdef MADV_HUGEPAGE
+	if (huge && !b.huge)
+		madvise(data, b.mapped, MADV_HUGEPAGE);
+#endif
+
+	if (node >= 0) {
+		unsigned long mask[16];
+		memset(mask, 0, sizeof(mask));
+		if (node < (int)(sizeof(mask) * 8)) {
+			mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+			if (syscall(SYS_mbind, data, b.mapped, CAM1394_MPOL_PREFERRED, mask, sizeof(mask) * 8, 0) != 0)
+				fprintf(stderr, "WARNING: Failed to place frame memory on node %d: %s\n", node, strerror(errno));
+		}
+	}
+
+	if (lock) {
+		/* mlock also faults every page in */
+		b.locked = (mlock(data, b.mapped) == 0);
+		if (!b.locked)
+			fprintf(stderr, "WARNING: Failed to lock frame memory: %s\n", strerror(errno));
+	}
+	if (!b.locked) {
+		for (size_t off = 0; off < b.mapped; off += page)
+			((volatile char*)data)[off] = 0;
+	}
+
+	int where = -1;
+	if (syscall(SYS_get_mempolicy, &where, NULL, 0, data, CAM1394_MPOL_F_NODE | CAM1394_MPOL_F_ADDR) == 0)
+		b.node = where;
+
+	*buf = b;
+	return 0;
+}
+
+void cam1394::freeHostBuffer(host_buffer* buf) {
+	if (buf->data != NULL) {
+		if (buf->locked)
+			munlock(buf->data, buf->mapped);
+		munmap(buf->data, buf->mapped);
+	}
+	*buf = host_buffer();
+}
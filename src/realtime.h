@@ -0,0 +1,135 @@
+//realtime.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file realtime.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <cstddef>
+#include <vector>
+
+namespace cam1394
+{
+	/*!\brief Scheduling and memory placement requested for a camera
+	 *
+	 * Applied by camera::open to the thread that opens the camera, which is
+	 * expected to be the thread that calls camera::read.
+	 */
+	struct realtime_settings {
+		/*!\brief CPUs the capture thread may run on, empty leaves the affinity alone */
+		std::vector<int> cpus;
+		/*!\brief SCHED_FIFO priority (1-99) of the capture thread, 0 keeps the default scheduler */
+		int priority;
+
+		/*!\brief CPUs for worker threads started by the library, empty leaves the affinity alone */
+		std::vector<int> worker_cpus;
+		/*!\brief SCHED_FIFO priority of worker threads, 0 keeps the default scheduler */
+		int worker_priority;
+
+		/*!\brief NUMA node of host frame buffers, -1 for the node the capture
+		 * thread runs on, -2 to leave placement to the kernel */
+		int numa_node;
+		/*!\brief Back host frame buffers with huge pages when available */
+		bool huge_pages;
+		/*!\brief mlock host frame buffers so they are never paged out */
+		bool lock_memory;
+
+		realtime_settings() : priority(0), worker_priority(0), numa_node(-2),
+			huge_pages(false), lock_memory(false) {}
+	};
+
+	/*!\brief What a thread actually got from applyThreadSettings
+	 */
+	struct thread_report {
+		/*!\brief CPUs the thread may run on */
+		std::vector<int> cpus;
+		/*!\brief Scheduling policy, SCHED_OTHER or SCHED_FIFO */
+		int policy;
+		/*!\brief Scheduling priority */
+		int priority;
+		/*!\brief CPU the thread was running on after the settings were applied */
+		int cpu;
+		/*!\brief NUMA node of that CPU */
+		int node;
+
+		thread_report() : policy(0), priority(0), cpu(-1), node(-1) {}
+	};
+
+	/*!\brief Host memory mapped by allocHostBuffer
+	 */
+	struct host_buffer {
+		void *data;
+		/*!\brief Bytes requested */
+		size_t size;
+		/*!\brief Bytes mapped, size rounded up to the page size */
+		size_t mapped;
+		/*!\brief NUMA node the first page landed on, -1 if unknown */
+		int node;
+		/*!\brief Backed by huge pages */
+		bool huge;
+		/*!\brief Locked into memory */
+		bool locked;
+
+		host_buffer() : data(NULL), size(0), mapped(0), node(-1), huge(false), locked(false) {}
+	};
+
+	/*!\brief What camera::open actually got for a realtime_settings
+	 */
+	struct realtime_report {
+		/*!\brief The thread that opened the camera */
+		thread_report capture;
+		/*!\brief Node host frame buffers are placed on, -1 if not placed */
+		int numa_node;
+		/*!\brief The newest host buffer, see host_buffer for what it got */
+		host_buffer buffer;
+
+		realtime_report() : numa_node(-1) {}
+	};
+
+	/*!\brief Sets the CPU affinity and scheduling of the calling thread
+	 *
+	 * Failures are reported as warnings and the thread keeps what it had,
+	 * report tells what it ended up with.
+	 * \param cpus		CPUs to run on, empty leaves the affinity alone
+	 * \param priority	SCHED_FIFO priority, 0 leaves the scheduler alone
+	 * \param report	filled in with the resulting settings, may be NULL
+	 * \return 0 if everything was applied, <0 if something was not
+	 */
+	int applyThreadSettings(const std::vector<int>& cpus, int priority, thread_report* report);
+
+	/*!\brief Maps zeroed host memory for frames
+	 *
+	 * The pages are placed and faulted in here so the capture loop never
+	 * takes a page fault on them.  Huge pages, the node and mlock are
+	 * best effort, buf tells what was actually done.
+	 * \param size		bytes to map
+	 * \param node		NUMA node to place the memory on, <0 for any node
+	 * \param huge		try huge pages first
+	 * \param lock		mlock the memory
+	 * \param buf		filled in with the mapping
+	 * \return 0 if success, <0 if no memory could be mapped
+	 */
+	int allocHostBuffer(size_t size, int node, bool huge, bool lock, host_buffer* buf);
+
+	/*!\brief Unmaps memory from allocHostBuffer and clears buf */
+	void freeHostBuffer(host_buffer* buf);
+};
+#endif
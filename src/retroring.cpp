@@ -0,0 +1,293 @@
+//retroring.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+#include <chrono>
+
+#include "retroring.h"
+#include "allocator.h"
+
+using namespace cam1394;
+
+/* frames start on cache lines in the arena */
+#define RETRO_ALIGN 64
+
+/* a dump stops waiting for frames after the event once none came for this long */
+#define RETRO_IDLE_MS 1000
+
+retro_ring::retro_ring() :
+	alloc(NULL), arena(NULL), capacity(0), window(0), oldest(0), next(0),
+	pinned(UINT64_MAX), rejected(0), busy(false), running(false) {}
+
+retro_ring::~retro_ring() {
+	close();
+}
+
+int retro_ring::open(size_t bytes, int max_frames, uint64_t window_us, const char* directory, frame_allocator* alloc) {
+	if (arena != NULL)
+		close();
+
+	if (bytes < RETRO_ALIGN || max_frames < 1) {
+		fprintf(stderr, "ERROR: Retro ring needs room for at least one frame\n");
+		return -1;
+	}
+
+	this->alloc = (alloc != NULL) ? alloc : heapAllocator();
+	arena = (unsigned char*)this->alloc->allocate(bytes);
+	if (arena == NULL) {
+		fprintf(stderr, "ERROR: Unable to allocate %zu bytes for the retro ring\n", bytes);
+		return -1;
+	}
+
+	dir      = (directory != NULL) ? directory : ".";
+	capacity = bytes;
+	window   = window_us;
+	entries.assign(max_frames, entry());
+	oldest   = 0;
+	next     = 0;
+	pinned   = UINT64_MAX;
+	rejected = 0;
+	running  = true;
+	thread   = std::thread(&retro_ring::writer, this);
+	return 0;
+}
+
+int retro_ring::close() {
+	if (arena == NULL)
+		return 0;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+	}
+	pushed.notify_all();
+	thread.join();
+
+	alloc->deallocate(arena);
+	arena = NULL;
+	entries.clear();
+	return 0;
+}
+
+/* Drops the oldest frame, false if a dump still needs it */
+bool retro_ring::evictOldest() {
+	if (oldest == next || oldest >= pinned)
+		return false;
+	oldest++;
+	return true;
+}
+
+/* Finds space after the newest frame, evicting the oldest until it fits */
+bool retro_ring::reserve(size_t space, size_t* offset) {
+	size_t n = entries.size();
+
+	while (true) {
+		if (oldest == next) {
+			*offset = 0;
+			return space <= capacity;
+		}
+
+		size_t start      = entries[oldest % n].offset;
+		const entry& last = entries[(next - 1) % n];
+		size_t end        = last.offset + last.space;
+
+		if (last.offset >= start) {
+			/* frames lie in [start, end), free space at both ends */
+			if (space <= capacity - end) {
+				*offset = end;
+				return true;
+			}
+			if (space <= start) {
+				*offset = 0;
+				return true;
+			}
+		} else if (space <= start - end) {
+			/* wrapped, free space between the newest and the oldest */
+			*offset = end;
+			return true;
+		}
+
+		if (!evictOldest())
+			return false;
+	}
+}
+
+int retro_ring::push(const frame_meta& meta, const void* data) {
+	size_t space = ((meta.size + RETRO_ALIGN - 1) / RETRO_ALIGN) * RETRO_ALIGN;
+	if (space == 0)
+		space = RETRO_ALIGN;
+
+	size_t offset;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (arena == NULL || !running)
+			return -1;
+		if (space > capacity) {
+			fprintf(stderr, "ERROR: Frame of %u bytes does not fit the retro ring\n", meta.size);
+			return -1;
+		}
+
+		if ((next - oldest == entries.size() && !evictOldest()) || !reserve(space, &offset)) {
+			rejected++;
+			return 0;
+		}
+	}
+
+	/* only this thread evicts, so the space stays ours without the lock */
+	memcpy(arena + offset, data, meta.size);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		entry& e = entries[next % entries.size()];
+		e.meta     = meta;
+		e.meta.seq = next;
+		e.offset   = offset;
+		e.space    = space;
+		next++;
+
+		while (window > 0 && next - oldest > 1 &&
+			   meta.timestamp - entries[oldest % entries.size()].meta.timestamp > window)
+			if (!evictOldest())
+				break;
+	}
+	pushed.notify_all();
+	return 1;
+}
+
+int retro_ring::push(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped) {
+	frame_meta meta;
+	describeFrame(image, guid, timestamp, dropped, &meta);
+	return push(meta, image->data);
+}
+
+int retro_ring::dump(uint64_t event_time, uint64_t before_us, uint64_t after_us, dump_callback cb, void* user) {
+	request req;
+	req.event    = event_time;
+	req.start    = (event_time > before_us) ? event_time - before_us : 0;
+	req.end      = event_time + after_us;
+	req.callback = cb;
+	req.user     = user;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!running) {
+			fprintf(stderr, "ERROR: Retro ring is not open\n");
+			return -1;
+		}
+		requests.push_back(req);
+	}
+	pushed.notify_all();
+	return 0;
+}
+
+int retro_ring::pending() {
+	std::lock_guard<std::mutex> guard(lock);
+	return requests.size() + (busy ? 1 : 0);
+}
+
+int retro_ring::frames() {
+	std::lock_guard<std::mutex> guard(lock);
+	return next - oldest;
+}
+
+size_t retro_ring::used() {
+	std::lock_guard<std::mutex> guard(lock);
+	size_t bytes = 0;
+	for (uint64_t s = oldest; s < next; s++)
+		bytes += entries[s % entries.size()].space;
+	return bytes;
+}
+
+uint64_t retro_ring::getRejected() {
+	std::lock_guard<std::mutex> guard(lock);
+	return rejected;
+}
+
+void retro_ring::writer() {
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true) {
+		pushed.wait(guard, [this] { return !requests.empty() || !running; });
+		if (requests.empty())
+			break;
+
+		request req = requests.front();
+		requests.pop_front();
+		busy = true;
+
+		guard.unlock();
+		write(req);
+		guard.lock();
+
+		busy = false;
+	}
+}
+
+/* Writes one dump, called from the writer thread without the lock */
+int retro_ring::write(const request& req) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/event_%llu.raw", dir.c_str(), (unsigned long long)req.event);
+
+	int written = 0, ret = 0;
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Unable to create %s\n", path);
+		ret = -1;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	uint64_t seq = oldest;
+	while (ret == 0) {
+		/* frames are never evicted at or after the pin */
+		pinned = seq;
+
+		if (seq == next) {
+			/* wait for the frames after the event while capture runs */
+			if (!running || !pushed.wait_for(guard, std::chrono::milliseconds(RETRO_IDLE_MS),
+											 [&] { return seq != next || !running; }))
+				break;
+			if (seq == next)
+				break;
+		}
+
+		const entry e = entries[seq % entries.size()];
+		if (e.meta.timestamp > req.end)
+			break;
+		seq++;
+		if (e.meta.timestamp < req.start)
+			continue;
+
+		guard.unlock();
+		if (fwrite(&e.meta, sizeof(e.meta), 1, file) != 1 ||
+			fwrite(arena + e.offset, 1, e.meta.size, file) != e.meta.size) {
+			fprintf(stderr, "ERROR: Unable to write frame %llu to %s\n", (unsigned long long)e.meta.seq, path);
+			ret = -1;
+		} else {
+			written++;
+		}
+		guard.lock();
+	}
+	pinned = UINT64_MAX;
+	guard.unlock();
+
+	if (file != NULL && fclose(file) != 0)
+		ret = -1;
+	if (req.callback != NULL)
+		req.callback(path, written, ret, req.user);
+	return ret;
+}
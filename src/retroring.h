@@ -0,0 +1,165 @@
+//retroring.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file retroring.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef RETRORING_H
+#define RETRORING_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.h"
+#include "shmring.h"
+
+namespace cam1394
+{
+	/*!\brief Called when a dump has been written
+	 * \param path		file the frames were written to
+	 * \param frames	number of frames written
+	 * \param result	0 if success, <0 if writing failed
+	 * \param user		pointer given to retro_ring::dump
+	 */
+	typedef void (*dump_callback)(const char* path, int frames, int result, void* user);
+
+	/*!
+	 * \class retro_ring
+	 * \brief Keeps the most recent frames of a camera for dumping after an event
+	 *
+	 * Frames are copied into one arena allocated by #open, and the oldest
+	 * ones are overwritten when the arena, the frame count or the time
+	 * window is full, so #push never allocates.  #dump hands a time window
+	 * to a writer thread and returns at once.
+	 *
+	 * Frames a dump has not written yet are never overwritten.  If the
+	 * writer falls behind and the arena fills up with them, #push rejects
+	 * new frames until it catches up.
+	 *
+	 * A dump file is a sequence of frame_meta records, each followed by
+	 * frame_meta::size bytes of pixels.
+	 */
+	class retro_ring
+	{
+	public:
+		retro_ring();
+		~retro_ring();
+
+		/*!\brief Allocates the arena and starts the writer thread
+		 * \param bytes		size of the arena
+		 * \param max_frames	most frames kept at once
+		 * \param window_us	oldest frame kept, relative to the newest, in
+		 * 					microseconds, 0 keeps as much as fits
+		 * \param directory	where dump files are created
+		 * \param alloc		allocator of the arena, NULL for the heap
+		 * \return 0 if success, <0 if failure
+		 */
+		int open(size_t bytes, int max_frames, uint64_t window_us, const char* directory, frame_allocator* alloc = NULL);
+
+		/*!\brief Finishes the queued dumps and frees the arena
+		 * \return 0 if success, <0 if failure
+		 */
+		int close();
+
+		/*!\brief Copies a frame into the ring
+		 * \param meta	metadata of the frame, seq is filled in
+		 * \param data	meta.size bytes of pixels
+		 * \return 1 if stored, 0 if a dump still needs the space, <0 if failure
+		 */
+		int push(const frame_meta& meta, const void* data);
+
+		/*!\brief Copies a frame read with camera::read or camera::readRaw
+		 * \return 1 if stored, 0 if a dump still needs the space, <0 if failure
+		 */
+		int push(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped);
+
+		/*!\brief Queues the frames around an event for writing
+		 *
+		 * Frames from event_time - before_us to event_time + after_us are
+		 * written to "<directory>/event_<event_time>.raw".  Frames after the
+		 * event are written as they are pushed.
+		 * \param event_time	timestamp of the event in microseconds
+		 * \param before_us		time before the event to write
+		 * \param after_us		time after the event to write
+		 * \param cb			called from the writer thread when done, may be NULL
+		 * \return 0 if queued, <0 if failure
+		 */
+		int dump(uint64_t event_time, uint64_t before_us, uint64_t after_us, dump_callback cb = NULL, void* user = NULL);
+
+		/*!\brief Gets the number of dumps queued or being written */
+		int pending();
+
+		/*!\brief Gets the number of frames held */
+		int frames();
+
+		/*!\brief Gets the bytes of the arena in use */
+		size_t used();
+
+		/*!\brief Gets the number of frames #push rejected */
+		uint64_t getRejected();
+
+	private:
+		struct entry {
+			frame_meta meta;
+			size_t offset;
+			size_t space;
+		};
+
+		struct request {
+			uint64_t event;
+			uint64_t start;
+			uint64_t end;
+			dump_callback callback;
+			void *user;
+		};
+
+		bool reserve(size_t space, size_t* offset);
+		bool evictOldest();
+		void writer();
+		int write(const request& req);
+
+		std::string dir;
+		frame_allocator *alloc;
+		unsigned char *arena;
+		size_t capacity;
+		uint64_t window;
+
+		/*!\brief entries[seq % max_frames] for oldest <= seq < next */
+		std::vector<entry> entries;
+		uint64_t oldest;
+		uint64_t next;
+		/*!\brief first frame the running dump still needs, UINT64_MAX if none */
+		uint64_t pinned;
+		uint64_t rejected;
+
+		std::mutex lock;
+		std::condition_variable pushed;
+		std::deque<request> requests;
+		bool busy;
+		bool running;
+		std::thread thread;
+	};
+};
+#endif
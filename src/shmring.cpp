@@ -0,0 +1,491 @@
+//shmring.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdio.h>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <atomic>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmring.h"
+
+using namespace cam1394;
+
+#define SHMRING_MAGIC   0x34393331
+#define SHMRING_VERSION 1
+#define SHMRING_ALIGN   64
+
+#define ALIGN_UP(x) (((x) + SHMRING_ALIGN - 1) & ~(size_t)(SHMRING_ALIGN - 1))
+
+namespace cam1394
+{
+	/* read cursor of one subscriber, pid is 0 when the cursor is free */
+	struct shmring_consumer {
+		std::atomic<int32_t> pid;
+		std::atomic<uint64_t> next;
+		std::atomic<uint64_t> skipped;
+		char pad[SHMRING_ALIGN - 24];
+	};
+
+	struct shmring_header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slots;
+		uint32_t reserved;
+		uint64_t slot_size;
+		uint64_t max_frame_size;
+
+		/* number of frames published so far */
+		std::atomic<uint64_t> head;
+		/* bumped on every publish, subscribers futex wait on it */
+		std::atomic<uint32_t> futex;
+		std::atomic<uint32_t> waiters;
+
+		shmring_consumer consumers[SHMRING_MAX_CONSUMERS] __attribute__((aligned(SHMRING_ALIGN)));
+	};
+
+	/* lock is 2*seq+1 while frame seq is being written and 2*seq+2 once it is complete */
+	struct shmring_slot {
+		std::atomic<uint64_t> lock;
+		frame_meta meta;
+	};
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+			  "shared memory ring needs lock free atomics");
+
+static inline shmring_slot* slotAt(shmring_header *h, uint64_t seq) {
+	uchar *base = (uchar*)h + ALIGN_UP(sizeof(shmring_header));
+	return (shmring_slot*)(base + (seq % h->slots) * h->slot_size);
+}
+
+static inline uchar* slotData(shmring_slot *slot) {
+	return (uchar*)slot + ALIGN_UP(sizeof(shmring_slot));
+}
+
+static inline long futex(std::atomic<uint32_t> *addr, int op, uint32_t val, const struct timespec *timeout) {
+	return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, NULL, 0);
+}
+
+/* Gets the number of bits per channel and channels of a packed image */
+static void imageFormat(int width, int height, int size, int32_t *channels, int32_t *bits) {
+	int bytes = (width > 0 && height > 0) ? size / (width * height) : 1;
+
+	*channels = (bytes % 3 == 0) ? 3 : 1;
+	*bits     = (bytes / *channels) * 8;
+}
+
+void cam1394::describeFrame(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped, frame_meta* meta) {
+	memset(meta, 0, sizeof(*meta));
+
+	meta->guid      = guid;
+	meta->timestamp = timestamp;
+	meta->dropped   = dropped;
+	meta->width     = image->width;
+	meta->height    = image->height;
+	meta->size      = image->size;
+	imageFormat(image->width, image->height, image->size, &meta->channels, &meta->bits);
+}
+
+frame_publisher::frame_publisher() : header(NULL), map_size(0), writing(false) {}
+
+frame_publisher::~frame_publisher() {
+	close();
+}
+
+int frame_publisher::open(const char* name, int slots, size_t max_frame_size) {
+	if (header != NULL)
+		close();
+
+	if (slots < 2) {
+		fprintf(stderr, "ERROR: A shared memory ring needs at least 2 slots\n");
+		return -1;
+	}
+
+	size_t slot_size = ALIGN_UP(sizeof(shmring_slot)) + ALIGN_UP(max_frame_size);
+	map_size = ALIGN_UP(sizeof(shmring_header)) + slots * slot_size;
+
+	/* subscribers of an old ring keep their mapping, new ones get this one */
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create shared memory %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, map_size) < 0) {
+		fprintf(stderr, "ERROR: Failed to size shared memory %s: %s\n", name, strerror(errno));
+		::close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map shared memory %s: %s\n", name, strerror(errno));
+		shm_unlink(name);
+		return -1;
+	}
+
+	/* ftruncate zero fills, which is a valid state for every atomic */
+	header = (shmring_header*)mem;
+	header->version        = SHMRING_VERSION;
+	header->slots          = slots;
+	header->slot_size      = slot_size;
+	header->max_frame_size = max_frame_size;
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic          = SHMRING_MAGIC;
+
+	_name = name;
+	return 0;
+}
+
+int frame_publisher::close() {
+	if (header == NULL)
+		return 0;
+
+	munmap(header, map_size);
+	shm_unlink(_name.c_str());
+	header = NULL;
+	writing = false;
+	return 0;
+}
+
+uchar* frame_publisher::begin() {
+	if (header == NULL)
+		return NULL;
+
+	uint64_t seq = header->head.load(std::memory_order_relaxed);
+	shmring_slot *slot = slotAt(header, seq);
+
+	if (!writing) {
+		slot->lock.store(2 * seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		writing = true;
+	}
+
+	return slotData(slot);
+}
+
+int64_t frame_publisher::commit(const frame_meta& meta) {
+	if (header == NULL || !writing) {
+		fprintf(stderr, "ERROR: No frame to commit\n");
+		return -1;
+	} else if (meta.size > header->max_frame_size) {
+		fprintf(stderr, "ERROR: Frame of %u bytes does not fit in the shared memory ring\n", meta.size);
+		return -1;
+	}
+
+	uint64_t seq = header->head.load(std::memory_order_relaxed);
+	shmring_slot *slot = slotAt(header, seq);
+
+	slot->meta     = meta;
+	slot->meta.seq = seq;
+	slot->lock.store(2 * seq + 2, std::memory_order_release);
+	header->head.store(seq + 1, std::memory_order_release);
+	writing = false;
+
+	/* seq_cst pairs with wait, so either the waiter sees the new head or
+	 * this sees the waiter, release/acquire allows both to miss */
+	header->futex.fetch_add(1, std::memory_order_seq_cst);
+	if (header->waiters.load(std::memory_order_seq_cst) > 0)
+		futex(&header->futex, FUTEX_WAKE, INT_MAX, NULL);
+
+	return seq;
+}
+
+int64_t frame_publisher::publish(const frame_meta& meta, const void* data) {
+	if (header == NULL) {
+		fprintf(stderr, "ERROR: Shared memory ring not open\n");
+		return -1;
+	} else if (meta.size > header->max_frame_size) {
+		fprintf(stderr, "ERROR: Frame of %u bytes does not fit in the shared memory ring\n", meta.size);
+		return -1;
+	}
+
+	memcpy(begin(), data, meta.size);
+	return commit(meta);
+}
+
+int64_t frame_publisher::publish(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped) {
+	frame_meta meta;
+	describeFrame(image, guid, timestamp, dropped, &meta);
+	return publish(meta, image->data);
+}
+
+int64_t frame_publisher::consumerLag(int consumer) {
+	if (header == NULL || consumer < 0 || consumer >= SHMRING_MAX_CONSUMERS)
+		return -1;
+
+	shmring_consumer& c = header->consumers[consumer];
+	if (c.pid.load(std::memory_order_acquire) == 0)
+		return -1;
+
+	return header->head.load(std::memory_order_acquire) - c.next.load(std::memory_order_acquire);
+}
+
+int64_t frame_publisher::consumerSkipped(int consumer) {
+	if (header == NULL || consumer < 0 || consumer >= SHMRING_MAX_CONSUMERS)
+		return -1;
+
+	shmring_consumer& c = header->consumers[consumer];
+	if (c.pid.load(std::memory_order_acquire) == 0)
+		return -1;
+
+	return c.skipped.load(std::memory_order_relaxed);
+}
+
+frame_subscriber::frame_subscriber() : header(NULL), map_size(0), consumer(-1) {}
+
+frame_subscriber::~frame_subscriber() {
+	close();
+}
+
+int frame_subscriber::open(const char* name) {
+	if (header != NULL)
+		close();
+
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to open shared memory %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < ALIGN_UP(sizeof(shmring_header))) {
+		fprintf(stderr, "ERROR: Shared memory %s is not a frame ring\n", name);
+		::close(fd);
+		return -1;
+	}
+
+	map_size = st.st_size;
+	void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map shared memory %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	header = (shmring_header*)mem;
+	if (header->magic != SHMRING_MAGIC || header->version != SHMRING_VERSION) {
+		fprintf(stderr, "ERROR: Shared memory %s is not a frame ring\n", name);
+		munmap(header, map_size);
+		header = NULL;
+		return -1;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	/* every slot the header declares must lie inside the mapping, divided so it can not overflow */
+	size_t slots_size = map_size - ALIGN_UP(sizeof(shmring_header));
+	if (header->slots < 2 || header->max_frame_size > header->slot_size ||
+		header->slot_size < ALIGN_UP(sizeof(shmring_slot)) + header->max_frame_size ||
+		slots_size / header->slots < header->slot_size) {
+		fprintf(stderr, "ERROR: Shared memory %s is smaller than the ring its header describes\n", name);
+		munmap(header, map_size);
+		header = NULL;
+		return -1;
+	}
+
+	/* claim a free cursor, or one left behind by a process that died */
+	int32_t self = getpid();
+	for (int i = 0; i < SHMRING_MAX_CONSUMERS && consumer < 0; i++) {
+		shmring_consumer& c = header->consumers[i];
+		int32_t pid = c.pid.load(std::memory_order_acquire);
+
+		if (pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH))
+			continue;
+
+		if (c.pid.compare_exchange_strong(pid, self)) {
+			c.skipped.store(0, std::memory_order_relaxed);
+			c.next.store(header->head.load(std::memory_order_acquire), std::memory_order_release);
+			consumer = i;
+		}
+	}
+
+	if (consumer < 0) {
+		fprintf(stderr, "ERROR: Shared memory %s already has %d subscribers\n", name, SHMRING_MAX_CONSUMERS);
+		munmap(header, map_size);
+		header = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int frame_subscriber::close() {
+	if (header == NULL)
+		return 0;
+
+	if (consumer >= 0)
+		header->consumers[consumer].pid.store(0, std::memory_order_release);
+
+	munmap(header, map_size);
+	header = NULL;
+	consumer = -1;
+	return 0;
+}
+
+uint64_t frame_subscriber::getSkipped() const {
+	if (header == NULL)
+		return 0;
+
+	return header->consumers[consumer].skipped.load(std::memory_order_relaxed);
+}
+
+size_t frame_subscriber::getMaxFrameSize() const {
+	if (header == NULL)
+		return 0;
+
+	return header->max_frame_size;
+}
+
+/* Waits until frame seq is published, returns 0 on timeout */
+int frame_subscriber::wait(uint64_t seq, int timeout_ms) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec  += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	/* seq_cst pairs with commit, see there */
+	header->waiters.fetch_add(1, std::memory_order_seq_cst);
+
+	int ret = 1;
+	while (1) {
+		uint32_t word = header->futex.load(std::memory_order_seq_cst);
+		if (header->head.load(std::memory_order_seq_cst) > seq)
+			break;
+
+		struct timespec remaining, *timeout = NULL;
+		if (timeout_ms >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec  = deadline.tv_sec - now.tv_sec;
+			remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) {
+				remaining.tv_sec--;
+				remaining.tv_nsec += 1000000000L;
+			}
+			if (remaining.tv_sec < 0) {
+				ret = 0;
+				break;
+			}
+			timeout = &remaining;
+		}
+
+		futex(&header->futex, FUTEX_WAIT, word, timeout);
+	}
+
+	header->waiters.fetch_sub(1, std::memory_order_acq_rel);
+	return ret;
+}
+
+int frame_subscriber::read(frame_meta* meta, void* dst, size_t dst_size, int timeout_ms) {
+	if (header == NULL) {
+		fprintf(stderr, "ERROR: Shared memory ring not open\n");
+		return -1;
+	}
+
+	shmring_consumer& c = header->consumers[consumer];
+
+	while (1) {
+		uint64_t next = c.next.load(std::memory_order_relaxed);
+		uint64_t head = header->head.load(std::memory_order_acquire);
+
+		if (next >= head) {
+			if (wait(next, timeout_ms) == 0)
+				return 0;
+			continue;
+		}
+
+		/* the slot after head is being rewritten, anything older than that is lost */
+		if (head - next >= header->slots) {
+			c.skipped.fetch_add(head - 1 - next, std::memory_order_relaxed);
+			next = head - 1;
+			c.next.store(next, std::memory_order_release);
+		}
+
+		shmring_slot *slot = slotAt(header, next);
+		uint64_t lock = slot->lock.load(std::memory_order_acquire);
+		if (lock != 2 * next + 2) {
+			/* the producer lapped us between reading head and the slot */
+			c.skipped.fetch_add(1, std::memory_order_relaxed);
+			c.next.store(next + 1, std::memory_order_release);
+			continue;
+		}
+
+		frame_meta m = slot->meta;
+		if (m.size > header->max_frame_size) {
+			/* a torn read of a slot being rewritten */
+			c.skipped.fetch_add(1, std::memory_order_relaxed);
+			c.next.store(next + 1, std::memory_order_release);
+			continue;
+		}
+		if (m.size > dst_size) {
+			fprintf(stderr, "ERROR: Frame of %u bytes does not fit in a %zu byte buffer\n", m.size, dst_size);
+			return -1;
+		}
+		memcpy(dst, slotData(slot), m.size);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->lock.load(std::memory_order_relaxed) != lock) {
+			c.skipped.fetch_add(1, std::memory_order_relaxed);
+			c.next.store(next + 1, std::memory_order_release);
+			continue;
+		}
+
+		*meta = m;
+		c.next.store(next + 1, std::memory_order_release);
+		return 1;
+	}
+}
+
+int frame_subscriber::read(frame_meta* meta, cam1394Image* image, int timeout_ms) {
+	if (header == NULL) {
+		fprintf(stderr, "ERROR: Shared memory ring not open\n");
+		return -1;
+	}
+
+	/* size the image for the largest frame so it is only allocated once */
+	if (image->reserve(header->max_frame_size, heapAllocator()) < 0) {
+		fprintf(stderr, "ERROR: Failed to allocate frame\n");
+		return -1;
+	}
+
+	int ret = read(meta, image->data, image->capacity, timeout_ms);
+	if (ret > 0) {
+		image->width  = meta->width;
+		image->height = meta->height;
+		image->size   = meta->size;
+	}
+
+	return ret;
+}
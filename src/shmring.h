@@ -0,0 +1,196 @@
+//shmring.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/*!
+ * \file shmring.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include "camera.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace cam1394
+{
+	/*!\brief Maximum number of subscribers attached to one ring */
+	const int SHMRING_MAX_CONSUMERS = 16;
+
+	/*!\brief Metadata stored next to every frame in a shared memory ring
+	 */
+	struct frame_meta {
+		/*!\brief Sequence number assigned by the publisher, starts at 0 */
+		uint64_t seq;
+		/*!\brief GUID of the camera the frame came from */
+		uint64_t guid;
+		/*!\brief Timestamp of the frame in microseconds, see camera::getTimestamp */
+		uint64_t timestamp;
+		/*!\brief Frames the camera read path dropped before this one */
+		int32_t dropped;
+		/*!\brief Width of the image in pixels */
+		int32_t width;
+		/*!\brief Height of the image in pixels */
+		int32_t height;
+		/*!\brief Channels per pixel, 1 for raw/mono and 3 for debayered */
+		int32_t channels;
+		/*!\brief Bits per channel */
+		int32_t bits;
+		/*!\brief Size of the pixel data in bytes */
+		uint32_t size;
+	};
+
+	/*!\brief Fills in the metadata of a frame read with camera::read
+	 * \param image		the frame, channels and bits are derived from its size
+	 * \param guid		GUID of the camera
+	 * \param timestamp	timestamp of the frame in microseconds
+	 * \param dropped	frames dropped before this one
+	 * \param meta		filled in, seq is set to 0
+	 */
+	void describeFrame(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped, frame_meta* meta);
+
+	struct shmring_header;
+	struct shmring_slot;
+
+	/*!
+	 * \class frame_publisher
+	 * \brief Writes frames once into a POSIX shared memory ring
+	 *
+	 * The producer never waits for subscribers.  Each slot is guarded by a
+	 * sequence lock, so a subscriber that falls more than a ring behind
+	 * skips to the newest frame instead of holding the producer back.
+	 */
+	class frame_publisher
+	{
+	public:
+		frame_publisher();
+		~frame_publisher();
+
+		/*!\brief Creates the shared memory ring
+		 * \param name			shm name, e.g. "/cam1394_00B09D0100AF05C1"
+		 * \param slots			number of frames kept in the ring
+		 * \param max_frame_size	largest frame in bytes that will be published
+		 * \return 0 if success, <0 if failure
+		 */
+		int open(const char* name, int slots, size_t max_frame_size);
+
+		/*!\brief Unmaps and unlinks the ring
+		 * \return 0 if success, <0 if failure
+		 */
+		int close();
+
+		/*!\brief Gets the slot the next frame will be written to
+		 *
+		 * Write the pixels straight into the returned buffer and call
+		 * #commit to publish them.
+		 * \return pointer to max_frame_size bytes, NULL if not open
+		 */
+		uchar* begin();
+
+		/*!\brief Publishes the frame written into the buffer from #begin
+		 * \param meta metadata of the frame, seq is filled in
+		 * \return sequence number of the frame, <0 if failure
+		 */
+		int64_t commit(const frame_meta& meta);
+
+		/*!\brief Copies a frame into the ring and publishes it
+		 * \return sequence number of the frame, <0 if failure
+		 */
+		int64_t publish(const frame_meta& meta, const void* data);
+
+		/*!\brief Publishes a frame read with camera::read
+		 * \return sequence number of the frame, <0 if failure
+		 */
+		int64_t publish(const cam1394Image* image, uint64_t guid, uint64_t timestamp, int dropped);
+
+		/*!\brief Gets how many frames a subscriber is behind the producer
+		 * \param consumer index of the subscriber
+		 * \return frames behind, <0 if the subscriber is not attached
+		 */
+		int64_t consumerLag(int consumer);
+
+		/*!\brief Gets how many frames a subscriber has skipped
+		 * \param consumer index of the subscriber
+		 * \return frames skipped, <0 if the subscriber is not attached
+		 */
+		int64_t consumerSkipped(int consumer);
+
+	private:
+		std::string _name;
+		shmring_header *header;
+		size_t map_size;
+		bool writing;
+	};
+
+	/*!
+	 * \class frame_subscriber
+	 * \brief Reads frames from a ring created by a frame_publisher
+	 */
+	class frame_subscriber
+	{
+	public:
+		frame_subscriber();
+		~frame_subscriber();
+
+		/*!\brief Attaches to a ring and claims a read cursor
+		 * \param name shm name passed to frame_publisher::open
+		 * \return 0 if success, <0 if failure
+		 */
+		int open(const char* name);
+
+		/*!\brief Releases the read cursor and unmaps the ring
+		 * \return 0 if success, <0 if failure
+		 */
+		int close();
+
+		/*!\brief Copies the next frame out of the ring
+		 *
+		 * If the subscriber has fallen a full ring behind it skips to the
+		 * newest frame and the number of frames lost is added to #getSkipped.
+		 * \param meta		filled in with the metadata of the frame
+		 * \param dst		buffer for the pixels
+		 * \param dst_size	size of dst, must hold frame_meta::size bytes
+		 * \param timeout_ms	time to wait for a frame, <0 waits forever
+		 * \return 1 if a frame was read, 0 on timeout, <0 if failure
+		 */
+		int read(frame_meta* meta, void* dst, size_t dst_size, int timeout_ms);
+
+		/*!\brief Reads the next frame into a cam1394Image, growing it if needed
+		 * \return 1 if a frame was read, 0 on timeout, <0 if failure
+		 */
+		int read(frame_meta* meta, cam1394Image* image, int timeout_ms);
+
+		/*!\brief Gets the index of the read cursor claimed by this subscriber */
+		int getConsumer() const { return consumer; }
+
+		/*!\brief Gets the number of frames skipped because the subscriber was too slow */
+		uint64_t getSkipped() const;
+
+		/*!\brief Gets the largest frame size in bytes the ring can hold */
+		size_t getMaxFrameSize() const;
+
+	private:
+		int wait(uint64_t seq, int timeout_ms);
+
+		shmring_header *header;
+		size_t map_size;
+		int consumer;
+	};
+};
+#endif
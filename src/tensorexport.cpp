@@ -0,0 +1,272 @@
+//tensorexport.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "tensorexport.h"
+
+using namespace cam1394;
+
+/* rows of the batch a thread takes at a time */
+#define EXPORT_CHUNK_ROWS 4
+
+/* ITU-R BT.601 luma weights */
+#define LUMA_R 0.299f
+#define LUMA_G 0.587f
+#define LUMA_B 0.114f
+
+tensor_exporter::tensor_exporter() : running(false), generation(0), busy(0), next_row(0) {}
+
+tensor_exporter::~tensor_exporter() {
+	stop();
+}
+
+int tensor_exporter::start(const tensor_settings& s) {
+	if (s.width <= 0 || s.height <= 0 || (s.channels != 1 && s.channels != 3)) {
+		fprintf(stderr, "ERROR: Tensors must be at least 1x1 with 1 or 3 channels\n");
+		return -1;
+	}
+	for (int c = 0; c < s.channels; c++) {
+		if (s.deviation[c] == 0) {
+			fprintf(stderr, "ERROR: Tensor plane %d has a deviation of 0\n", c);
+			return -1;
+		}
+	}
+
+	stop();
+	settings = s;
+	busy = 0;
+
+	int threads = settings.threads;
+	if (threads < 0)
+		threads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+
+	running = true;
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&tensor_exporter::workerLoop, this));
+
+	return 0;
+}
+
+void tensor_exporter::stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+	}
+	wake.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+size_t tensor_exporter::batchSize(size_t regions) {
+	return regions * settings.channels * settings.height * settings.width;
+}
+
+/* Taps of a source coordinate on the lattices of even and odd sites, a
+ * step of 2 for bayer frames and 1, with both parities the same, for mono */
+static void lattice(float s, int size, int step, int* index, float* weight) {
+	for (int p = 0; p < 2; p++) {
+		int origin = (step == 2) ? p : 0;
+		int count = (size - origin + step - 1) / step;
+		float u = (s - origin) / step;
+		int i = (int)floorf(u);
+		float f = u - i;
+
+		if (i < 0) {
+			i = 0;
+			f = 0;
+		} else if (i > count - 2) {
+			i = count - 2;
+			f = 1;
+		}
+		index[p]  = origin + i * step;
+		weight[p] = f;
+	}
+}
+
+void tensor_exporter::workerLoop() {
+	std::unique_lock<std::mutex> guard(lock);
+	/* the job of an earlier run may point at buffers that are gone */
+	uint64_t seen = generation;
+
+	while (1) {
+		wake.wait(guard, [&] { return !running || generation != seen; });
+		if (!running)
+			return;
+		seen = generation;
+
+		guard.unlock();
+		exportRows();
+		guard.lock();
+
+		if (--busy == 0)
+			done.notify_all();
+	}
+}
+
+void tensor_exporter::exportRows() {
+	int total = (int)job.rois->size() * settings.height;
+
+	while (1) {
+		int first = next_row.fetch_add(EXPORT_CHUNK_ROWS);
+		if (first >= total)
+			return;
+
+		int last = std::min(first + EXPORT_CHUNK_ROWS, total);
+		for (int r = first; r < last; r++)
+			exportRow(r / settings.height, r % settings.height);
+	}
+}
+
+/* Bilinear interpolation on one lattice */
+template<typename T>
+static inline float sample(const T* data, int width, int step, int row, float fy, int col, float fx) {
+	const T* r0 = data + (size_t)row * width + col;
+	const T* r1 = r0 + (size_t)step * width;
+	float top    = r0[0] + fx * ((float)r0[step] - r0[0]);
+	float bottom = r1[0] + fx * ((float)r1[step] - r1[0]);
+	return top + fy * (bottom - top);
+}
+
+template<typename T>
+static void fillRow(const T* data, int width, int step, dc1394color_filter_t pattern,
+					const int* rows, const float* fy, const int* cols, const float* fx, int count,
+					int channels, pixel_order order, const float* scale, const float* bias, float** planes) {
+	/* parity of the red sites, blue sits on the other parity in both directions */
+	int rx = (pattern == DC1394_COLOR_FILTER_GRBG || pattern == DC1394_COLOR_FILTER_BGGR) ? 1 : 0;
+	int ry = (pattern == DC1394_COLOR_FILTER_GBRG || pattern == DC1394_COLOR_FILTER_BGGR) ? 1 : 0;
+	int bx = 1 - rx, by = 1 - ry;
+
+	for (int x = 0; x < count; x++, cols += 2, fx += 2) {
+		float red, green, blue;
+
+		if (step == 1) {
+			red = green = blue = sample(data, width, 1, rows[0], fy[0], cols[0], fx[0]);
+		} else {
+			red   = sample(data, width, 2, rows[ry], fy[ry], cols[rx], fx[rx]);
+			blue  = sample(data, width, 2, rows[by], fy[by], cols[bx], fx[bx]);
+			green = 0.5f * (sample(data, width, 2, rows[ry], fy[ry], cols[bx], fx[bx]) +
+							sample(data, width, 2, rows[by], fy[by], cols[rx], fx[rx]));
+		}
+
+		if (channels == 1) {
+			planes[0][x] = (LUMA_R * red + LUMA_G * green + LUMA_B * blue) * scale[0] + bias[0];
+		} else {
+			float first = (order == PIXEL_RGB) ? red : blue;
+			float last  = (order == PIXEL_RGB) ? blue : red;
+			planes[0][x] = first * scale[0] + bias[0];
+			planes[1][x] = green * scale[1] + bias[1];
+			planes[2][x] = last  * scale[2] + bias[2];
+		}
+	}
+}
+
+void tensor_exporter::exportRow(int n, int y) {
+	const pixel_rect& roi = (*job.rois)[n];
+	int step = (job.pattern == 0) ? 1 : 2;
+
+	/* pixel centers of the output map to pixel centers of the region */
+	float sy = roi.y + (y + 0.5f) * roi.height / settings.height - 0.5f;
+	int rows[2];
+	float fy[2];
+	lattice(sy, job.height, step, rows, fy);
+
+	float *planes[3];
+	for (int c = 0; c < settings.channels; c++)
+		planes[c] = job.tensor + (((size_t)n * settings.channels + c) * settings.height + y) * settings.width;
+
+	size_t first = (size_t)n * settings.width * 2;
+	if (job.bytes == 2)
+		fillRow((const uint16_t*)job.data, job.width, step, job.pattern, rows, fy,
+				&column_index[first], &column_weight[first], settings.width,
+				settings.channels, settings.order, job.scale, job.bias, planes);
+	else
+		fillRow(job.data, job.width, step, job.pattern, rows, fy,
+				&column_index[first], &column_weight[first], settings.width,
+				settings.channels, settings.order, job.scale, job.bias, planes);
+}
+
+int tensor_exporter::run(const unsigned char* data, int width, int height, int bytes, int bits,
+						 dc1394color_filter_t pattern, const std::vector<pixel_rect>& rois, float* tensor) {
+	std::lock_guard<std::mutex> serial(exporting);
+
+	if (!running) {
+		fprintf(stderr, "ERROR: Tensor exporter is not started\n");
+		return -1;
+	}
+	if (bytes != 1 && bytes != 2) {
+		fprintf(stderr, "ERROR: Tensor export needs 1 or 2 bytes per sample\n");
+		return -1;
+	}
+
+	/* two sites of each parity in both directions */
+	int step = (pattern == 0) ? 1 : 2;
+	if (width < 2 * step || height < 2 * step) {
+		fprintf(stderr, "ERROR: Frame of %dx%d is too small to export\n", width, height);
+		return -1;
+	}
+
+	column_index.resize(rois.size() * settings.width * 2);
+	column_weight.resize(rois.size() * settings.width * 2);
+	for (size_t n = 0; n < rois.size(); n++) {
+		const pixel_rect& roi = rois[n];
+		if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+			roi.x + roi.width > width || roi.y + roi.height > height) {
+			fprintf(stderr, "ERROR: Region %dx%d+%d+%d is outside the %dx%d frame\n",
+					roi.width, roi.height, roi.x, roi.y, width, height);
+			return -1;
+		}
+
+		for (int x = 0; x < settings.width; x++) {
+			size_t at = (n * settings.width + x) * 2;
+			float sx = roi.x + (x + 0.5f) * roi.width / settings.width - 0.5f;
+			lattice(sx, width, step, &column_index[at], &column_weight[at]);
+		}
+	}
+
+	float full = (bytes == 2) ? (float)((1 << bits) - 1) : 255.0f;
+	for (int c = 0; c < settings.channels; c++) {
+		job.scale[c] = 1 / (full * settings.deviation[c]);
+		job.bias[c]  = -settings.mean[c] / settings.deviation[c];
+	}
+	job.data    = data;
+	job.width   = width;
+	job.height  = height;
+	job.bytes   = bytes;
+	job.pattern = pattern;
+	job.rois    = &rois;
+	job.tensor  = tensor;
+	next_row    = 0;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		busy = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	/* the caller takes rows too, then waits for the workers to finish theirs */
+	exportRows();
+
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [&] { return busy == 0; });
+	return 0;
+}
@@ -0,0 +1,143 @@
+//tensorexport.h
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+/*!
+ * \file tensorexport.h
+ *
+ * \author Yiying Li and Dylan Davis
+ */
+#ifndef TENSOREXPORT_H
+#define TENSOREXPORT_H
+
+#include <dc1394/dc1394.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pixelpipe.h"
+
+namespace cam1394
+{
+	/*!\brief Shape and normalization of the tensors of a tensor_exporter
+	 *
+	 * Each value is (sample / full scale - mean) / deviation of its channel.
+	 */
+	struct tensor_settings {
+		/*!\brief Width every region is resized to */
+		int width;
+		/*!\brief Height every region is resized to */
+		int height;
+		/*!\brief 3 for color planes, 1 for a luma plane */
+		int channels;
+		/*!\brief Order of the color planes */
+		pixel_order order;
+		/*!\brief Mean per plane, in the order of the planes */
+		float mean[3];
+		/*!\brief Standard deviation per plane, in the order of the planes */
+		float deviation[3];
+		/*!\brief Worker threads besides the caller, -1 for one less than the cores */
+		int threads;
+
+		tensor_settings() : width(224), height(224), channels(3), order(PIXEL_RGB), threads(-1) {
+			for (int i = 0; i < 3; i++) {
+				mean[i] = 0;
+				deviation[i] = 1;
+			}
+		}
+	};
+
+	/*!
+	 * \class tensor_exporter
+	 * \brief Writes regions of a raw frame into one float NCHW batch
+	 *
+	 * Debayering, resizing, normalizing and splitting into planes happen
+	 * in one pass.  Each output pixel interpolates every color bilinearly
+	 * on the lattice of its own bayer sites, green averaged over its two
+	 * lattices, so no full color frame is ever built.  Rows of the batch
+	 * are shared among the worker threads and the calling thread.
+	 */
+	class tensor_exporter
+	{
+	public:
+		tensor_exporter();
+		~tensor_exporter();
+
+		/*!\brief Sets the shape and starts the worker threads
+		 * \return 0 if success, <0 if failure
+		 */
+		int start(const tensor_settings& settings);
+
+		/*!\brief Stops the worker threads */
+		void stop();
+
+		/*!\brief Gets the floats a batch of regions takes */
+		size_t batchSize(size_t regions);
+
+		/*!\brief Exports regions of a raw frame
+		 * \param data		raw samples
+		 * \param width		width of the frame
+		 * \param height	height of the frame
+		 * \param bytes		bytes per sample, 1 or 2
+		 * \param bits		significant bits per sample
+		 * \param pattern	bayer pattern, 0 for mono frames
+		 * \param rois		regions in frame pixels, one tensor each
+		 * \param tensor	room for #batchSize floats
+		 * \return 0 if success, <0 if failure
+		 */
+		int run(const unsigned char* data, int width, int height, int bytes, int bits,
+				dc1394color_filter_t pattern, const std::vector<pixel_rect>& rois, float* tensor);
+
+	private:
+		struct batch {
+			const unsigned char* data;
+			int width;
+			int height;
+			int bytes;
+			dc1394color_filter_t pattern;
+			const std::vector<pixel_rect>* rois;
+			float* tensor;
+			float scale[3];
+			float bias[3];
+		};
+
+		void workerLoop();
+		void exportRows();
+		void exportRow(int n, int y);
+
+		tensor_settings settings;
+		std::vector<std::thread> workers;
+		std::mutex exporting;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+		bool running;
+		uint64_t generation;
+		int busy;
+
+		batch job;
+		std::atomic<int> next_row;
+		/* source column and weight of every output column of every region,
+		 * on the lattice of even and of odd sites */
+		std::vector<int> column_index;
+		std::vector<float> column_weight;
+	};
+};
+#endif
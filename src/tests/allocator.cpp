@@ -0,0 +1,129 @@
+//allocator.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "allocator.h"
+
+using namespace cam1394;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static bool aligned(void* ptr, size_t alignment) {
+	return ((uintptr_t)ptr & (alignment - 1)) == 0;
+}
+
+static void testAligned() {
+	size_t alignments[] = {16, 64, 4096};
+
+	for (int i = 0; i < 3; i++) {
+		aligned_allocator alloc(alignments[i]);
+		void *a = alloc.allocate(100);
+		void *b = alloc.allocate(1);
+		CHECK(a != NULL && b != NULL);
+		CHECK(aligned(a, alignments[i]));
+		CHECK(aligned(b, alignments[i]));
+		alloc.deallocate(a);
+		alloc.deallocate(b);
+	}
+}
+
+static void testArenaAlignment() {
+	arena_allocator arena(1 << 16, 64);
+	for (int i = 0; i < 20; i++) {
+		void *ptr = arena.allocate(1 + i * 37);
+		CHECK(ptr != NULL);
+		CHECK(aligned(ptr, 64));
+	}
+
+	/* a caller region that does not start aligned */
+	static unsigned char region[4096 + 64];
+	arena_allocator placed(region + 3, 4096, 64);
+	void *ptr = placed.allocate(10);
+	CHECK(ptr != NULL);
+	CHECK(aligned(ptr, 64));
+}
+
+static void testArenaReuse() {
+	arena_allocator arena(4096, 64);
+
+	void *a = arena.allocate(1000);
+	void *b = arena.allocate(1000);
+	size_t left = arena.remaining();
+	CHECK(a != NULL && b != NULL && a != b);
+
+	/* a freed block comes back for a request of up to its size */
+	arena.deallocate(a);
+	void *c = arena.allocate(900);
+	CHECK(c == a);
+	CHECK(arena.remaining() == left);
+
+	/* freeing twice must not hand the block out twice */
+	arena.deallocate(b);
+	arena.deallocate(b);
+	void *d = arena.allocate(1000);
+	void *e = arena.allocate(1000);
+	CHECK(d == b);
+	CHECK(e != b);
+
+	/* a pointer from elsewhere is ignored */
+	int other;
+	arena.deallocate(&other);
+	CHECK(arena.remaining() == left - 1024);
+}
+
+static void testArenaExhaustion() {
+	arena_allocator arena(4096, 64);
+
+	CHECK(arena.allocate(5000) == NULL);
+
+	void *blocks[4];
+	for (int i = 0; i < 4; i++) {
+		blocks[i] = arena.allocate(1024);
+		CHECK(blocks[i] != NULL);
+	}
+	CHECK(arena.remaining() == 0);
+	CHECK(arena.allocate(1) == NULL);
+
+	/* freed space is usable again, but not for larger requests */
+	arena.deallocate(blocks[2]);
+	CHECK(arena.allocate(2048) == NULL);
+	CHECK(arena.allocate(1024) == blocks[2]);
+}
+
+int main() {
+	testAligned();
+	testArenaAlignment();
+	testArenaReuse();
+	testArenaExhaustion();
+
+	if (failures > 0) {
+		printf("allocator: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("allocator: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,164 @@
+//binning.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "binning.h"
+
+using namespace cam1394;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Random samples with a share of the extremes */
+static int randomSample(int maxv) {
+	int r = rand() % 4;
+	if (r == 0)
+		return maxv;
+	if (r == 1)
+		return 0;
+	return rand() % (maxv + 1);
+}
+
+static int sampleAt(const std::vector<unsigned char>& frame, int bytes, size_t i) {
+	return (bytes == 2) ? ((const uint16_t*)&frame[0])[i] : frame[i];
+}
+
+static void setSample(std::vector<unsigned char>& frame, int bytes, size_t i, int v) {
+	if (bytes == 2)
+		((uint16_t*)&frame[0])[i] = (uint16_t)v;
+	else
+		frame[i] = (unsigned char)v;
+}
+
+/* Bins a mono frame one column of bins at a time, the rows are then
+ * narrower than any vector loop so only the scalar loops run */
+static int binColumns(const std::vector<unsigned char>& src, int width, int height, int bytes, int bits,
+					  int factor, bin_mode mode, std::vector<unsigned char>* dst) {
+	int out_width, out_height;
+	binnedSize(width, height, factor, false, &out_width, &out_height);
+	int out_bytes = binnedBytes(bytes, mode);
+	dst->assign((size_t)out_width * out_height * out_bytes, 0);
+
+	std::vector<unsigned char> strip((size_t)factor * height * bytes);
+	std::vector<unsigned char> binned((size_t)out_height * out_bytes);
+	for (int x = 0; x < out_width; x++) {
+		for (int y = 0; y < height; y++)
+			for (int i = 0; i < factor; i++)
+				setSample(strip, bytes, (size_t)y * factor + i, sampleAt(src, bytes, (size_t)y * width + x * factor + i));
+
+		if (binPixels(&strip[0], factor, height, bytes, bits, factor, false, mode, &binned[0]) < 0)
+			return -1;
+		for (int y = 0; y < out_height; y++)
+			setSample(*dst, out_bytes, (size_t)y * out_width + x, sampleAt(binned, out_bytes, y));
+	}
+
+	return 0;
+}
+
+static bool monoMatches(int width, int height, int bytes, int bits, int factor, bin_mode mode) {
+	std::vector<unsigned char> src((size_t)width * height * bytes);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		setSample(src, bytes, i, randomSample((1 << bits) - 1));
+
+	int out_width, out_height;
+	binnedSize(width, height, factor, false, &out_width, &out_height);
+	std::vector<unsigned char> whole((size_t)out_width * out_height * binnedBytes(bytes, mode)), columns;
+
+	if (binPixels(&src[0], width, height, bytes, bits, factor, false, mode, &whole[0]) < 0 ||
+		binColumns(src, width, height, bytes, bits, factor, mode, &columns) < 0)
+		return false;
+
+	return whole == columns;
+}
+
+/* A bayer bin is the mono bin of its color plane, the planes are binned
+ * column by column as above and interleaved again */
+static bool bayerMatches(int width, int height, int bytes, int bits, int factor, bin_mode mode) {
+	std::vector<unsigned char> src((size_t)width * height * bytes);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		setSample(src, bytes, i, randomSample((1 << bits) - 1));
+
+	int out_width, out_height;
+	binnedSize(width, height, factor, true, &out_width, &out_height);
+	int out_bytes = binnedBytes(bytes, mode);
+	std::vector<unsigned char> whole((size_t)out_width * out_height * out_bytes);
+	std::vector<unsigned char> planes(whole.size());
+
+	if (binPixels(&src[0], width, height, bytes, bits, factor, true, mode, &whole[0]) < 0)
+		return false;
+
+	int pw = width / 2, ph = height / 2;
+	std::vector<unsigned char> plane((size_t)pw * ph * bytes), binned;
+	for (int py = 0; py < 2; py++) {
+		for (int px = 0; px < 2; px++) {
+			for (int y = 0; y < ph; y++)
+				for (int x = 0; x < pw; x++)
+					setSample(plane, bytes, (size_t)y * pw + x, sampleAt(src, bytes, (size_t)(2 * y + py) * width + 2 * x + px));
+
+			if (binColumns(plane, pw, ph, bytes, bits, factor, mode, &binned) < 0)
+				return false;
+			for (int y = 0; y < out_height / 2; y++)
+				for (int x = 0; x < out_width / 2; x++)
+					setSample(planes, out_bytes, (size_t)(2 * y + py) * out_width + 2 * x + px,
+							  sampleAt(binned, out_bytes, (size_t)y * (out_width / 2) + x));
+		}
+	}
+
+	return whole == planes;
+}
+
+static void testBinning() {
+	int factors[] = {2, 4};
+	bin_mode modes[] = {BIN_AVERAGE, BIN_SUM};
+
+	for (int f = 0; f < 2; f++) {
+		for (int m = 0; m < 2; m++) {
+			/* widths that leave samples over after the vector loops */
+			CHECK(monoMatches(150, 12, 1, 8, factors[f], modes[m]));
+			CHECK(monoMatches(150, 12, 2, 12, factors[f], modes[m]));
+			CHECK(monoMatches(150, 12, 2, 16, factors[f], modes[m]));
+			CHECK(bayerMatches(150, 16, 1, 8, factors[f], modes[m]));
+			CHECK(bayerMatches(150, 16, 2, 10, factors[f], modes[m]));
+			CHECK(bayerMatches(150, 16, 2, 16, factors[f], modes[m]));
+		}
+	}
+}
+
+int main() {
+	srand(1);
+	testBinning();
+
+	if (failures > 0) {
+		printf("binning: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("binning: all checks passed\n");
+	return 0;
+}
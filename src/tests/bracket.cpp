@@ -0,0 +1,109 @@
+//bracket.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cmath>
+#include <vector>
+
+#include "bracket.h"
+
+using namespace cam1394;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Random samples with a share of black and full scale, which take the
+ * fallback to the longest and the shortest exposure */
+static int randomSample(int maxv) {
+	int r = rand() % 6;
+	if (r == 0)
+		return 0;
+	if (r == 1)
+		return maxv;
+	return rand() % (maxv + 1);
+}
+
+/* Merges a frame whole and again one pixel at a time, a single pixel
+ * never fills the four lanes of the vector loop.  The vector loop
+ * multiplies in another order, so results may differ by rounding. */
+static bool mergeMatches(int width, int height, int bytes, int bits, int count, int threads) {
+	size_t pixels = (size_t)width * height;
+	int maxv = (bytes == 2) ? (1 << bits) - 1 : 255;
+
+	std::vector<std::vector<unsigned char> > frames(count, std::vector<unsigned char>(pixels * bytes));
+	std::vector<const unsigned char*> samples(count);
+	std::vector<float> exposures(count);
+	for (int k = 0; k < count; k++) {
+		for (size_t i = 0; i < pixels; i++) {
+			if (bytes == 2)
+				((uint16_t*)&frames[k][0])[i] = (uint16_t)randomSample(maxv);
+			else
+				frames[k][i] = (unsigned char)randomSample(maxv);
+		}
+		samples[k]   = &frames[k][0];
+		exposures[k] = 100.0f * (k + 1) * (k + 1);
+	}
+
+	std::vector<float> whole(pixels), single(pixels);
+	if (mergeExposures(&samples[0], &exposures[0], count, width, height, bytes, bits, 0.98f, threads, &whole[0]) < 0)
+		return false;
+
+	std::vector<const unsigned char*> pixel(count);
+	for (size_t i = 0; i < pixels; i++) {
+		for (int k = 0; k < count; k++)
+			pixel[k] = samples[k] + i * bytes;
+		if (mergeExposures(&pixel[0], &exposures[0], count, 1, 1, bytes, bits, 0.98f, 1, &single[i]) < 0)
+			return false;
+	}
+
+	for (size_t i = 0; i < pixels; i++) {
+		if (std::fabs(whole[i] - single[i]) > 1e-5f * std::fabs(single[i]))
+			return false;
+	}
+	return true;
+}
+
+static void testMerge() {
+	/* pixel counts that leave samples over after the vector loop */
+	CHECK(mergeMatches(37, 5, 1, 8, 3, 1));
+	CHECK(mergeMatches(37, 5, 2, 12, 3, 1));
+	CHECK(mergeMatches(37, 5, 2, 16, 2, 1));
+	CHECK(mergeMatches(23, 9, 2, 10, 4, 3));
+	CHECK(mergeMatches(23, 9, 1, 8, 1, 3));
+}
+
+int main() {
+	srand(1);
+	testMerge();
+
+	if (failures > 0) {
+		printf("bracket: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("bracket: all checks passed\n");
+	return 0;
+}
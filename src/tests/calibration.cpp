@@ -0,0 +1,113 @@
+//calibration.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "calibration.h"
+
+using namespace cam1394;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Random values with a share of the extremes */
+static int randomValue(int maxv) {
+	int r = rand() % 8;
+	if (r == 0)
+		return 0;
+	if (r == 1)
+		return maxv;
+	return rand() % (maxv + 1);
+}
+
+/* Corrects a frame whole and again in pieces of fewer than the eight
+ * samples the vector loop takes, which only the scalar loop sees */
+static bool correctionMatches(int width, int height, int bytes, int bits) {
+	size_t n = (size_t)width * height;
+	int maxv = (1 << (8 * bytes)) - 1;
+
+	calibration_map map;
+	map.width  = width;
+	map.height = height;
+	for (size_t i = 0; i < n; i++) {
+		/* the gain reaches 4.0, far past where the products clip */
+		map.dark.push_back((uint16_t)randomValue(maxv / 4));
+		map.gain.push_back((uint16_t)randomValue(0xffff));
+	}
+
+	std::vector<unsigned char> src(n * bytes), whole(n * bytes), pieces(n * bytes);
+	for (size_t i = 0; i < n; i++) {
+		if (bytes == 2)
+			((uint16_t*)&src[0])[i] = (uint16_t)randomValue(maxv);
+		else
+			src[i] = (unsigned char)randomValue(maxv);
+	}
+
+	raw_corrector corrector;
+	if (corrector.setMap(map, false) < 0 || corrector.apply(&src[0], &whole[0], width, height, bytes, bits) < 0)
+		return false;
+
+	for (size_t i = 0; i < n; i += 7) {
+		int count = (int)std::min(n - i, (size_t)7);
+
+		calibration_map piece;
+		piece.width  = count;
+		piece.height = 1;
+		piece.dark.assign(map.dark.begin() + i, map.dark.begin() + i + count);
+		piece.gain.assign(map.gain.begin() + i, map.gain.begin() + i + count);
+
+		raw_corrector scalar;
+		if (scalar.setMap(piece, false) < 0 ||
+			scalar.apply(&src[i * bytes], &pieces[i * bytes], count, 1, bytes, bits) < 0)
+			return false;
+	}
+
+	return memcmp(&whole[0], &pieces[0], whole.size()) == 0;
+}
+
+static void testCorrection() {
+	CHECK(correctionMatches(37, 5, 1, 8));
+	CHECK(correctionMatches(37, 5, 2, 16));
+	CHECK(correctionMatches(21, 7, 2, 12));
+	CHECK(correctionMatches(21, 7, 2, 10));
+	CHECK(correctionMatches(3, 3, 2, 16));
+}
+
+int main() {
+	srand(1);
+	testCorrection();
+
+	if (failures > 0) {
+		printf("calibration: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("calibration: all checks passed\n");
+	return 0;
+}
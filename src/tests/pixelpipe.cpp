@@ -0,0 +1,138 @@
+//pixelpipe.cpp
+//Copyright (C) <2011, 2012>  <Yiying Li>
+//
+//This program is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//This program is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with this program.  If not, see <http://www.gnu.org/licenses/> .
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "pixelpipe.h"
+
+using namespace cam1394;
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/* Random samples with a share of the extremes, where the bias and
+ * saturation tricks of the vector paths go wrong first */
+static int randomSample(int maxv) {
+	int r = rand() % 8;
+	if (r == 0)
+		return 0;
+	if (r == 1)
+		return maxv;
+	return rand() % (maxv + 1);
+}
+
+/* The vector loop of a row only runs over at least four columns, so a
+ * frame converted one column at a time takes the scalar path throughout */
+static bool debayerMatches(dc1394color_coding_t coding, dc1394color_filter_t pattern,
+						   dc1394bayer_method_t method, pixel_order order, pixel_depth depth,
+						   int w, int h, int bits) {
+	pixel_pipeline pipe;
+	if (selectPipeline(coding, pattern, method, order, &pipe, depth) < 0)
+		return false;
+
+	int bytes = (coding == DC1394_COLOR_CODING_RAW16) ? 2 : 1;
+	int maxv = (1 << bits) - 1;
+	std::vector<unsigned char> src((size_t)w * h * bytes);
+	for (size_t i = 0; i < (size_t)w * h; i++) {
+		if (bytes == 2)
+			((uint16_t*)&src[0])[i] = (uint16_t)randomSample(maxv);
+		else
+			src[i] = (unsigned char)randomSample(maxv);
+	}
+
+	size_t stride = (size_t)w * pipe.channels * pipe.bytes;
+	std::vector<unsigned char> whole(stride * h), columns(stride * h);
+
+	pixel_rect all = {0, 0, w, h};
+	if (pipe.convert(&src[0], w, h, bits, all, &whole[0], stride) < 0)
+		return false;
+
+	for (int x = 0; x < w; x++) {
+		pixel_rect column = {x, 0, 1, h};
+		if (pipe.convert(&src[0], w, h, bits, column, &columns[(size_t)x * pipe.channels * pipe.bytes], stride) < 0)
+			return false;
+	}
+
+	return memcmp(&whole[0], &columns[0], whole.size()) == 0;
+}
+
+static void testDebayer() {
+	dc1394color_filter_t patterns[] = {DC1394_COLOR_FILTER_RGGB, DC1394_COLOR_FILTER_GBRG,
+									   DC1394_COLOR_FILTER_GRBG, DC1394_COLOR_FILTER_BGGR};
+	dc1394bayer_method_t methods[] = {DC1394_BAYER_METHOD_BILINEAR, DC1394_BAYER_METHOD_HQLINEAR};
+
+	for (int m = 0; m < 2; m++) {
+		for (int p = 0; p < 4; p++) {
+			/* widths that leave columns over after the vector loop */
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW8, patterns[p], methods[m], PIXEL_RGB, DEPTH_SOURCE, 38, 10, 8));
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW8, patterns[p], methods[m], PIXEL_BGR, DEPTH_SOURCE, 14, 8, 8));
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW16, patterns[p], methods[m], PIXEL_RGB, DEPTH_SOURCE, 38, 10, 16));
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW16, patterns[p], methods[m], PIXEL_BGR, DEPTH_SOURCE, 22, 8, 12));
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW16, patterns[p], methods[m], PIXEL_RGB, DEPTH_TONEMAP8, 30, 8, 12));
+			CHECK(debayerMatches(DC1394_COLOR_CODING_RAW16, patterns[p], methods[m], PIXEL_RGB, DEPTH_TONEMAP8, 26, 6, 16));
+		}
+	}
+}
+
+/* Two samples at a time never reach the vector loop */
+static void testUnpack() {
+	pixel_packing packings[] = {PACKED_10, PACKED_12};
+	size_t counts[] = {2, 10, 16, 18, 34, 1000};
+
+	for (int p = 0; p < 2; p++) {
+		for (int c = 0; c < 6; c++) {
+			size_t pixels = counts[c];
+			std::vector<unsigned char> src(packedBytes(packings[p], pixels));
+			for (size_t i = 0; i < src.size(); i++)
+				src[i] = (unsigned char)randomSample(255);
+
+			std::vector<uint16_t> whole(pixels), pairs(pixels);
+			unpackPixels(&src[0], pixels, packings[p], &whole[0]);
+			for (size_t i = 0; i < pixels; i += 2)
+				unpackPixels(&src[i / 2 * 3], 2, packings[p], &pairs[i]);
+
+			CHECK(whole == pairs);
+			for (size_t i = 0; i < pixels; i++)
+				CHECK(whole[i] < (1u << packings[p]));
+		}
+	}
+}
+
+int main() {
+	srand(1);
+	testDebayer();
+	testUnpack();
+
+	if (failures > 0) {
+		printf("pixelpipe: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("pixelpipe: all checks passed\n");
+	return 0;
+}